@@ -0,0 +1,397 @@
+/**************************************************************
+      > File Name: bench.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 15时10分26秒
+ **************************************************************/
+
+#include "flFTP.h"
+#include "flServer.h"
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <utility>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+using Rainbow::DataPort;
+using Rainbow::TransferInfo;
+using Rainbow::flFTP;
+using Rainbow::LoopbackServer;
+
+/* -j: one JSON object per result, to be compared across releases */
+static bool json = false;
+
+/* LoopbackServer::Content() repeats with this period */
+static const std::size_t ContentPeriod = 251;
+
+
+/*
+ * One line per result, "name key=value ..." or, with -j, 
+ * {"bench":"name","key":value,...}
+ */
+static void Report(const char *name, 
+		std::initializer_list<std::pair<const char *, double>> fields)
+{
+	if(json)
+		printf("{\"bench\":\"%s\"", name);
+	else
+		printf("%-10s", name);
+	for(auto &field : fields)
+	{
+		bool integral = (field.second == (double)(long long)field.second);
+		if(json)
+			printf(integral ? ",\"%s\":%.0f" : ",\"%s\":%.6g", field.first, field.second);
+		else
+			printf(integral ? " %s=%.0f" : " %s=%.3f", field.first, field.second);
+	}
+	printf(json ? "}\n" : "\n");
+	fflush(stdout);
+}
+
+
+static double ProcessCpuSeconds()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/*
+ * Listen on a loopback port chosen by the kernel
+ */
+static int ListenLoopback(int &port)
+{
+	int sd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if(sd < 0 || bind(sd, (sockaddr *)&sin, sizeof(sin)) < 0 ||
+			listen(sd, 1) < 0 || getsockname(sd, (sockaddr *)&sin, &len) < 0)
+	{
+		perror("listen");
+		exit(1);
+	}
+	port = ntohs(sin.sin_port);
+	return sd;
+}
+
+
+/* Send total bytes of LoopbackServer::Content() to the first to connect */
+static void ServeBytes(int ld, std::size_t total)
+{
+	int sd = accept(ld, NULL, NULL);
+	const std::size_t chunk = 1 << 20;
+	std::string pattern(chunk + ContentPeriod, '\0');
+	LoopbackServer::Content(0, &pattern[0], pattern.size());
+	std::size_t offset = 0;
+	while(sd >= 0 && offset < total)
+	{
+		ssize_t n = send(sd, pattern.data() + offset % ContentPeriod,
+				std::min(total - offset, chunk), 0);
+		if(n <= 0)
+			break;
+		offset += n;
+	}
+	close(sd);
+	close(ld);
+}
+
+
+/*
+ * Whether path holds total bytes of LoopbackServer::Content(); a path
+ * that keeps nothing, as /dev/null, passes
+ */
+static bool SameContent(const std::string &path, std::size_t total)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) < 0)
+		return false;
+	if(!S_ISREG(st.st_mode))
+		return true;
+	if((std::size_t)st.st_size != total)
+		return false;
+	FILE *fp = fopen(path.c_str(), "rb");
+	if(!fp)
+		return false;
+	std::vector<char> local(1 << 20), expect(1 << 20);
+	std::size_t offset = 0;
+	bool same = true;
+	while(same && offset < total)
+	{
+		std::size_t n = std::min(total - offset, local.size());
+		LoopbackServer::Content(offset, expect.data(), n);
+		same = (fread(local.data(), 1, n, fp) == n && memcmp(local.data(), expect.data(), n) == 0);
+		offset += n;
+	}
+	fclose(fp);
+	return same;
+}
+
+
+enum Backend
+{
+	Recv,
+	Uring,
+	Splice
+};
+
+
+/*
+ * Receive total bytes through a DataPort with the given buffer bounds,
+ * pipeline depth, backend and checksum stage
+ */
+static void BenchRecv(const char *name, std::size_t initial, std::size_t max,
+		unsigned int depth, Backend backend, std::size_t total, const std::string &path,
+		Rainbow::HashAlgorithm hash = Rainbow::HashNone)
+{
+	int port;
+	int ld = ListenLoopback(port);
+	std::thread server(ServeBytes, ld, total);
+
+	DataPort dataPort;
+	TransferInfo info;
+	dataPort.SetRecvBuffer(initial, max);
+	dataPort.SetPipelineDepth(depth);
+	dataPort.SetIoUring(backend == Uring);
+	dataPort.SetSplice(backend == Splice);
+	dataPort.SetHash(hash);
+	dataPort.SetBreakInfoFun([](const TransferInfo&){}, [](const TransferInfo&){});
+	if(dataPort.Connect("127.0.0.1", std::to_string(port)) < 0)
+	{
+		fprintf(stderr, "connect failed\n");
+		exit(1);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if(dataPort.GetFile(path, total, std::ios::out | std::ios::trunc | std::ios::binary,
+				info) < 0)
+	{
+		fprintf(stderr, "%s\n", dataPort.GetErrorDesc().c_str());
+		exit(1);
+	}
+	while(dataPort.State() == Rainbow::Transport)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	double seconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	server.join();
+
+	DataPort::RecvStats stats = dataPort.GetRecvStats();
+	if(dataPort.State() != Rainbow::Done || stats.recvBytes != total || !SameContent(path, total))
+	{
+		fprintf(stderr, "%s: received %zu of %zu bytes or not what was sent\n", name,
+				(std::size_t)stats.recvBytes, total);
+		exit(1);
+	}
+	if(depth <= 1)
+	{
+		Report(name, {{"bytes", stats.recvBytes}, {"recv_calls", stats.recvCalls},
+				{"buffer", stats.bufferSize}, {"seconds", seconds},
+				{"MB/s", stats.recvBytes / seconds / (1 << 20)}});
+		return;
+	}
+	DataPort::PipelineStats pipeline = dataPort.GetPipelineStats();
+	Report(name, {{"bytes", stats.recvBytes}, {"recv_calls", stats.recvCalls},
+			{"buffer", stats.bufferSize}, {"seconds", seconds},
+			{"MB/s", stats.recvBytes / seconds / (1 << 20)},
+			{"max_queue", pipeline.maxQueueDepth}, {"reader_stalls", pipeline.readerStalls},
+			{"reader_stall_seconds", pipeline.readerStallSeconds},
+			{"writer_stalls", pipeline.writerStalls},
+			{"writer_stall_seconds", pipeline.writerStallSeconds}});
+}
+
+
+/* A session on server, logged in, binary, resuming nothing */
+static std::unique_ptr<flFTP> Connect(LoopbackServer &server, bool pipelining)
+{
+	auto ftp = Rainbow::details::make_unique<flFTP>();
+	if(ftp->Connection("127.0.0.1", server.Port()) < 0 ||
+			ftp->AnonymousLogin() < 0 || ftp->SetTransferType(flFTP::Binary) < 0)
+	{
+		fprintf(stderr, "%s\n", ftp->GetErrorDesc().c_str());
+		exit(1);
+	}
+	ftp->SetBreakRecordMethod([](const TransferInfo&){ return (std::size_t)0; },
+			[](const TransferInfo&){}, [](const TransferInfo&){});
+	ftp->SetPipelining(pipelining);
+	return ftp;
+}
+
+
+/*
+ * Fetch one file of total bytes from the loopback server, over
+ * segments connections, or send it when upload. CPU is the client's:
+ * what the server's threads used is taken off the process total.
+ */
+static void BenchFile(const char *name, std::size_t total, unsigned int segments,
+		bool upload, const std::string &dir)
+{
+	LoopbackServer server;
+	if(server.Start() < 0)
+	{
+		fprintf(stderr, "%s\n", server.GetErrorDesc().c_str());
+		exit(1);
+	}
+	server.AddFile("/bench/file", total);
+	auto ftp = Connect(server, false);
+	if(ftp->Cd("/bench") < 0)
+	{
+		fprintf(stderr, "%s\n", ftp->GetErrorDesc().c_str());
+		exit(1);
+	}
+	if(upload)
+	{
+		/* something of the right size to send */
+		FILE *fp = fopen((dir + "file").c_str(), "w");
+		if(!fp || ftruncate(fileno(fp), total) < 0)
+		{
+			perror("upload source");
+			exit(1);
+		}
+		fclose(fp);
+	}
+
+	server.ResetStats();
+	double cpu = ProcessCpuSeconds();
+	auto start = std::chrono::steady_clock::now();
+	int ret;
+	if(upload)
+		ret = ftp->Upload("file", dir);
+	else if(segments > 1)
+		ret = ftp->SegmentedDownload("file", segments, dir);
+	else
+		ret = ftp->Download("file", dir);
+	if(ret < 0 || ftp->Wait() != Rainbow::Done)
+	{
+		fprintf(stderr, "%s: %s\n", name, ftp->GetErrorDesc().c_str());
+		exit(1);
+	}
+	double seconds = Seconds(start);
+	LoopbackServer::Stats stats = server.GetStats();
+	double clientCpu = ProcessCpuSeconds() - cpu - stats.cpuSeconds;
+	/*
+	 * The server keeps nothing of an upload but its size, and sends
+	 * each range on until the client has had enough
+	 */
+	bool same = upload ? stats.bytesReceived == total :
+		(segments > 1 || stats.bytesSent == total) && SameContent(dir + "file", total);
+	unlink((dir + "file").c_str());
+	if(!same)
+	{
+		fprintf(stderr, "%s: the file differs from what was sent\n", name);
+		exit(1);
+	}
+
+	Report(name, {{"bytes", total}, {"seconds", seconds},
+			{"MB/s", total / seconds / (1 << 20)},
+			{"cpu_seconds_per_GB", clientCpu / (total / double(1 << 30))},
+			{"commands", stats.commands}, {"turns", stats.turns}});
+}
+
+
+/*
+ * Fetch files small files one after another over one session, with 
+ * latency before each reply, and report the time each took and how
+ * many round trips to the server it needed
+ */
+static void BenchSmallFiles(const char *name, std::size_t files, std::size_t size,
+		std::chrono::microseconds latency, bool pipelining, const std::string &dir)
+{
+	LoopbackServer server;
+	if(server.Start() < 0)
+	{
+		fprintf(stderr, "%s\n", server.GetErrorDesc().c_str());
+		exit(1);
+	}
+	for(std::size_t i = 0; i < files; ++i)
+		server.AddFile("/small/f" + std::to_string(i), size);
+	server.SetLatency(latency);
+	auto ftp = Connect(server, pipelining);
+	if(ftp->Cd("/small") < 0)
+	{
+		fprintf(stderr, "%s\n", ftp->GetErrorDesc().c_str());
+		exit(1);
+	}
+
+	server.ResetStats();
+	std::vector<double> times;
+	auto start = std::chrono::steady_clock::now();
+	for(std::size_t i = 0; i < files; ++i)
+	{
+		const std::string file = "f" + std::to_string(i);
+		auto fileStart = std::chrono::steady_clock::now();
+		if(ftp->Download(file, dir) < 0 || ftp->Wait() != Rainbow::Done)
+		{
+			fprintf(stderr, "%s: %s\n", name, ftp->GetErrorDesc().c_str());
+			exit(1);
+		}
+		times.push_back(Seconds(fileStart) * 1000);
+		unlink((dir + file).c_str());
+	}
+	double seconds = Seconds(start);
+	LoopbackServer::Stats stats = server.GetStats();
+
+	std::sort(times.begin(), times.end());
+	Report(name, {{"files", files}, {"file_bytes", size},
+			{"latency_ms", latency.count() / 1000.0}, {"seconds", seconds},
+			{"files/s", files / seconds},
+			{"ms_per_file", seconds * 1000 / files},
+			{"p50_ms", times[times.size() / 2]},
+			{"p99_ms", times[std::min(times.size() - 1, times.size() * 99 / 100)]},
+			{"turns_per_file", stats.turns / (double)files},
+			{"commands_per_file", stats.commands / (double)files}});
+}
+
+
+/*
+ * flBench [-j] [MB] [output file] [work directory]
+ */
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && strcmp(argv[1], "-j") == 0)
+	{
+		json = true;
+		--argc;
+		++argv;
+	}
+	std::size_t total = (argc > 1 ? atoll(argv[1]) : 512) << 20;
+	std::string path = argc > 2 ? argv[2] : "/dev/null";
+	std::string dir = argc > 3 ? argv[3] : "/tmp";
+	if(dir.back() != '/')
+		dir += '/';
+
+	/* the old loop: 511 bytes per recv() */
+	BenchRecv("legacy", 511, 511, 1, Recv, total, path);
+	BenchRecv("adaptive", 0, 4 << 20, 1, Recv, total, path);
+	BenchRecv("pipelined", 0, 4 << 20, 4, Recv, total, path);
+	/* same as adaptive unless built with DFL_USE_IO_URING */
+	BenchRecv("io_uring", 0, 4 << 20, 1, Uring, total, path);
+	BenchRecv("splice", 0, 4 << 20, 1, Splice, total, path);
+	/* hashed as it arrives, each with the fastest kernel the CPU has */
+	BenchRecv("crc32c", 0, 4 << 20, 1, Recv, total, path, Rainbow::HashCrc32c);
+	BenchRecv("xxh64", 0, 4 << 20, 1, Recv, total, path, Rainbow::HashXxh64);
+	BenchRecv("sha256", 0, 4 << 20, 1, Recv, total, path, Rainbow::HashSha256);
+
+	/* whole sessions against the loopback server, files in dir */
+	BenchFile("download", total, 1, false, dir);
+	BenchFile("segmented", total, 4, false, dir);
+	BenchFile("upload", total, 1, true, dir);
+	BenchSmallFiles("small", 500, 4096, std::chrono::microseconds(0), false, dir);
+	BenchSmallFiles("small_rtt", 100, 4096, std::chrono::microseconds(2000), false, dir);
+	BenchSmallFiles("small_pipe", 100, 4096, std::chrono::microseconds(2000), true, dir);
+	return 0;
+}
@@ -0,0 +1,564 @@
+/**************************************************************
+      > File Name: flCache.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 21时26分04秒
+ **************************************************************/
+
+#include "flCache.h"
+#include "flHash.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#	define fsync(fd) _commit(fd)
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace Rainbow{
+
+	/*
+	 * File layout, every part 8 byte aligned:
+	 *   Header
+	 *   DirRecord of each directory, sorted by path
+	 *   FileRecord of each file, those of a directory together and
+	 *     sorted by name
+	 *   the paths and names, without terminators
+	 * Offsets of strings count from the start of their block.
+	 */
+	struct CacheHeader
+	{
+		char		magic[4];
+		uint32_t	version;
+		uint64_t	dirCount;
+		uint64_t	fileCount;
+		uint64_t	stringBytes;
+	};
+
+	struct MirrorCache::DirRecord
+	{
+		uint64_t	hash;
+		uint64_t	pathOffset;
+		uint64_t	firstFile;
+		uint32_t	pathLength;
+		uint32_t	fileCount;
+	};
+
+	struct MirrorCache::FileRecord
+	{
+		uint64_t	nameOffset;
+		int64_t		size;
+		int64_t		listedTime;
+		int64_t		mtime;
+		uint32_t	nameLength;
+		uint32_t	reserved;
+	};
+
+	static const char CacheMagic[4] = {'F', 'L', 'M', 'C'};
+	static const uint32_t CacheVersion = 1;
+
+	static_assert(sizeof(CacheHeader) == 32, "cache header layout");
+
+
+	static int WriteAll(int fd, const char *buf, std::size_t n)
+	{
+		while(n > 0)
+		{
+			int written = write(fd, buf, n);
+			if(written < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return -1;
+			}
+			buf += written;
+			n -= written;
+		}
+		return 0;
+	}
+
+
+	/* Gathers small writes into large ones */
+	class CacheWriter
+	{
+		public:
+			explicit CacheWriter(int fd): _fd(fd) {}
+
+			void Append(const void *data, std::size_t n)
+			{
+				_buffer.append((const char *)data, n);
+				if(_buffer.size() >= (1 << 20))
+					Flush();
+			}
+
+			int Flush()
+			{
+				if(!_failed && WriteAll(_fd, _buffer.data(), _buffer.size()) < 0)
+					_failed = true;
+				_buffer.clear();
+				return _failed ? -1 : 0;
+			}
+
+		private:
+			int			_fd;
+			bool		_failed = false;
+			std::string _buffer;
+	};
+
+
+	/* Whether path is root or lies below it */
+	static bool Under(const char *path, std::size_t n, const std::string &root)
+	{
+		std::size_t rootLength = root.size();
+		while(rootLength > 0 && root[rootLength - 1] == '/')
+			--rootLength;
+		if(n < rootLength || memcmp(path, root.data(), rootLength) != 0)
+			return false;
+		return n == rootLength || path[rootLength] == '/';
+	}
+
+
+	static int Compare(const char *a, std::size_t an, const char *b, std::size_t bn)
+	{
+		int ret = memcmp(a, b, std::min(an, bn));
+		if(ret != 0)
+			return ret;
+		return an < bn ? -1 : (an > bn ? 1 : 0);
+	}
+
+
+	uint64_t MirrorCache::ListingHash(const Listing &listing)
+	{
+		Xxh64 hash;
+		for(auto &entry : listing)
+		{
+			unsigned char type = entry.type;
+			hash.Update(&type, 1);
+			hash.Update(&entry.size, sizeof(entry.size));
+			hash.Update(&entry.mtime, sizeof(entry.mtime));
+			hash.Update(&entry.nameLength, sizeof(entry.nameLength));
+			hash.Update(entry.name, entry.nameLength);
+		}
+		return hash.Value();
+	}
+
+
+	int MirrorCache::Open(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		Unmap();
+		_pending.clear();
+		_kept.clear();
+		_path = path;
+		return Map();
+	}
+
+
+	int MirrorCache::Map()
+	{
+		int flags = O_RDONLY;
+#ifdef _WIN32 
+		/* the cache is binary, read without CRLF translation */
+		flags |= _O_BINARY;
+#endif
+		int fd = open(_path.c_str(), flags);
+		if(fd < 0)
+		{
+			if(errno == ENOENT)
+				return 0;
+			_errorMessage = "open cache error";
+			return -1;
+		}
+		struct stat st;
+		if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CacheHeader))
+		{
+			close(fd);
+			return 0;
+		}
+		_size = st.st_size;
+#ifdef _WIN32
+		/* no mmap here, read it whole instead */
+		char *data = new char[_size];
+		std::size_t got = 0;
+		while(got < _size)
+		{
+			int n = read(fd, data + got, _size - got);
+			if(n <= 0)
+				break;
+			got += n;
+		}
+		close(fd);
+		if(got < _size)
+		{
+			delete[] data;
+			_size = 0;
+			_errorMessage = "read cache error";
+			return -1;
+		}
+		_data = data;
+#else
+		void *data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(data == MAP_FAILED)
+		{
+			_size = 0;
+			_errorMessage = "map cache error";
+			return -1;
+		}
+		_data = (const char *)data;
+#endif
+
+		/*
+		 * Only the directory records are checked here, the file records
+		 * are checked as they are looked at, so a large cache opens
+		 * without being read through.
+		 */
+		CacheHeader header;
+		memcpy(&header, _data, sizeof(header));
+		uint64_t dirBytes = header.dirCount * sizeof(DirRecord);
+		uint64_t fileBytes = header.fileCount * sizeof(FileRecord);
+		bool valid = memcmp(header.magic, CacheMagic, 4) == 0 &&
+			header.version == CacheVersion &&
+			header.dirCount < _size && header.fileCount < _size &&
+			sizeof(CacheHeader) + dirBytes + fileBytes + header.stringBytes == _size;
+		const DirRecord *dirs = (const DirRecord *)(_data + sizeof(CacheHeader));
+		for(uint64_t i = 0; valid && i < header.dirCount; ++i)
+			valid = dirs[i].firstFile + dirs[i].fileCount <= header.fileCount &&
+				dirs[i].pathOffset + dirs[i].pathLength <= header.stringBytes;
+		if(!valid)
+		{
+			Unmap();
+			return 0;
+		}
+		_dirCount = header.dirCount;
+		_fileCount = header.fileCount;
+		_stringBytes = header.stringBytes;
+		return 0;
+	}
+
+
+	void MirrorCache::Unmap()
+	{
+		if(_data)
+		{
+#ifdef _WIN32
+			delete[] _data;
+#else
+			munmap((void *)_data, _size);
+#endif
+		}
+		_data = nullptr;
+		_size = 0;
+		_dirCount = 0;
+		_fileCount = 0;
+		_stringBytes = 0;
+	}
+
+
+	const MirrorCache::DirRecord *MirrorCache::FindDir(const std::string &dir) const
+	{
+		if(_dirCount == 0)
+			return nullptr;
+		const DirRecord *dirs = (const DirRecord *)(_data + sizeof(CacheHeader));
+		const char *strings = _data + _size - _stringBytes;
+		const DirRecord *found = std::lower_bound(dirs, dirs + _dirCount, dir,
+				[strings](const DirRecord &record, const std::string &path)
+				{
+					return Compare(strings + record.pathOffset, record.pathLength,
+						path.data(), path.size()) < 0;
+				});
+		if(found == dirs + _dirCount || Compare(strings + found->pathOffset,
+					found->pathLength, dir.data(), dir.size()) != 0)
+			return nullptr;
+		return found;
+	}
+
+
+	bool MirrorCache::Find(const std::string &dir, uint64_t &hash) const
+	{
+		const DirRecord *record = FindDir(dir);
+		if(!record)
+			return false;
+		hash = record->hash;
+		return true;
+	}
+
+
+	int64_t MirrorCache::Time(const std::string &dir, const ListEntry &entry) const
+	{
+		const DirRecord *record = FindDir(dir);
+		if(!record)
+			return -1;
+		const FileRecord *files = (const FileRecord *)(_data + sizeof(CacheHeader) +
+				_dirCount * sizeof(DirRecord)) + record->firstFile;
+		const char *strings = _data + _size - _stringBytes;
+		const std::size_t stringBytes = _stringBytes;
+		auto name = [strings, stringBytes](const FileRecord &file, std::size_t &n)
+		{
+			/* a damaged record reads as an empty name */
+			if(file.nameOffset + file.nameLength > stringBytes)
+			{
+				n = 0;
+				return strings;
+			}
+			n = file.nameLength;
+			return strings + file.nameOffset;
+		};
+
+		const FileRecord *found = std::lower_bound(files, files + record->fileCount, entry,
+				[&name](const FileRecord &file, const ListEntry &entry)
+				{
+					std::size_t n;
+					const char *p = name(file, n);
+					return Compare(p, n, entry.name, entry.nameLength) < 0;
+				});
+		if(found == files + record->fileCount)
+			return -1;
+		std::size_t n;
+		const char *p = name(*found, n);
+		if(Compare(p, n, entry.name, entry.nameLength) != 0 ||
+				found->size != entry.size || found->listedTime != entry.mtime)
+			return -1;
+		return found->mtime;
+	}
+
+
+	void MirrorCache::Put(const std::string &dir, uint64_t hash, std::vector<File> files)
+	{
+		std::sort(files.begin(), files.end(), [](const File &a, const File &b)
+				{
+					return a.name < b.name;
+				});
+		std::lock_guard<std::mutex> lk(_mt);
+		_kept.erase(dir);
+		Pending &pending = _pending[dir];
+		pending.hash = hash;
+		pending.files = std::move(files);
+	}
+
+
+	void MirrorCache::Keep(const std::string &dir)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		if(_pending.find(dir) == _pending.end())
+			_kept.insert(dir);
+	}
+
+
+	int MirrorCache::Save(const std::string &root)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		if(_path.empty())
+		{
+			_errorMessage = "cache not open";
+			return -1;
+		}
+
+		/* merge the mapped records with the pending ones, both sorted by path */
+		const DirRecord *dirs = nullptr;
+		const FileRecord *files = nullptr;
+		const char *strings = nullptr;
+		if(_data)
+		{
+			dirs = (const DirRecord *)(_data + sizeof(CacheHeader));
+			files = (const FileRecord *)(dirs + _dirCount);
+			strings = _data + _size - _stringBytes;
+		}
+		auto intact = [files, this](const DirRecord &dir)
+		{
+			for(uint32_t i = 0; i < dir.fileCount; ++i)
+			{
+				const FileRecord &file = files[dir.firstFile + i];
+				if(file.nameOffset + file.nameLength > _stringBytes)
+					return false;
+			}
+			return true;
+		};
+		struct Source
+		{
+			const DirRecord *old;
+			const std::pair<const std::string, Pending> *pending;
+		};
+		std::vector<Source> sources;
+		auto pending = _pending.begin();
+		for(std::size_t i = 0; i < _dirCount || pending != _pending.end(); )
+		{
+			int order = 1;
+			if(i < _dirCount && pending != _pending.end())
+				order = Compare(strings + dirs[i].pathOffset, dirs[i].pathLength,
+						pending->first.data(), pending->first.size());
+			else if(i < _dirCount)
+				order = -1;
+
+			if(order >= 0)
+			{
+				sources.push_back(Source{nullptr, &*pending});
+				++pending;
+				if(order == 0)
+					++i;
+				continue;
+			}
+			const DirRecord &dir = dirs[i++];
+			const char *path = strings + dir.pathOffset;
+			if((!Under(path, dir.pathLength, root) ||
+					_kept.count(std::string(path, dir.pathLength))) && intact(dir))
+				sources.push_back(Source{&dir, nullptr});
+		}
+
+		CacheHeader header;
+		memcpy(header.magic, CacheMagic, 4);
+		header.version = CacheVersion;
+		header.dirCount = sources.size();
+		header.fileCount = 0;
+		header.stringBytes = 0;
+		for(auto &source : sources)
+		{
+			if(source.old)
+			{
+				header.fileCount += source.old->fileCount;
+				header.stringBytes += source.old->pathLength;
+				for(uint32_t i = 0; i < source.old->fileCount; ++i)
+					header.stringBytes += files[source.old->firstFile + i].nameLength;
+			}
+			else
+			{
+				header.fileCount += source.pending->second.files.size();
+				header.stringBytes += source.pending->first.size();
+				for(auto &file : source.pending->second.files)
+					header.stringBytes += file.name.size();
+			}
+		}
+		uint64_t padding = (8 - header.stringBytes % 8) % 8;
+		header.stringBytes += padding;
+
+		const std::string tmpPath = _path + ".tmp";
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		int fd = open(tmpPath.c_str(), flags, 0644);
+		if(fd < 0)
+		{
+			_errorMessage = "open cache error";
+			return -1;
+		}
+		CacheWriter writer(fd);
+		writer.Append(&header, sizeof(header));
+
+		uint64_t stringOffset = 0;
+		uint64_t fileIndex = 0;
+		for(auto &source : sources)
+		{
+			DirRecord dir;
+			dir.pathOffset = stringOffset;
+			dir.firstFile = fileIndex;
+			if(source.old)
+			{
+				dir.hash = source.old->hash;
+				dir.pathLength = source.old->pathLength;
+				dir.fileCount = source.old->fileCount;
+				stringOffset += dir.pathLength;
+				for(uint32_t i = 0; i < dir.fileCount; ++i)
+					stringOffset += files[source.old->firstFile + i].nameLength;
+			}
+			else
+			{
+				dir.hash = source.pending->second.hash;
+				dir.pathLength = source.pending->first.size();
+				dir.fileCount = source.pending->second.files.size();
+				stringOffset += dir.pathLength;
+				for(auto &file : source.pending->second.files)
+					stringOffset += file.name.size();
+			}
+			fileIndex += dir.fileCount;
+			writer.Append(&dir, sizeof(dir));
+		}
+
+		stringOffset = 0;
+		for(auto &source : sources)
+		{
+			FileRecord record;
+			record.reserved = 0;
+			if(source.old)
+			{
+				stringOffset += source.old->pathLength;
+				for(uint32_t i = 0; i < source.old->fileCount; ++i)
+				{
+					record = files[source.old->firstFile + i];
+					record.nameOffset = stringOffset;
+					stringOffset += record.nameLength;
+					writer.Append(&record, sizeof(record));
+				}
+			}
+			else
+			{
+				stringOffset += source.pending->first.size();
+				for(auto &file : source.pending->second.files)
+				{
+					record.nameOffset = stringOffset;
+					record.size = file.size;
+					record.listedTime = file.listedTime;
+					record.mtime = file.mtime;
+					record.nameLength = file.name.size();
+					stringOffset += record.nameLength;
+					writer.Append(&record, sizeof(record));
+				}
+			}
+		}
+
+		for(auto &source : sources)
+		{
+			if(source.old)
+			{
+				writer.Append(strings + source.old->pathOffset, source.old->pathLength);
+				for(uint32_t i = 0; i < source.old->fileCount; ++i)
+				{
+					const FileRecord &file = files[source.old->firstFile + i];
+					writer.Append(strings + file.nameOffset, file.nameLength);
+				}
+			}
+			else
+			{
+				writer.Append(source.pending->first.data(), source.pending->first.size());
+				for(auto &file : source.pending->second.files)
+					writer.Append(file.name.data(), file.name.size());
+			}
+		}
+		const char zeros[8] = {0};
+		writer.Append(zeros, padding);
+
+		if(writer.Flush() < 0 || fsync(fd) < 0)
+		{
+			_errorMessage = "write cache error";
+			close(fd);
+			remove(tmpPath.c_str());
+			return -1;
+		}
+		close(fd);
+		/* nothing points into the old file any more */
+		Unmap();
+		if(rename(tmpPath.c_str(), _path.c_str()) < 0)
+		{
+			_errorMessage = "rename cache error";
+			remove(tmpPath.c_str());
+			Map();
+			return -1;
+		}
+		_pending.clear();
+		_kept.clear();
+		return Map();
+	}
+
+
+	MirrorCache::~MirrorCache()
+	{
+		Unmap();
+	}
+
+}	/* namespace Rainbow */
@@ -0,0 +1,112 @@
+#ifndef FLCACHE_H
+#define FLCACHE_H
+#include "flList.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+namespace Rainbow{
+
+	/*
+	 * What earlier Mirror() runs saw of each remote directory: a hash of
+	 * its listing and, for each file, the size and time the listing
+	 * showed beside the exact time MLSD or MDTM gave. The cache file is
+	 * memory mapped and searched in place, so opening one of millions
+	 * of files reads nothing up front. Changes stay in memory until
+	 * Save(), which writes a new file beside the old one and renames it
+	 * over. Lookups, Put and Keep may run from several threads, Open
+	 * and Save may not run beside them. The records are in host byte
+	 * order.
+	 */
+	class MirrorCache
+	{
+		public:
+			struct File
+			{
+				std::string name;
+				int64_t		size;
+				int64_t		listedTime;		/* as the listing showed it */
+				int64_t		mtime;			/* exact, -1 if never learned */
+			};
+
+			MirrorCache() = default;
+
+			MirrorCache(const MirrorCache&) = delete;
+			MirrorCache &operator=(const MirrorCache&) = delete;
+
+			/* Map path; a missing, foreign or damaged file is an empty cache */
+			int Open(const std::string &path);
+
+			/* The listing hash dir was last mirrored from, false if it never was */
+			bool Find(const std::string &dir, uint64_t &hash) const;
+
+			/*
+			 * The exact time cached for entry of dir, -1 unless its size
+			 * and listed time are still those cached
+			 */
+			int64_t Time(const std::string &dir, const ListEntry &entry) const;
+
+			/* dir has been mirrored from a listing hashed to hash */
+			void Put(const std::string &dir, uint64_t hash, std::vector<File> files);
+
+			/* dir has been mirrored again from the listing it is cached with */
+			void Keep(const std::string &dir);
+
+			/*
+			 * Write what was Put or Kept since Open(), and the old records
+			 * outside root. Old records under root that were neither are
+			 * dropped: their directories are gone or failed to mirror.
+			 */
+			int Save(const std::string &root);
+
+			/* Directories in the mapped file */
+			std::size_t Size() const
+			{
+				return _dirCount;
+			}
+
+			std::string GetErrorDesc()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _errorMessage;
+			}
+
+			/* Names, types, sizes and times of listing, in order */
+			static uint64_t ListingHash(const Listing &listing);
+
+			~MirrorCache();
+
+		private:
+			struct DirRecord;
+			struct FileRecord;
+
+			struct Pending
+			{
+				uint64_t hash;
+				std::vector<File> files;
+			};
+
+			const DirRecord *FindDir(const std::string &dir) const;
+
+			int Map();
+
+			void Unmap();
+
+			std::mutex _mt;
+			std::string _path;
+			std::string _errorMessage;
+			const char	*_data = nullptr;
+			std::size_t _size = 0;
+			std::size_t _dirCount = 0;
+			std::size_t _fileCount = 0;
+			std::size_t _stringBytes = 0;
+			std::map<std::string, Pending> _pending;
+			std::set<std::string> _kept;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLCACHE_H
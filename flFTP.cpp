@@ -6,18 +6,37 @@
  **************************************************************/
 
 #include "flFTP.h" 
+#include "flReactor.h"
+#include "flSession.h"
+#include "flJournal.h"
+#include "flList.h"
 #include "tinyxml2/tinyxml2.h"
 #include <cstring>
 #include <cstdlib>
 #include <cmath>
 #include <algorithm>
+#include <condition_variable>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/stat.h>
 #if defined(SOLARIS)
 #include <netinet/in.h>
 #endif
+#ifndef _WIN32 
+#include <sys/mman.h>
+#endif
 #ifdef __linux 
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <limits.h>
+#include <sys/sendfile.h>
+#endif
+#ifdef DFL_HAVE_IO_URING 
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
 #endif
 
 namespace Rainbow{
@@ -25,6 +44,8 @@ namespace Rainbow{
 #if defined(_WIN32) 
 #include <io.h>
 #include <windows.h>
+#	define fdatasync(fd) _commit(fd)
+#	define ftruncate(fd, size) _chsize_s(fd, size)
 #	define strcasecmp stricmp
 #	define access(...) _access(_VA_ARGS_)
 #	define F_OK	0
@@ -40,11 +61,19 @@ namespace Rainbow{
 #		define DFL_MAX_PATH 500 
 #	endif
 #endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 
 	thread_local  InterruptFlag this_thread_interrupt_flag;
 
+	/* std::max and std::min take them by reference, so they need a definition */
+	const std::size_t DataPort::MinRecvBuffer;
+	const std::size_t DataPort::MaxRecvBuffer;
+	const std::size_t ReplyBuffer::MaxReply;
+
 	socket_t connectsock(const std::string &host,
 					const std::string &service,
 					const std::string &transport)
@@ -128,6 +157,114 @@ namespace Rainbow{
 	}
 
 
+	/*
+	 * A CR held back that turns out not to start a CRLF is put back in
+	 * front, hence the spare byte. Sixteen bytes without a CR at a time
+	 * are moved as one, and only the blocks holding one are walked byte
+	 * by byte.
+	 */
+	std::size_t ToLocalText(char *data, std::size_t n, bool &pendingCR)
+	{
+		if(n == 0)
+			return 0;
+		if(pendingCR)
+		{
+			pendingCR = false;
+			if(data[0] != '\n')
+			{
+				memmove(data + 1, data, n);
+				data[0] = '\r';
+				++n;
+			}
+		}
+		/* whether it ends a line is only known with the next buffer */
+		if(data[n - 1] == '\r')
+		{
+			pendingCR = true;
+			--n;
+		}
+
+		char *out = data;
+		const char *in = data;
+		const char *end = data + n;
+		auto copy = [&](const char *stop)
+		{
+			for(; in < stop; ++in)
+			{
+				if(*in == '\r' && in + 1 < end && in[1] == '\n')
+					continue;
+				*out++ = *in;
+			}
+		};
+#if defined(__SSE2__)
+		const __m128i cr = _mm_set1_epi8('\r');
+		while(end - in >= 16)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i *)in);
+			if(_mm_movemask_epi8(_mm_cmpeq_epi8(block, cr)) != 0)
+			{
+				copy(in + 16);
+				continue;
+			}
+			/* out never passes in, so this only overwrites bytes already read */
+			if(out != in)
+				_mm_storeu_si128((__m128i *)out, block);
+			in += 16;
+			out += 16;
+		}
+#endif
+		copy(end);
+		return out - data;
+	}
+
+
+	/*
+	 * Write all n bytes at offset without moving a shared file position,
+	 * so several data ports can fill one file at once.
+	 */
+	static int WriteAt(int fd, const char *buf, std::size_t n, std::size_t offset)
+	{
+		while(n > 0)
+		{
+#ifdef _WIN32 
+			if(_lseeki64(fd, offset, SEEK_SET) < 0)
+				return -1;
+			int written = write(fd, buf, n);
+#else 
+			ssize_t written = pwrite(fd, buf, n, offset);
+#endif 
+			if(written < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return -1;
+			}
+			buf += written;
+			offset += written;
+			n -= written;
+		}
+		return 0;
+	}
+
+
+	/*
+	 * Reserve the blocks of [offset, offset + length) without changing
+	 * the size of the file. Only a hint: where it cannot be done the
+	 * blocks are allocated as writes reach them, as before.
+	 */
+	static void Preallocate(int fd, std::size_t offset, std::size_t length)
+	{
+#if defined(__linux) && defined(FALLOC_FL_KEEP_SIZE)
+		if(length > 0)
+			fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length);
+#else 
+		(void)fd;
+		(void)offset;
+		(void)length;
+#endif 
+	}
+
+
 //	static bool FileExists(const std::string &file)
 //	{
 //		if(access(file.c_str(), F_OK) == -1)
@@ -146,6 +283,43 @@ namespace Rainbow{
 	}
 
 
+	int SockClient::RecvBufferSize()
+	{
+		int size = 0;
+		socklen_t len = sizeof(size);
+		if(getsockopt(_sock, SOL_SOCKET, SO_RCVBUF, (char *)&size, &len) < 0)
+		{
+			SetLastError(SocketLastError);
+			return -1;
+		}
+		return size;
+	}
+
+
+	void SockClient::Shutdown()
+	{
+#ifdef _WIN32 
+		shutdown(_sock, SD_BOTH);
+#else 
+		shutdown(_sock, SHUT_RDWR);
+#endif
+	}
+
+
+	int SockClient::SetNonBlocking()
+	{
+#ifdef _WIN32 
+		u_long on = 1;
+		return ioctlsocket(_sock, FIONBIO, &on) == 0 ? 0 : -1;
+#else 
+		int flags = fcntl(_sock, F_GETFL, 0);
+		if(flags < 0)
+			return -1;
+		return fcntl(_sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+	}
+
+
 	int TcpSockClient::Send(const void *buffer, size_t n, int flags)
 	{
 		int sendBytes = send(_sock, (char *)buffer, n, flags);
@@ -172,12 +346,41 @@ namespace Rainbow{
 		return recvBytes;
 	}
 
+
+	int TcpSockClient::SendFile(int fd, std::size_t &offset, std::size_t n)
+	{
+#ifdef __linux__ 
+		off_t off = offset;
+		ssize_t sendBytes = sendfile(_sock, fd, &off, n);
+		if(sendBytes < 0)
+		{
+			SetLastError(SocketLastError);
+			return -1;
+		}
+		offset = off;
+		return sendBytes;
+#else 
+		char buffer[4096];
+		if(_lseeki64(fd, offset, SEEK_SET) < 0)
+			return -1;
+		int readBytes = read(fd, buffer, std::min<std::size_t>(n, sizeof(buffer)));
+		if(readBytes <= 0)
+			return readBytes;
+		int sendBytes = Send(buffer, readBytes, 0);
+		if(sendBytes > 0)
+			offset += sendBytes;
+		return sendBytes;
+#endif
+	}
+
 	
 	const std::map<std::string, std::string> CommPort::_errDescTable = {
 
 			{FTP_COMMAND_FAILED, "Command not implemented"},
 			{FTP_CANNOT_SERVICE, "Service not available, closing control connection"},
 			{FTP_CANNOT_OPEN_DATA_CONN, "Can't open data connection"},
+			{FTP_TRANSFER_ABORTED, "Connection closed, transfer aborted"},
+			{FTP_LOCAL_ERROR, "Requested action aborted, local error in processing"},
 			{FTP_NOT_ENOUGH_DISK_SPACE, "Requested action not taken: insufficient storage space in system"},
 			{FTP_FORMAT_ERROR, "Syntax error, command unrecognized"},
 			{FTP_PARAM_ERROR, "Syntax error in parameters or arguments."},
@@ -194,24 +397,231 @@ namespace Rainbow{
 	int CommPort::Recv(void *buf, size_t n, int flags,
 					const std::string &futureCode, std::string &errorDesc)
 	{
-		int recvBytes;
+		const char *reply;
+		int code;
+		int length = FillReply(std::chrono::milliseconds(-1), reply, code);
+		if(length <= 0)
+		{
+			errorDesc = "Recv error";
+			_errorMessage = errorDesc;
+			return -1;
+		}
+
 		char *p = (char *)buf;
-		recvBytes = _tcpSock->Recv(p, n, flags);
-		while(recvBytes > 0)
+		std::size_t copied = std::min((std::size_t)length, n);
+		memcpy(p, reply, copied);
+		if(copied < n)
+			p[copied] = '\0';
+		_replyBuffer.Consume();
+		Replied(code);
+		return CheckRespondCode(std::string(p, copied), futureCode, errorDesc);
+	}
+
+
+	void CommPort::Sent(const char *p, std::size_t n)
+	{
+		for(std::size_t i = 0; i < n; ++i)
 		{
-			p += recvBytes;
-			if(strcmp(p-2, "\r\n") == 0)
-				break;
-			n -= recvBytes;
-			recvBytes = _tcpSock->Recv(p, n, flags);
+			if(p[i] == '\n')
+			{
+				_outstanding.push_back(Outstanding{
+						Metrics::CommandOf(_sentName.data(), _sentName.size()),
+						std::chrono::steady_clock::now(), true});
+				_sentName.clear();
+				_sentNameDone = false;
+			}
+			else if(_sentNameDone || p[i] == ' ' || p[i] == '\r')
+				_sentNameDone = true;
+			else if(_sentName.size() < 8)
+				_sentName += p[i];
+		}
+	}
+
+
+	void CommPort::Replied(int code)
+	{
+		/* the greeting, or a reply to what was sent before the metrics */
+		if(!_metrics || _outstanding.empty())
+			return;
+		Outstanding command = _outstanding.front();
+		_outstanding.pop_front();
+		auto now = std::chrono::steady_clock::now();
+		if(command.timed)
+			_metrics->RecordReply(command.command, 
+					std::chrono::duration_cast<std::chrono::microseconds>(now - command.sent));
+		/* a transfer began, its end is yet to be told */
+		if(code >= 100 && code < 200)
+			_outstanding.push_front(Outstanding{command.command, now, false});
+	}
+
+
+	int CommPort::FillReply(std::chrono::milliseconds timeout, const char *&reply, int &code)
+	{
+		/* what a read asks for, replies are short but may come several at once */
+		const std::size_t chunk = 4096;
+
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::size_t length;
+		while(!_replyBuffer.Next(reply, length, code))
+		{
+			if(timeout.count() >= 0)
+			{
+				auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+						deadline - std::chrono::steady_clock::now());
+				if(left.count() <= 0)
+					return 0;
+				socket_t sock = _tcpSock->GetSocket();
+				fd_set readSet;
+				FD_ZERO(&readSet);
+				FD_SET(sock, &readSet);
+				struct timeval tv;
+				tv.tv_sec = left.count() / 1000000;
+				tv.tv_usec = left.count() % 1000000;
+				int ready = select(sock + 1, &readSet, nullptr, nullptr, &tv);
+				if(ready < 0 && errno != EINTR)
+					return -1;
+				if(ready <= 0)
+					continue;
+			}
+			char *space = _replyBuffer.Space(chunk);
+			if(!space)
+				return -1;
+			int recvBytes = _tcpSock->Recv(space, chunk, 0);
+			if(recvBytes == SOCKET_ERROR || recvBytes == 0)
+				return -1;
+			_replyBuffer.Commit(recvBytes);
+		}
+		return length;
+	}
+
+
+	int CommPort::Pipeline(std::vector<Pipelined> &commands)
+	{
+		if(commands.empty())
+			return 0;
+		std::chrono::milliseconds timeout(-1);
+		if(_pipelining && commands.size() > 1)
+		{
+			std::string batch;
+			for(auto &command : commands)
+				batch += command.command;
+			for(std::size_t sent = 0; sent < batch.size(); )
+			{
+				int n = Send(batch.data() + sent, batch.size() - sent, 0);
+				if(n <= 0)
+					return -1;
+				sent += n;
+			}
+			timeout = _pipelineTimeout;
 		}
-		if(recvBytes == SOCKET_ERROR || recvBytes == 0)
+
+		for(auto &command : commands)
 		{
-			errorDesc = "Recv error";
-			_errorMessage = errorDesc;
+			if(timeout.count() < 0 &&
+					Send(command.command.data(), command.command.size(), 0) <= 0)
+				return -1;
+			const char *reply;
+			int code;
+			int length = FillReply(timeout, reply, code);
+			if(length <= 0)
+			{
+				if(length == 0 || timeout.count() >= 0)
+				{
+					/* the server lost what was sent ahead, or hung up on it */
+					_pipelining = false;
+					_errorMessage = "pipelined commands unanswered";
+				}
+				else
+					_errorMessage = "Recv error";
+				return -1;
+			}
+			command.reply.assign(reply, length);
+			command.code = code;
+			_replyBuffer.Consume();
+			Replied(code);
+		}
+		return 0;
+	}
+
+
+	char *ReplyBuffer::Space(std::size_t n)
+	{
+		if(_write + n <= _data.size())
+			return _data.data() + _write;
+		if(_write - _read > MaxReply)
+			return nullptr;
+
+		/* move what is left to the front, the positions with it */
+		if(_read > 0)
+		{
+			memmove(_data.data(), _data.data() + _read, _write - _read);
+			_write -= _read;
+			_line -= _read;
+			_scan -= _read;
+			if(_end > 0)
+				_end -= _read;
+			_read = 0;
+		}
+		if(_write + n > _data.size())
+			_data.resize(std::max(_data.size() * 2, _write + n));
+		return _data.data() + _write;
+	}
+
+
+	int ReplyBuffer::Code(const char *p, std::size_t n)
+	{
+		if(n < 3 || !isdigit((unsigned char)p[0]) || !isdigit((unsigned char)p[1]) ||
+				!isdigit((unsigned char)p[2]))
 			return -1;
+		return (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+	}
+
+
+	bool ReplyBuffer::Next(const char *&reply, std::size_t &length, int &code)
+	{
+		while(_end == 0)
+		{
+			const char *data = _data.data();
+			const char *newline = nullptr;
+			if(_scan < _write)
+				newline = (const char *)memchr(data + _scan, '\n', _write - _scan);
+			if(!newline)
+			{
+				_scan = _write;
+				return false;
+			}
+			std::size_t lineEnd = newline - data + 1;
+			const char *line = data + _line;
+			std::size_t lineLength = lineEnd - _line;
+			/* the last line of "ddd-" is "ddd " or a bare "ddd" */
+			bool last = lineLength > 3 && (line[3] == ' ' || line[3] == '\r' || line[3] == '\n');
+			if(_line == _read)
+			{
+				_code = Code(line, lineLength);
+				if(_code < 0 || lineLength <= 3 || line[3] != '-')
+					_end = lineEnd;
+			}
+			else if(last && Code(line, lineLength) == _code)
+				_end = lineEnd;
+			_line = _scan = lineEnd;
 		}
-		return CheckRespondCode((char *)buf, futureCode, errorDesc);
+		reply = _data.data() + _read;
+		length = _end - _read;
+		code = _code;
+		return true;
+	}
+
+
+	void ReplyBuffer::Consume()
+	{
+		if(_end == 0)
+			return;
+		_read = _line = _scan = _end;
+		_end = 0;
+		_code = -1;
+		/* nothing left, start again at the front */
+		if(_read == _write)
+			_read = _write = _line = _scan = 0;
 	}
 
 
@@ -256,6 +666,22 @@ namespace Rainbow{
 		return size;
 	}
 
+
+	int64_t CommPort::ModifyTime(const std::string &filename)
+	{
+		char command[BUFFER];
+		snprintf(command, BUFFER, "MDTM %s\r\n", filename.c_str());
+
+		if(Send(command, strlen(command), 0) < 0)
+			return -1;
+
+		char message[BUFFER] = {0};
+		if(Recv(message, BUFFER - 1, 0, FTP_FILE_STATUS, _errorMessage) < 0)
+			return -1;
+
+		return ListParser::ParseTime(message + 4, strcspn(message + 4, "\r\n"));
+	}
+
 	
 	int CommPort::Cd(const std::string &path)
 	{
@@ -283,8 +709,98 @@ namespace Rainbow{
 		if(Recv(message, BUFFER - 1, 0, FTP_CURR_PATH, _errorMessage) < 0)
 			return std::string();
 
-		std::string path = message;
-		return path.substr(4, path.size()-6);
+		return ParsePwd(message);
+	}
+
+
+	std::string CommPort::ParsePwd(const std::string &reply)
+	{
+		/* 257 "<path>" is the current directory */
+		std::string path = reply;
+		std::string::size_type first = path.find('"');
+		std::string::size_type last = path.rfind('"');
+		if(first == std::string::npos || last == first)
+			return path.substr(4, path.size()-6);
+		return path.substr(first + 1, last - first - 1);
+	}
+
+
+	int CommPort::Command(const char *command, char *message)
+	{
+		memset(message, 0, BUFFER);
+		if(Send(command, strlen(command), 0) < 0)
+			return -1;
+		std::string errorDesc;
+		Recv(message, BUFFER - 1, 0, "", errorDesc);
+		if(!isdigit((unsigned char)message[0]))
+			return -1;
+		return atoi(message);
+	}
+
+
+	/*
+	 * The HASH command of draft-bryan-ftpext-hash first, then the older
+	 * XCRC and XMD5. A command the server does not know is not tried 
+	 * again on this connection.
+	 */
+	int CommPort::RangeHash(const std::string &filename, HashAlgorithm algorithm,
+			std::size_t start, std::size_t end, std::string &digest)
+	{
+		char command[BUFFER];
+		char message[BUFFER];
+		int code;
+
+		if(!(_unsupportedHash & HashCommandHash))
+		{
+			snprintf(command, BUFFER, "OPTS HASH %s\r\n", HashName(algorithm));
+			code = Command(command, message);
+			if(code < 0)
+				return -1;
+			if(code == 200)
+			{
+				/* the range ends inclusively */
+				snprintf(command, BUFFER, "RANG %zu %zu\r\n", start, end - 1);
+				code = Command(command, message);
+				if(code == 350)
+				{
+					snprintf(command, BUFFER, "HASH %s\r\n", filename.c_str());
+					code = Command(command, message);
+				}
+				/* 213 <algorithm> <start>-<end> <digest> <filename> */
+				char hex[BUFFER];
+				if(code == 213 && sscanf(message, "%*s %*s %*s %511s", hex) == 1)
+				{
+					digest = hex;
+					return 0;
+				}
+			}
+			if(code < 0)
+				return -1;
+			/* 501 and 504 only refuse this algorithm */
+			if(code == 500 || code == 502)
+				_unsupportedHash |= HashCommandHash;
+		}
+
+		unsigned int bit = (algorithm == HashCrc32 ? HashCommandXcrc : 
+				algorithm == HashMd5 ? HashCommandXmd5 : 0);
+		if(bit == 0 || (_unsupportedHash & bit))
+		{
+			_errorMessage = "hash not supported";
+			return -1;
+		}
+		snprintf(command, BUFFER, "%s %s %zu %zu\r\n", bit == HashCommandXcrc ? "XCRC" : "XMD5",
+				filename.c_str(), start, end);
+		code = Command(command, message);
+		char hex[BUFFER];
+		if(code == 250 && sscanf(message, "%*s %511s", hex) == 1)
+		{
+			digest = hex;
+			return 0;
+		}
+		if(code >= 500)
+			_unsupportedHash |= bit;
+		_errorMessage = "hash not supported";
+		return -1;
 	}
 
 
@@ -309,10 +825,15 @@ namespace Rainbow{
 		int port;
 		char *p1, *p2, *end;
 		end = strrchr(message, ')');
-		*end = 0x00;
+		if(end)
+			*end = 0x00;
 		p2 = strrchr(message, ',');
+		if(!p2)
+			return -1;
 		*p2 = 0x00;
 		p1 = strrchr(message, ',');
+		if(!p1)
+			return -1;
 		port = atoi(p1+1) * 256 + atoi(p2+1);
 		return port;
 	}
@@ -349,85 +870,1721 @@ namespace Rainbow{
 	}
 
 
-	int DataPort::GetFile(const std::string &filename, std::size_t fileSize,
-			std::ios_base::openmode mode, TransferInfo &info)
+	int CommPort::Put(const std::string &filename, bool append)
 	{
-		_fout.open(filename, mode);
-		if(_fout.fail())
+		char command[BUFFER];
+		snprintf(command, BUFFER, "%s %s\r\n", append ? "APPE" : "STOR", 
+				filename.c_str());
+
+		if(Send(command, strlen(command), 0) < 0)
 		{
-			_errorMessage = "open file error";
 			return -1;
 		}
 
-		auto fun = std::bind(&DataPort::RecviceFile, this, 
-				std::ref(_fout), mode, fileSize, std::ref(info));
-		_recvThread = Thread(fun);
-
-		return 0;
+		char message[BUFFER] = {0};
+		return Recv(message, BUFFER - 1, 0, FTP_FILE_READY_OK, _errorMessage);
 	}
 
 
-	void DataPort::RecviceFile(std::ofstream &fout, std::ios_base::openmode mode,
-			std::size_t size, TransferInfo &info)
+	int CommPort::List(const std::string &path, bool &mlsd)
 	{
-		char message[FileBuffer];
-		size_t recvSize = fout.tellp();
-		double percentage = 0;
-
-		int recvBytes = _tcpSock->Recv(message, FileBuffer - 1, 0);
-		while(recvBytes != SOCKET_ERROR && recvBytes > 0)
+		char command[BUFFER];
+		char message[BUFFER];
+		mlsd = !_noMlsd;
+		snprintf(command, BUFFER, "%s%s%s\r\n", mlsd ? "MLSD" : "LIST", 
+				path.empty() ? "" : " ", path.c_str());
+		int code = Command(command, message);
+		/* a server without MLSD is not asked again */
+		if(mlsd && (code == 500 || code == 502))
+			_noMlsd = true;
+		if(code < 0)
+			_errorMessage = "Recv error";
+		else if(code != 150 && code != 125)
 		{
-			recvSize += recvBytes;
-			if(mode & std::ofstream::binary)
-			{
-				fout.write(message, recvBytes);
-			}
-			else 
-			{
-				message[recvBytes] = '\0';
-				fout << message;
-			}
+			auto search = _errDescTable.find(std::string(message, 3));
+			_errorMessage = (search != _errDescTable.end() ? search->second : "Unknow error");
+		}
+		return code;
+	}
 
-			percentage = recvSize / (double)size;
-			for(auto elem : _progressList)
-			{
-				elem->DoProgress(percentage);
-			}
-			if(this_thread_interrupt_flag.is_set())
-			{
-				std::lock_guard<std::mutex> lk(_mt);
-				info.offset = recvSize;
-				_putBreakPointFunc(info);
-				_transferState = TransferState::Suspend;
-				fout.flush();
-				fout.close();
-				return;
-			}
 
-			recvBytes = _tcpSock->Recv(message, BUFFER - 1, 0);
+	int DataPort::OpenFile(const std::string &filename, int flags)
+	{
+		_fd = open(filename.c_str(), flags, 0644);
+		if(_fd < 0)
+		{
+			_errorMessage = "open file error";
+			return -1;
 		}
+		return 0;
+	}
+
 
+	int DataPort::GetFile(const std::string &filename, std::size_t fileSize,
+			std::ios_base::openmode mode, TransferInfo &info)
+	{
+		int flags = O_WRONLY | O_CREAT;
+		if(mode & std::ios::trunc)
+			flags |= O_TRUNC;
+#ifdef _WIN32 
+		/* CRLF is the local convention already, the bytes go as they are */
+		flags |= _O_BINARY;
+		_text = false;
+#else
+		_text = !(mode & std::ios::binary);
+#endif
+		_pendingCR = false;
+		/* the previous transfer's thread has ended or is about to */
+		if(_recvThread.Joinable())
+			_recvThread.Join();
 		{
+			/* a mapping not taken goes with the next download */
 			std::lock_guard<std::mutex> lk(_mt);
-			if(recvBytes == SOCKET_ERROR)
+			_mapped.reset();
+		}
+		_ranged = false;
+		_reserved = 0;
+		int mapped = MapOutput(filename, flags, fileSize, 
+				(mode & std::ios::app) ? info.offset : 0);
+		if(mapped < 0)
+			return -1;
+		if(mapped > 0)
+		{
+			if(OpenFile(filename, flags) < 0)
+				return -1;
+
+			/*
+			 * A checkpoint may lag what reached the file, resume from it.
+			 * REST has the server send from there, so written anywhere
+			 * else the bytes would corrupt the file: fail instead, and
+			 * close the data connection so the server ends the transfer.
+			 */
+			_writeOffset = (mode & std::ios::app) ? info.offset : 0;
+			if(_writeOffset > 0 && ftruncate(_fd, _writeOffset) < 0)
 			{
-				info.offset = recvSize;
-				_putBreakPointFunc(info);
-				_transferState = TransferState::NetworkAnomaly;
+				_errorMessage = "truncate file error";
+				close(_fd);
+				_fd = -1;
+				_tcpSock->Close();
+				return -1;
 			}
-			else 
+			if(_preallocate && fileSize != (std::size_t)-1 && fileSize > _writeOffset)
 			{
-				_transferState = TransferState::Done;
-				_deleteBreakPointFunc(info);
+				Preallocate(_fd, _writeOffset, fileSize - _writeOffset);
+				_reserved = fileSize;
 			}
 		}
-		fout.flush();
-		fout.close();
-	}
+		/* a resumed download reads back what it had, once, to hash the whole */
+		_hash = MakeHash(_hashAlgorithm);
+		if(_hash && _writeOffset > 0 && HashFile(filename, 0, _writeOffset, *_hash) < 0)
+			_hash.reset();
+		_checkpointOffset = _writeOffset;
+		_checkpointTime = std::chrono::steady_clock::now();
+		_sharedReceived.reset();
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_transferState = TransferState::Transport;
+		}
 
+		BeginTransfer(false, fileSize);
+		if(_reactor && !_map && StartAsync(false, fileSize, info) == 0)
+			return 0;
 
-	static tinyxml2::XMLElement *
-	FindTransferInfo(tinyxml2::XMLElement *ftp, const TransferInfo &info)
+		auto fun = std::bind(&DataPort::RecviceFile, this, 
+				mode, fileSize, std::ref(info));
+		_recvThread = Thread(fun);
+
+		return 0;
+	}
+
+
+	int DataPort::MapOutput(const std::string &filename, int flags, std::size_t size,
+			std::size_t offset)
+	{
+		if(_mapMode == MapNone)
+			return 1;
+		if(_text || size == (std::size_t)-1)
+		{
+			if(_mapMode == MapFile)
+				return 1;
+			_errorMessage = "cannot map a download of unknown size or in ASCII";
+			return -1;
+		}
+#ifndef _WIN32 
+		/* an empty mapping is refused, an empty file gets a page past its end */
+		std::size_t length = std::max<std::size_t>(size, 1);
+		void *map;
+		if(_mapMode == MapMemory)
+		{
+			_fd = -1;
+			_writeOffset = 0;
+			map = mmap(nullptr, length, PROT_READ | PROT_WRITE, 
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+		else 
+		{
+			/* written through the mapping, the file must be readable too */
+			if(OpenFile(filename, (flags & ~O_WRONLY) | O_RDWR) < 0)
+				return -1;
+			/* REST has the server send from offset, as in GetFile() fail rather than start over */
+			_writeOffset = offset;
+			if(offset > size || ftruncate(_fd, offset) < 0)
+			{
+				_errorMessage = "truncate file error";
+				close(_fd);
+				_fd = -1;
+				_tcpSock->Close();
+				return -1;
+			}
+			/* pages past the end of the file cannot be touched, so it is full size at once */
+#if defined(__linux) 
+			if(fallocate(_fd, 0, _writeOffset, size - _writeOffset) < 0 && 
+					size > _writeOffset)
+#endif 
+				ftruncate(_fd, size);
+			_reserved = size;
+			map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		}
+		if(map == MAP_FAILED)
+		{
+			_errorMessage = "map error";
+			if(_fd >= 0)
+			{
+				ftruncate(_fd, _writeOffset);
+				close(_fd);
+				_fd = -1;
+			}
+			return -1;
+		}
+		_map = (char *)map;
+		_mapSize = size;
+		return 0;
+#else 
+		(void)filename;
+		(void)flags;
+		(void)offset;
+		if(_mapMode == MapFile)
+			return 1;
+		_errorMessage = "mapping is not supported";
+		return -1;
+#endif 
+	}
+
+
+	MappedData::~MappedData()
+	{
+#ifndef _WIN32 
+		munmap(_data, _length);
+#endif 
+	}
+
+
+	/*
+	 * Receive into the mapping, a chunk a call, stopping at its end:
+	 * more than the size said is a failure, not a larger file.
+	 */
+	void DataPort::RecvMapped(TransferInfo &info)
+	{
+		std::size_t recvSize = _writeOffset;
+		bool interrupted = false, failed = false;
+
+		_recvCalls = 0;
+		_recvBytes = 0;
+		_bufferSize = _maxBuffer;
+
+		int recvBytes = 0;
+		while(_writeOffset < _mapSize)
+		{
+			if(!Throttle())
+			{
+				interrupted = true;
+				break;
+			}
+			std::size_t want = std::min(_rateLimit.Quantum(_maxBuffer), _mapSize - _writeOffset);
+			auto start = std::chrono::steady_clock::now();
+			recvBytes = _tcpSock->Recv(_map + _writeOffset, want, 0);
+			Waited(std::chrono::steady_clock::duration::zero(), 
+					std::chrono::steady_clock::now() - start);
+			++_recvCalls;
+			if(recvBytes == SOCKET_ERROR || recvBytes == 0)
+			{
+				failed = (recvBytes == SOCKET_ERROR);
+				break;
+			}
+			Account(recvBytes);
+			if(_hash)
+				_hash->Update(_map + _writeOffset, recvBytes);
+			_writeOffset += recvBytes;
+			recvSize += recvBytes;
+			_recvBytes += recvBytes;
+			Checkpoint(info, _writeOffset);
+			ReportProgress(recvSize, recvBytes);
+			if(this_thread_interrupt_flag.is_set())
+			{
+				interrupted = true;
+				break;
+			}
+		}
+
+		if(!interrupted && !failed && _writeOffset == _mapSize)
+		{
+			char extra;
+			if(_tcpSock->Recv(&extra, 1, 0) != 0)
+			{
+				_errorMessage = "more data than the file size";
+				failed = true;
+			}
+		}
+		FinishRecv(info, recvSize, interrupted, failed);
+	}
+
+
+	int DataPort::GetFileRange(const std::string &filename, std::size_t offset,
+			std::size_t length, TransferInfo &info)
+	{
+		int flags = O_WRONLY | O_CREAT;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		/* the previous transfer's thread has ended or is about to */
+		if(_recvThread.Joinable())
+			_recvThread.Join();
+		if(OpenFile(filename, flags) < 0)
+			return -1;
+
+		_writeOffset = offset;
+		_ranged = true;
+		_reserved = 0;
+		_text = false;
+		_pendingCR = false;
+		_remaining = length;
+		_hash.reset();
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_transferState = TransferState::Transport;
+		}
+
+		BeginTransfer(false, length);
+		if(_reactor && StartAsync(false, length, info) == 0)
+			return 0;
+
+		auto fun = std::bind(&DataPort::RecviceFile, this, 
+				std::ios::binary, length, std::ref(info));
+		_recvThread = Thread(fun);
+
+		return 0;
+	}
+
+
+	std::size_t DataPort::InitialRecvBuffer()
+	{
+		std::size_t size = _initialBuffer;
+		if(size == 0)
+		{
+			/* one read can take whatever the kernel may have queued */
+			int rcvbuf = _tcpSock->RecvBufferSize();
+			size = rcvbuf > 0 ? rcvbuf : MinRecvBuffer;
+			size = std::max(size, MinRecvBuffer);
+		}
+		return std::min(size, _maxBuffer);
+	}
+
+
+	/*
+	 * Bounded ring of pooled buffers handed from the network reader 
+	 * to the disk writer of a download.
+	 */
+	class BufferRing
+	{
+		public:
+			struct Chunk
+			{
+				std::vector<char> data;
+				std::size_t size = 0;
+				std::size_t offset = 0;
+			};
+
+			BufferRing(unsigned int depth, DataPort::PipelineCounters &counters):
+				_chunks(depth), _counters(counters)
+			{
+				for(auto &chunk : _chunks)
+					_free.push_back(&chunk);
+				_counters.queueDepth = 0;
+				_counters.maxQueueDepth = 0;
+				_counters.readerStalls = 0;
+				_counters.writerStalls = 0;
+				_counters.readerStallNanos = 0;
+				_counters.writerStallNanos = 0;
+			}
+
+			/* Wait for a free buffer of at least size bytes, nullptr once aborted */
+			Chunk *Acquire(std::size_t size)
+			{
+				std::unique_lock<std::mutex> lk(_mt);
+				if(_free.empty() && !_aborted)
+				{
+					auto start = std::chrono::steady_clock::now();
+					++_counters.readerStalls;
+					_freeCond.wait(lk, [this]{ return !_free.empty() || _aborted; });
+					_counters.readerStallNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now() - start).count();
+				}
+				if(_aborted)
+					return nullptr;
+				Chunk *chunk = _free.front();
+				_free.pop_front();
+				lk.unlock();
+
+				if(chunk->data.size() < size)
+					chunk->data.resize(size);
+				return chunk;
+			}
+
+			void Push(Chunk *chunk)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_pushed += chunk->size;
+				_filled.push_back(chunk);
+				_counters.queueDepth = _filled.size();
+				if(_filled.size() > _counters.maxQueueDepth)
+					_counters.maxQueueDepth = _filled.size();
+				_filledCond.notify_one();
+			}
+
+			/* Wait for a filled buffer, nullptr once closed and drained or aborted */
+			Chunk *Pop()
+			{
+				std::unique_lock<std::mutex> lk(_mt);
+				if(_filled.empty() && !_closed && !_aborted)
+				{
+					auto start = std::chrono::steady_clock::now();
+					++_counters.writerStalls;
+					_filledCond.wait(lk, [this]{ return !_filled.empty() || _closed || _aborted; });
+					_counters.writerStallNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now() - start).count();
+				}
+				if(_filled.empty() || _aborted)
+					return nullptr;
+				Chunk *chunk = _filled.front();
+				_filled.pop_front();
+				_counters.queueDepth = _filled.size();
+				return chunk;
+			}
+
+			/* Hand a written buffer back to the reader */
+			void Release(Chunk *chunk)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_written += chunk->size;
+				_free.push_back(chunk);
+				_freeCond.notify_one();
+			}
+
+			/* No more buffers will be pushed */
+			void Close()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_closed = true;
+				_filledCond.notify_one();
+			}
+
+			/* The writer failed, stop both sides */
+			void Abort()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_aborted = true;
+				_freeCond.notify_one();
+				_filledCond.notify_one();
+			}
+
+			bool Aborted()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _aborted;
+			}
+
+			/* Bytes pushed but never written */
+			std::size_t Lost()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _pushed - _written;
+			}
+
+		private:
+			std::vector<Chunk> _chunks;
+			std::list<Chunk *> _free;
+			std::list<Chunk *> _filled;
+			std::size_t _pushed = 0;
+			std::size_t _written = 0;
+			bool _closed = false;
+			bool _aborted = false;
+			std::mutex _mt;
+			std::condition_variable _freeCond;
+			std::condition_variable _filledCond;
+			DataPort::PipelineCounters &_counters;
+	};
+
+
+	DataPort::PipelineStats DataPort::GetPipelineStats() const
+	{
+		PipelineStats stats;
+		stats.queueDepth = _pipelineCounters.queueDepth;
+		stats.maxQueueDepth = _pipelineCounters.maxQueueDepth;
+		stats.readerStalls = _pipelineCounters.readerStalls;
+		stats.writerStalls = _pipelineCounters.writerStalls;
+		stats.readerStallSeconds = _pipelineCounters.readerStallNanos / 1e9;
+		stats.writerStallSeconds = _pipelineCounters.writerStallNanos / 1e9;
+		return stats;
+	}
+
+
+	int DataPort::RecvStream(const std::function<void(const char *, std::size_t)> &sink)
+	{
+		/* the previous transfer's thread has ended or is about to */
+		if(_recvThread.Joinable())
+			_recvThread.Join();
+
+		const std::size_t bufferSize = MinRecvBuffer;
+		if(_buffer.size() < bufferSize)
+			_buffer.resize(bufferSize);
+		int recvBytes;
+		while((recvBytes = _tcpSock->Recv(_buffer.data(), bufferSize, 0)) > 0)
+			sink(_buffer.data(), recvBytes);
+		_tcpSock->Close();
+		if(recvBytes == SOCKET_ERROR)
+		{
+			_errorMessage = "recv error";
+			return -1;
+		}
+		return 0;
+	}
+
+
+	void DataPort::WriteFile(BufferRing *ring, TransferInfo *info)
+	{
+		BufferRing::Chunk *chunk;
+		while((chunk = ring->Pop()) != nullptr)
+		{
+			if(WriteAt(_fd, chunk->data.data(), chunk->size, chunk->offset) < 0)
+			{
+				_errorMessage = "write file error";
+				ring->Abort();
+				return;
+			}
+			if(_hash)
+				_hash->Update(chunk->data.data(), chunk->size);
+			Checkpoint(*info, chunk->offset + chunk->size);
+			ring->Release(chunk);
+		}
+	}
+
+
+	void DataPort::RecviceFile(std::ios_base::openmode mode,
+			std::size_t size, TransferInfo &info)
+	{
+		if(_map)
+		{
+			RecvMapped(info);
+			return;
+		}
+		if(_splice && !_hash && (mode & std::ios::binary) && RecvSplice(size, info) == 0)
+			return;
+		if(_ioUring && (mode & std::ios::binary) && RecvUring(size, info) == 0)
+			return;
+
+		std::size_t bufferSize = InitialRecvBuffer();
+		int fullReads = 0;
+		size_t recvSize = _ranged ? 0 : _writeOffset;
+		bool interrupted = false;
+
+		_recvCalls = 0;
+		_recvBytes = 0;
+		_bufferSize = bufferSize;
+
+		auto recvLength = [this](std::size_t n)
+		{
+			return (_ranged && _remaining < n) ? _remaining : n;
+		};
+
+		std::unique_ptr<BufferRing> ring;
+		std::thread writer;
+		BufferRing::Chunk *chunk = nullptr;
+		if(_pipelineDepth > 1)
+		{
+			ring = details::make_unique<BufferRing>(_pipelineDepth, _pipelineCounters);
+			writer = std::thread(&DataPort::WriteFile, this, ring.get(), &info);
+		}
+
+		auto nextBuffer = [&]() -> char *
+		{
+			/* one spare byte for ToLocalText() */
+			if(!ring)
+			{
+				if(_buffer.size() < bufferSize + 1)
+					_buffer.resize(bufferSize + 1);
+				return _buffer.data();
+			}
+			/* a full ring is the writer falling behind */
+			auto start = std::chrono::steady_clock::now();
+			chunk = ring->Acquire(bufferSize + 1);
+			Waited(std::chrono::steady_clock::now() - start, 
+					std::chrono::steady_clock::duration::zero());
+			return chunk ? chunk->data.data() : nullptr;
+		};
+
+		int recvBytes = SOCKET_ERROR;
+		char *message;
+		while((message = nextBuffer()) != nullptr)
+		{
+			if(!Throttle())
+			{
+				interrupted = true;
+				break;
+			}
+			auto start = std::chrono::steady_clock::now();
+			recvBytes = _tcpSock->Recv(message, 
+					recvLength(_rateLimit.Quantum(bufferSize)), 0);
+			auto received = std::chrono::steady_clock::now();
+			Waited(std::chrono::steady_clock::duration::zero(), received - start);
+			++_recvCalls;
+			if(recvBytes == SOCKET_ERROR || recvBytes == 0)
+				break;
+			Account(recvBytes);
+
+			std::size_t length = _text ? ToLocalText(message, recvBytes) : recvBytes;
+			if(ring)
+			{
+				chunk->size = length;
+				chunk->offset = _writeOffset;
+				ring->Push(chunk);
+			}
+			else
+			{
+				int written = WriteAt(_fd, message, length, _writeOffset);
+				Waited(std::chrono::steady_clock::now() - received, 
+						std::chrono::steady_clock::duration::zero());
+				if(written < 0)
+				{
+					_errorMessage = "write file error";
+					recvBytes = SOCKET_ERROR;
+					break;
+				}
+			}
+			recvSize += length;
+			_writeOffset += length;
+			_recvBytes += recvBytes;
+			if(!ring)
+			{
+				if(_hash)
+					_hash->Update(message, length);
+				Checkpoint(info, _writeOffset);
+			}
+
+			ReportProgress(recvSize, length);
+			if(this_thread_interrupt_flag.is_set())
+			{
+				interrupted = true;
+				break;
+			}
+
+			if(_ranged)
+			{
+				_remaining -= recvBytes;
+				if(_remaining == 0)
+				{
+					/* the server keeps sending past our range */
+					_tcpSock->Close();
+					break;
+				}
+			}
+
+			/* the socket had more queued than we took, twice in a row */
+			if((std::size_t)recvBytes < bufferSize)
+				fullReads = 0;
+			else if(++fullReads == 2 && bufferSize < _maxBuffer)
+			{
+				bufferSize = std::min(bufferSize * 2, _maxBuffer);
+				_bufferSize = bufferSize;
+				fullReads = 0;
+			}
+		}
+
+		/* only what reached the file counts towards the breakpoint */
+		std::size_t lost = 0;
+		if(ring)
+		{
+			ring->Close();
+			writer.join();
+			if(ring->Aborted())
+				recvBytes = SOCKET_ERROR;
+			lost = ring->Lost();
+		}
+
+		FinishRecv(info, recvSize - lost, interrupted, 
+				recvBytes == SOCKET_ERROR || lost > 0);
+	}
+
+
+#ifdef DFL_HAVE_IO_URING 
+	/*
+	 * io_uring with registered buffers, driven through the raw system 
+	 * calls so no liburing is needed. 
+	 *
+	 * Each round chains, for every buffer, a MSG_WAITALL recv into it 
+	 * linked to a fixed-buffer write of it to the file, and submits the
+	 * whole chain with one io_uring_enter(). The kernel then runs the 
+	 * chain without returning to us. A short recv (end of data, or the
+	 * shutdown we issue on interrupt) cancels the rest of the chain; its
+	 * bytes are written by hand.
+	 */
+	class UringReceiver
+	{
+		public:
+			enum Op { RecvOp = 0, WriteOp = 1, TimeoutOp = 2 };
+
+			UringReceiver(unsigned int buffers, std::size_t bufferSize):
+				_buffers(buffers), _bufferSize(bufferSize)
+			{
+				struct io_uring_params params;
+				memset(&params, 0, sizeof(params));
+				_ringFd = syscall(__NR_io_uring_setup, buffers * 2 + 2, &params);
+				if(_ringFd < 0)
+					return;
+
+				_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+				if(params.features & IORING_FEAT_SINGLE_MMAP)
+					_sqSize = _cqSize = std::max(_sqSize, _cqSize);
+				_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+				_sq = (char *)mmap(NULL, _sqSize, PROT_READ | PROT_WRITE, 
+						MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+				if(_sq == MAP_FAILED)
+				{
+					Release();
+					return;
+				}
+				if(params.features & IORING_FEAT_SINGLE_MMAP)
+					_cq = _sq;
+				else 
+					_cq = (char *)mmap(NULL, _cqSize, PROT_READ | PROT_WRITE, 
+							MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+				_sqes = (struct io_uring_sqe *)mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, 
+						MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+				if(_cq == MAP_FAILED || _sqes == MAP_FAILED)
+				{
+					Release();
+					return;
+				}
+
+				_sqHead = (unsigned *)(_sq + params.sq_off.head);
+				_sqTail = (unsigned *)(_sq + params.sq_off.tail);
+				_sqMask = *(unsigned *)(_sq + params.sq_off.ring_mask);
+				_sqArray = (unsigned *)(_sq + params.sq_off.array);
+				_cqHead = (unsigned *)(_cq + params.cq_off.head);
+				_cqTail = (unsigned *)(_cq + params.cq_off.tail);
+				_cqMask = *(unsigned *)(_cq + params.cq_off.ring_mask);
+				_cqes = (struct io_uring_cqe *)(_cq + params.cq_off.cqes);
+				_localTail = *_sqTail;
+
+				_memory.resize(buffers * bufferSize);
+				std::vector<struct iovec> iov(buffers);
+				for(unsigned int i = 0; i < buffers; ++i)
+				{
+					iov[i].iov_base = Buffer(i);
+					iov[i].iov_len = bufferSize;
+				}
+				if(syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_BUFFERS,
+							iov.data(), buffers) < 0)
+					Release();
+			}
+
+			UringReceiver(const UringReceiver&) = delete;
+			UringReceiver &operator=(const UringReceiver&) = delete;
+
+			~UringReceiver()
+			{
+				Release();
+			}
+
+			bool Ok() const
+			{
+				return _ringFd >= 0;
+			}
+
+			char *Buffer(unsigned int i)
+			{
+				return _memory.data() + i * _bufferSize;
+			}
+
+			static unsigned long long Tag(unsigned int i, Op op)
+			{
+				return ((unsigned long long)i << 2) | op;
+			}
+
+			void PrepRecv(unsigned int i, int sock, std::size_t len)
+			{
+				struct io_uring_sqe *sqe = NextSqe();
+				sqe->opcode = IORING_OP_RECV;
+				sqe->fd = sock;
+				sqe->addr = (unsigned long long)Buffer(i);
+				sqe->len = len;
+				sqe->msg_flags = MSG_WAITALL;
+				sqe->flags = IOSQE_IO_LINK;
+				sqe->user_data = Tag(i, RecvOp);
+			}
+
+			void PrepWrite(unsigned int i, int fd, std::size_t len, std::size_t offset, bool link)
+			{
+				struct io_uring_sqe *sqe = NextSqe();
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+				sqe->fd = fd;
+				sqe->addr = (unsigned long long)Buffer(i);
+				sqe->len = len;
+				sqe->off = offset;
+				sqe->buf_index = i;
+				sqe->flags = link ? IOSQE_IO_LINK : 0;
+				sqe->user_data = Tag(i, WriteOp);
+			}
+
+			/*
+			 * Submit what was prepared and wait until a completion arrives
+			 * or the wake-up timer fires, so the caller can look at its 
+			 * interrupt flag now and then.
+			 */
+			int SubmitAndWait()
+			{
+				if(!_timerArmed)
+				{
+					_timeout.tv_sec = 0;
+					_timeout.tv_nsec = 100 * 1000 * 1000;
+					struct io_uring_sqe *sqe = NextSqe();
+					sqe->opcode = IORING_OP_TIMEOUT;
+					sqe->fd = -1;
+					sqe->addr = (unsigned long long)&_timeout;
+					sqe->len = 1;
+					sqe->user_data = Tag(0, TimeoutOp);
+					_timerArmed = true;
+				}
+				__atomic_store_n(_sqTail, _localTail, __ATOMIC_RELEASE);
+				int ret;
+				do
+				{
+					unsigned int submit = _localTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+					ret = syscall(__NR_io_uring_enter, _ringFd, submit, 1, 
+							IORING_ENTER_GETEVENTS, NULL, 0);
+				}while(ret < 0 && errno == EINTR);
+				return ret < 0 ? -1 : 0;
+			}
+
+			/* Pop one completion, false when none is ready */
+			bool Reap(unsigned long long &tag, int &res)
+			{
+				unsigned head = *_cqHead;
+				if(head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+					return false;
+				struct io_uring_cqe *cqe = &_cqes[head & _cqMask];
+				tag = cqe->user_data;
+				res = cqe->res;
+				__atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+				if((tag & 3) == TimeoutOp)
+					_timerArmed = false;
+				return true;
+			}
+
+			/*
+			 * Whether a MSG_WAITALL recv comes back short only at the end
+			 * of the stream and then cancels the write linked to it, as
+			 * since Linux 5.18. Before, the write ran with the full length
+			 * regardless. Found out once, on a socket pair.
+			 */
+			static bool ShortRecvBreaksLink()
+			{
+				static const bool breaks = []
+				{
+					int pair[2];
+					if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+						return false;
+					int null = open("/dev/null", O_WRONLY);
+					int results[2] = {-ECANCELED, 0};
+					unsigned int pending = 2;
+					{
+						UringReceiver ring(1, 2);
+						if(ring.Ok() && null >= 0 && send(pair[1], "x", 1, 0) == 1 &&
+								shutdown(pair[1], SHUT_WR) == 0)
+						{
+							ring.PrepRecv(0, pair[0], 2);
+							ring.PrepWrite(0, null, 2, 0, false);
+							/* the timer wakes it every 100ms, give up after a second */
+							for(int round = 0; pending > 0 && round < 10; ++round)
+							{
+								if(ring.SubmitAndWait() < 0)
+									break;
+								unsigned long long tag;
+								int res;
+								while(ring.Reap(tag, res))
+								{
+									if((tag & 3) == TimeoutOp)
+										continue;
+									results[tag & 3] = res;
+									--pending;
+								}
+							}
+						}
+					}
+					if(null >= 0)
+						close(null);
+					close(pair[0]);
+					close(pair[1]);
+					return pending == 0 && results[RecvOp] == 1 && results[WriteOp] == -ECANCELED;
+				}();
+				return breaks;
+			}
+
+		private:
+			struct io_uring_sqe *NextSqe()
+			{
+				unsigned index = _localTail & _sqMask;
+				struct io_uring_sqe *sqe = &_sqes[index];
+				memset(sqe, 0, sizeof(*sqe));
+				_sqArray[index] = index;
+				++_localTail;
+				return sqe;
+			}
+
+			void Release()
+			{
+				if(_sqes && _sqes != MAP_FAILED)
+					munmap(_sqes, _sqesSize);
+				if(_cq && _cq != MAP_FAILED && _cq != _sq)
+					munmap(_cq, _cqSize);
+				if(_sq && _sq != MAP_FAILED)
+					munmap(_sq, _sqSize);
+				_sqes = nullptr;
+				_cq = _sq = nullptr;
+				if(_ringFd >= 0)
+					close(_ringFd);
+				_ringFd = -1;
+			}
+
+			unsigned int _buffers;
+			std::size_t _bufferSize;
+			std::vector<char> _memory;
+			int _ringFd = -1;
+			char *_sq = nullptr;
+			char *_cq = nullptr;
+			struct io_uring_sqe *_sqes = nullptr;
+			std::size_t _sqSize = 0;
+			std::size_t _cqSize = 0;
+			std::size_t _sqesSize = 0;
+			unsigned *_sqHead = nullptr;
+			unsigned *_sqTail = nullptr;
+			unsigned *_sqArray = nullptr;
+			unsigned _sqMask = 0;
+			unsigned _localTail = 0;
+			unsigned *_cqHead = nullptr;
+			unsigned *_cqTail = nullptr;
+			unsigned _cqMask = 0;
+			struct io_uring_cqe *_cqes = nullptr;
+			struct __kernel_timespec _timeout;
+			bool _timerArmed = false;
+	};
+
+
+	int DataPort::RecvUring(std::size_t size, TransferInfo &info)
+	{
+		/* an older kernel would write past what a recv got, the plain loop it is */
+		if(!UringReceiver::ShortRecvBreaksLink())
+			return -1;
+
+		const unsigned int buffers = 4;
+		const std::size_t bufferSize = std::min<std::size_t>(_maxBuffer, 1 << 20);
+		UringReceiver ring(buffers, bufferSize);
+		if(!ring.Ok())
+			return -1;
+
+		const int sock = _tcpSock->GetSocket();
+		std::size_t recvSize = _ranged ? 0 : _writeOffset;
+		bool interrupted = false, failed = false, finished = false;
+
+		_recvCalls = 0;
+		_recvBytes = 0;
+		_bufferSize = bufferSize;
+
+		while(!finished && !failed)
+		{
+			if(!Throttle())
+			{
+				interrupted = true;
+				break;
+			}
+			/* a round may take no more than the rate limits allow at once */
+			std::size_t budget = _rateLimit.Quantum(buffers * bufferSize);
+			if(_ranged)
+				budget = std::min(budget, _remaining);
+			std::size_t lengths[buffers];
+			unsigned int n = 0;
+			std::size_t planned = 0;
+			for(; n < buffers; ++n)
+			{
+				lengths[n] = std::min(bufferSize, budget - planned);
+				if(lengths[n] == 0)
+					break;
+				planned += lengths[n];
+			}
+			if(n == 0)
+				break;
+
+			/* recv 0 -> write 0 -> recv 1 -> ... -> write n-1 */
+			std::size_t offset = _writeOffset;
+			for(unsigned int i = 0; i < n; ++i)
+			{
+				ring.PrepRecv(i, sock, lengths[i]);
+				ring.PrepWrite(i, _fd, lengths[i], offset, i + 1 < n);
+				offset += lengths[i];
+			}
+
+			int results[buffers][2];
+			unsigned int pending = n * 2;
+			bool shutdownIssued = false;
+			for(unsigned int i = 0; i < n; ++i)
+				results[i][0] = results[i][1] = -ECANCELED;
+
+			while(pending > 0)
+			{
+				/* the writes chained to the receives are mostly done by then */
+				auto start = std::chrono::steady_clock::now();
+				int submitted = ring.SubmitAndWait();
+				Waited(std::chrono::steady_clock::duration::zero(), 
+						std::chrono::steady_clock::now() - start);
+				if(submitted < 0)
+				{
+					failed = true;
+					break;
+				}
+				++_recvCalls;
+				unsigned long long tag;
+				int res;
+				while(ring.Reap(tag, res))
+				{
+					unsigned int op = tag & 3;
+					if(op == UringReceiver::TimeoutOp)
+						continue;
+					results[tag >> 2][op] = res;
+					--pending;
+				}
+				if(!shutdownIssued && this_thread_interrupt_flag.is_set())
+				{
+					/* wakes the waiting recv with what it has so far */
+					interrupted = shutdownIssued = true;
+					_tcpSock->Shutdown();
+				}
+			}
+			if(failed)
+				break;
+
+			for(unsigned int i = 0; i < n && !finished && !failed; ++i)
+			{
+				int received = results[i][UringReceiver::RecvOp];
+				int written = results[i][UringReceiver::WriteOp];
+				if(received < 0)
+				{
+					failed = (received != -ECANCELED);
+					finished = true;
+					break;
+				}
+				if(written != received)
+				{
+					/* the chain broke here, write the tail ourselves */
+					if(written > 0 || (written < 0 && written != -ECANCELED) ||
+						WriteAt(_fd, ring.Buffer(i), received, _writeOffset) < 0)
+					{
+						_errorMessage = "write file error";
+						failed = true;
+						break;
+					}
+				}
+				recvSize += received;
+				_writeOffset += received;
+				_recvBytes += received;
+				Account(received);
+				if(_hash)
+					_hash->Update(ring.Buffer(i), received);
+				Checkpoint(info, _writeOffset);
+				if(_ranged)
+					_remaining -= received;
+				if(received > 0)
+					ReportProgress(recvSize, received);
+				if((std::size_t)received < lengths[i])
+					finished = true;
+			}
+			if(interrupted || (_ranged && _remaining == 0))
+				finished = true;
+		}
+
+		if(_ranged && _remaining == 0)
+			_tcpSock->Close();
+		FinishRecv(info, recvSize, interrupted, failed);
+		return 0;
+	}
+#else 
+	int DataPort::RecvUring(std::size_t, TransferInfo &)
+	{
+		return -1;
+	}
+#endif
+
+
+	int DataPort::RecvSplice(std::size_t size, TransferInfo &info)
+	{
+#ifdef __linux__ 
+		int pipefd[2];
+		if(pipe(pipefd) < 0)
+			return -1;
+		/* one splice moves at most what the pipe holds */
+		fcntl(pipefd[1], F_SETPIPE_SZ, (int)std::min<std::size_t>(_maxBuffer, 1 << 20));
+		int pipeSize = fcntl(pipefd[1], F_GETPIPE_SZ);
+		if(pipeSize <= 0)
+			pipeSize = 64 * 1024;
+
+		const int sock = _tcpSock->GetSocket();
+		std::size_t recvSize = _ranged ? 0 : _writeOffset;
+		bool interrupted = false, failed = false;
+
+		_recvCalls = 0;
+		_recvBytes = 0;
+		_bufferSize = pipeSize;
+
+		while(!_ranged || _remaining > 0)
+		{
+			if(!Throttle())
+			{
+				interrupted = true;
+				break;
+			}
+			std::size_t want = _rateLimit.Quantum(pipeSize);
+			if(_ranged)
+				want = std::min(want, _remaining);
+			auto start = std::chrono::steady_clock::now();
+			ssize_t recvBytes = splice(sock, NULL, pipefd[1], NULL, want, 
+					SPLICE_F_MOVE | SPLICE_F_MORE);
+			auto received = std::chrono::steady_clock::now();
+			Waited(std::chrono::steady_clock::duration::zero(), received - start);
+			++_recvCalls;
+			if(recvBytes < 0 && errno == EINTR)
+				continue;
+			if(recvBytes <= 0)
+			{
+				failed = (recvBytes < 0);
+				break;
+			}
+			Account(recvBytes);
+
+			loff_t offset = _writeOffset;
+			ssize_t left = recvBytes;
+			while(left > 0)
+			{
+				ssize_t moved = splice(pipefd[0], NULL, _fd, &offset, left, 
+						SPLICE_F_MOVE | SPLICE_F_MORE);
+				if(moved < 0 && errno == EINTR)
+					continue;
+				if(moved <= 0)
+					break;
+				left -= moved;
+			}
+			Waited(std::chrono::steady_clock::now() - received, 
+					std::chrono::steady_clock::duration::zero());
+			if(left > 0)
+			{
+				_errorMessage = "write file error";
+				failed = true;
+				break;
+			}
+
+			recvSize += recvBytes;
+			_writeOffset += recvBytes;
+			_recvBytes += recvBytes;
+			Checkpoint(info, _writeOffset);
+			if(_ranged)
+				_remaining -= recvBytes;
+
+			ReportProgress(recvSize, recvBytes);
+			if(this_thread_interrupt_flag.is_set())
+			{
+				interrupted = true;
+				break;
+			}
+		}
+		close(pipefd[0]);
+		close(pipefd[1]);
+
+		if(_ranged && _remaining == 0)
+			_tcpSock->Close();
+		FinishRecv(info, recvSize, interrupted, failed);
+		return 0;
+#else 
+		return -1;
+#endif
+	}
+
+
+	int DataPort::StartAsync(bool upload, std::size_t size, TransferInfo &info)
+	{
+		if(_rateLimit.Limited())
+			return -1;
+		_async.size = size;
+		_async.transferred = (_ranged ? 0 : _writeOffset);
+		_async.bufferSize = InitialRecvBuffer();
+		_async.fullReads = 0;
+		_async.info = &info;
+		_recvCalls = 0;
+		_recvBytes = 0;
+		_bufferSize = _async.bufferSize;
+
+		if(_tcpSock->SetNonBlocking() < 0)
+			return -1;
+		Reactor::Handler handler = upload ? 
+			std::bind(&DataPort::OnWritable, this) : std::bind(&DataPort::OnReadable, this);
+		if(_reactor->Add(_tcpSock->GetSocket(), 
+					upload ? Reactor::Writable : Reactor::Readable, handler) < 0)
+			return -1;
+		_async.active = true;
+		return 0;
+	}
+
+
+	void DataPort::StopAsync()
+	{
+		if(!_async.active)
+			return;
+		_async.active = false;
+		/* the handler had not finished by itself, so this is an interrupt */
+		if(_reactor->Remove(_tcpSock->GetSocket()))
+			FinishRecv(*_async.info, _async.transferred, true, false);
+	}
+
+
+	bool DataPort::OnReadable()
+	{
+		/* shared by every transfer this reactor thread serves */
+		thread_local std::vector<char> buffer;
+
+		/* a budget per wake-up keeps one fast transfer from starving the rest */
+		for(int reads = 0; reads < 16; ++reads)
+		{
+			std::size_t bufferSize = _async.bufferSize;
+			/* one spare byte for ToLocalText() */
+			if(buffer.size() < bufferSize + 1)
+				buffer.resize(bufferSize + 1);
+			if(_ranged)
+				bufferSize = std::min(bufferSize, _remaining);
+
+			int recvBytes = _tcpSock->Recv(buffer.data(), bufferSize, 0);
+			++_recvCalls;
+			if(recvBytes < 0)
+			{
+				int err = _tcpSock->GetLastError();
+				if(err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+					return true;
+				FinishRecv(*_async.info, _async.transferred, false, true);
+				return false;
+			}
+			if(recvBytes == 0)
+			{
+				FinishRecv(*_async.info, _async.transferred, false, false);
+				return false;
+			}
+			/* a limit set since the start is not held, but still charged */
+			Account(recvBytes);
+			std::size_t length = _text ? ToLocalText(buffer.data(), recvBytes) : recvBytes;
+			/* the reactor waits on the network, only the disk blocks here */
+			auto start = std::chrono::steady_clock::now();
+			int written = WriteAt(_fd, buffer.data(), length, _writeOffset);
+			Waited(std::chrono::steady_clock::now() - start, 
+					std::chrono::steady_clock::duration::zero());
+			if(written < 0)
+			{
+				_errorMessage = "write file error";
+				FinishRecv(*_async.info, _async.transferred, false, true);
+				return false;
+			}
+			_async.transferred += length;
+			_writeOffset += length;
+			_recvBytes += recvBytes;
+			if(_hash)
+				_hash->Update(buffer.data(), length);
+			Checkpoint(*_async.info, _writeOffset);
+			ReportProgress(_async.transferred, length);
+
+			if(_ranged)
+			{
+				_remaining -= recvBytes;
+				if(_remaining == 0)
+				{
+					/* the server keeps sending past our range */
+					_tcpSock->Shutdown();
+					FinishRecv(*_async.info, _async.transferred, false, false);
+					return false;
+				}
+			}
+
+			if((std::size_t)recvBytes < bufferSize)
+				_async.fullReads = 0;
+			else if(++_async.fullReads == 2 && _async.bufferSize < _maxBuffer)
+			{
+				_async.bufferSize = std::min(_async.bufferSize * 2, _maxBuffer);
+				_bufferSize = _async.bufferSize;
+				_async.fullReads = 0;
+			}
+		}
+		return true;
+	}
+
+
+	bool DataPort::OnWritable()
+	{
+		const std::size_t chunk = 1 << 20;
+		for(int writes = 0; writes < 16; ++writes)
+		{
+			if(_async.transferred >= _async.size)
+			{
+				/* marks the end of file for the server */
+				_tcpSock->Shutdown();
+				FinishRecv(*_async.info, _async.transferred, false, false);
+				return false;
+			}
+
+			std::size_t sendSize = _async.transferred;
+			int sendBytes = _tcpSock->SendFile(_fd, sendSize, 
+					std::min(chunk, _async.size - sendSize));
+			if(sendBytes <= 0)
+			{
+				int err = _tcpSock->GetLastError();
+				if(sendBytes < 0 && (err == EAGAIN || err == EWOULDBLOCK || err == EINTR))
+					return true;
+				FinishRecv(*_async.info, _async.transferred, false, true);
+				return false;
+			}
+			Account(sendBytes);
+			_async.transferred = sendSize;
+			ReportProgress(sendSize, 0);
+		}
+		return true;
+	}
+
+
+	void DataPort::BeginTransfer(bool upload, std::size_t size)
+	{
+		auto now = std::chrono::steady_clock::now();
+		_upload = upload;
+		_meter.Start(now);
+		_endTime = 0;
+		_firstByteTime = 0;
+		_transferBytes = 0;
+		_diskWait = 0;
+		_networkWait = 0;
+		if(_metrics)
+			_metrics->TransferStarted();
+
+		Unwatch();
+		_progressBytes = _ranged ? 0 : _writeOffset;
+		_progressShared = _sharedReceived;
+		if(_sharedReceived)
+			size = _sharedTotal;
+		_progressTotal = (size == (std::size_t)-1) ? 0 : size;
+		_progressDone = false;
+		_progressLast = ProgressBytes();
+		_progressMeter.Start(now);
+
+		ProgressNotifier *notifier = _notifier;
+		if(!notifier)
+		{
+			std::lock_guard<std::mutex> lk(_progressMt);
+			if(!_progressList.empty())
+				notifier = GetProgressNotifier();
+		}
+		if(notifier)
+		{
+			_watched = notifier;
+			notifier->Add(this, [this]{ return NotifyProgress(); });
+		}
+	}
+
+
+	void DataPort::SetProgressNotifier(ProgressNotifier *notifier)
+	{
+		Unwatch();
+		_notifier = notifier;
+	}
+
+
+	ProgressNotifier *DataPort::GetProgressNotifier()
+	{
+		if(_notifier)
+			return _notifier;
+		if(!_ownNotifier)
+			_ownNotifier = details::make_unique<ProgressNotifier>(_progressInterval);
+		return _ownNotifier.get();
+	}
+
+
+	std::size_t DataPort::ProgressBytes() const
+	{
+		if(_progressShared)
+			return _progressShared->load(std::memory_order_relaxed);
+		return _progressBytes.load(std::memory_order_relaxed);
+	}
+
+
+	bool DataPort::NotifyProgress()
+	{
+		/* before the bytes, so the end is told with all of them */
+		bool done = _progressDone.load(std::memory_order_acquire);
+		auto now = std::chrono::steady_clock::now();
+		std::size_t bytes = ProgressBytes();
+		_progressMeter.Add(bytes > _progressLast ? bytes - _progressLast : 0, now);
+		_progressLast = bytes;
+
+		Progress progress;
+		progress.bytes = bytes;
+		progress.total = _progressTotal;
+		progress.fraction = progress.total ? bytes / (double)progress.total : 0;
+		progress.throughput = _progressMeter.Rate();
+		progress.averageThroughput = _progressMeter.Average();
+		progress.eta = -1;
+		if(done)
+			progress.eta = 0;
+		else if(progress.total >= bytes && progress.averageThroughput > 0)
+			progress.eta = (progress.total - bytes) / progress.averageThroughput;
+		progress.done = done;
+
+		std::lock_guard<std::mutex> lk(_progressMt);
+		for(auto elem : _progressList)
+			elem->OnProgress(progress);
+		return !done;
+	}
+
+
+	void DataPort::Unwatch()
+	{
+		if(!_watched)
+			return;
+		/* the end is told from the notifier's thread too, never two at once */
+		if(_progressDone)
+			_watched->Flush(this);
+		_watched->Remove(this);
+		_watched = nullptr;
+	}
+
+
+	TransferState DataPort::Wait()
+	{
+		TransferState state;
+		{
+			std::unique_lock<std::mutex> lk(_mt);
+			_stateCond.wait(lk, [this]{ return _transferState != TransferState::Transport; });
+			state = _transferState;
+		}
+		Unwatch();
+		return state;
+	}
+
+
+	void DataPort::Account(std::size_t n)
+	{
+		_rateLimit.Consume(n);
+		auto now = std::chrono::steady_clock::now();
+		if(_firstByteTime == 0 && n > 0)
+		{
+			_firstByteTime = now.time_since_epoch().count();
+			if(_metrics)
+				_metrics->RecordFirstByte(std::chrono::duration_cast<std::chrono::microseconds>(
+							now.time_since_epoch() - 
+							std::chrono::steady_clock::duration(_connectTime.load())));
+		}
+		_transferBytes.store(_transferBytes.load(std::memory_order_relaxed) + n, 
+				std::memory_order_relaxed);
+		_meter.Add(n, now);
+		if(_metrics)
+			_metrics->AddBytes(_upload, n);
+	}
+
+
+	void DataPort::Waited(std::chrono::steady_clock::duration disk, 
+			std::chrono::steady_clock::duration network)
+	{
+		_diskWait.fetch_add(disk.count(), std::memory_order_relaxed);
+		_networkWait.fetch_add(network.count(), std::memory_order_relaxed);
+		if(_metrics)
+			_metrics->AddWait(disk, network);
+	}
+
+
+	TransferStats DataPort::GetTransferStats() const
+	{
+		typedef std::chrono::steady_clock::duration Ticks;
+		auto seconds = [](long long ticks)
+		{
+			return std::chrono::duration<double>(Ticks(ticks)).count();
+		};
+		long long end = _endTime;
+		if(end == 0)
+			end = std::chrono::steady_clock::now().time_since_epoch().count();
+		long long firstByte = _firstByteTime;
+
+		TransferStats stats;
+		stats.bytes = _transferBytes;
+		stats.seconds = seconds(end - _connectTime);
+		stats.throughput = _meter.Rate();
+		stats.averageThroughput = _meter.Average();
+		stats.firstByteSeconds = firstByte ? seconds(firstByte - _connectTime) : -1;
+		stats.diskWaitSeconds = seconds(_diskWait);
+		stats.networkWaitSeconds = seconds(_networkWait);
+		stats.retries = 0;
+		return stats;
+	}
+
+
+	bool DataPort::Throttle()
+	{
+		while(!_rateLimit.Wait())
+			if(this_thread_interrupt_flag.is_set())
+				return false;
+		return !this_thread_interrupt_flag.is_set();
+	}
+
+
+	void DataPort::ReportProgress(std::size_t recvSize, std::size_t recvBytes)
+	{
+		/* the notifier takes it from here */
+		if(_sharedReceived)
+			_sharedReceived->fetch_add(recvBytes, std::memory_order_relaxed);
+		else
+			_progressBytes.store(recvSize, std::memory_order_relaxed);
+	}
+
+
+	void DataPort::FinishRecv(TransferInfo &info, std::size_t offset, 
+			bool interrupted, bool failed)
+	{
+		/* a CR that ended the data ends no line; dropped on interrupt, resent on resume */
+		if(_pendingCR)
+		{
+			_pendingCR = false;
+			if(!interrupted && !failed && WriteAt(_fd, "\r", 1, _writeOffset) == 0)
+			{
+				++_writeOffset;
+				++offset;
+				if(_hash)
+					_hash->Update("\r", 1);
+			}
+		}
+		/* what was reserved past the end is not needed, or not yet */
+		if(_reserved > offset)
+			ftruncate(_fd, offset);
+		_reserved = 0;
+		/* a download held in memory only leaves nothing to resume */
+		bool resumable = !_ranged && _fd >= 0;
+		if(_fd >= 0)
+			close(_fd);
+		_fd = -1;
+		failed = failed || (!interrupted && _ranged && _remaining > 0);
+		std::unique_ptr<MappedData> mapped;
+		if(_map)
+		{
+			mapped = details::make_unique<MappedData>(_map, 
+					std::max<std::size_t>(_mapSize, 1), offset);
+			_map = nullptr;
+			if(interrupted || failed)
+				mapped.reset();
+		}
+		_endTime = std::chrono::steady_clock::now().time_since_epoch().count();
+		if(_metrics)
+			_metrics->TransferEnded(interrupted, failed);
+		_progressDone.store(true, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			info.offset = offset;
+			_resumable = resumable;
+			if(failed)
+			{
+				if(resumable)
+					_putBreakPointFunc(info);
+				_transferState = TransferState::NetworkAnomaly;
+			}
+			else if(interrupted)
+			{
+				if(resumable)
+					_putBreakPointFunc(info);
+				_transferState = TransferState::Suspend;
+			}
+			else 
+			{
+				_transferState = TransferState::Done;
+				_mapped = std::move(mapped);
+				if(resumable)
+					_deleteBreakPointFunc(info);
+			}
+		}
+		_stateCond.notify_all();
+	}
+
+
+	void DataPort::Aborted(TransferInfo &info)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		if(_upload || _ranged || _transferState != TransferState::Done)
+			return;
+		_mapped.reset();
+		if(_resumable)
+			_putBreakPointFunc(info);
+		_transferState = TransferState::NetworkAnomaly;
+	}
+
+
+	/*
+	 * Record written as the breakpoint once every byte below it is on
+	 * disk, so a crash or power loss costs at most the last interval.
+	 * Ranged transfers are not resumable and keep no breakpoint.
+	 */
+	void DataPort::Checkpoint(TransferInfo &info, std::size_t written)
+	{
+		if(_ranged || written <= _checkpointOffset)
+			return;
+
+		auto now = std::chrono::steady_clock::now();
+		bool due = (_checkpointBytes > 0 && written - _checkpointOffset >= _checkpointBytes) ||
+			(_checkpointInterval.count() > 0 && now - _checkpointTime >= _checkpointInterval);
+		if(!due)
+			return;
+
+		_checkpointTime = now;
+		if(fdatasync(_fd) < 0)
+			return;
+		_checkpointOffset = written;
+		std::lock_guard<std::mutex> lk(_mt);
+		info.offset = written;
+		_putBreakPointFunc(info);
+	}
+
+
+	int DataPort::OpenUpload(const std::string &filename, std::size_t &size)
+	{
+		int flags = O_RDONLY;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		/* the previous transfer's thread has ended or is about to */
+		if(_recvThread.Joinable())
+			_recvThread.Join();
+		if(OpenFile(filename, flags) < 0)
+			return -1;
+
+		struct stat st;
+		if(fstat(_fd, &st) < 0)
+		{
+			_errorMessage = "stat file error";
+			close(_fd);
+			_fd = -1;
+			return -1;
+		}
+		size = st.st_size;
+		return 0;
+	}
+
+
+	void DataPort::CancelUpload()
+	{
+		if(_fd >= 0)
+			close(_fd);
+		_fd = -1;
+		_tcpSock->Close();
+	}
+
+
+	int DataPort::PutFile(std::size_t offset, TransferInfo &info)
+	{
+		struct stat st;
+		if(_fd < 0 || fstat(_fd, &st) < 0 || (std::size_t)st.st_size < offset)
+		{
+			_errorMessage = "bad upload offset";
+			CancelUpload();
+			return -1;
+		}
+
+		_writeOffset = offset;
+		_ranged = false;
+		_hash.reset();
+		_sharedReceived.reset();
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_transferState = TransferState::Transport;
+		}
+
+		BeginTransfer(true, st.st_size);
+		if(_reactor && StartAsync(true, st.st_size, info) == 0)
+			return 0;
+
+		auto fun = std::bind(&DataPort::SendFile, this, 
+				(std::size_t)st.st_size, std::ref(info));
+		_recvThread = Thread(fun);
+
+		return 0;
+	}
+
+
+	void DataPort::SendFile(std::size_t size, TransferInfo &info)
+	{
+		/* bound each sendfile() so interrupts and progress stay responsive */
+		const std::size_t chunk = 1 << 20;
+		std::size_t sendSize = _writeOffset;
+		int sendBytes = 0;
+
+		while(sendSize < size)
+		{
+			if(!Throttle())
+			{
+				FinishRecv(info, sendSize, true, false);
+				return;
+			}
+			auto start = std::chrono::steady_clock::now();
+			sendBytes = _tcpSock->SendFile(_fd, sendSize, 
+					_rateLimit.Quantum(std::min(chunk, size - sendSize)));
+			Waited(std::chrono::steady_clock::duration::zero(), 
+					std::chrono::steady_clock::now() - start);
+			if(sendBytes <= 0)
+			{
+				if(sendBytes < 0 && _tcpSock->GetLastError() == EINTR)
+					continue;
+				sendBytes = SOCKET_ERROR;
+				break;
+			}
+			Account(sendBytes);
+
+			ReportProgress(sendSize, sendBytes);
+			if(this_thread_interrupt_flag.is_set())
+			{
+				FinishRecv(info, sendSize, true, false);
+				return;
+			}
+		}
+
+		/* closing the data connection marks the end of file for the server */
+		_tcpSock->Close();
+		FinishRecv(info, sendSize, false, sendBytes == SOCKET_ERROR);
+	}
+
+
+	static std::string ChildText(tinyxml2::XMLElement *task, const char *name)
+	{
+		/* empty elements such as <LocalPath/> have no text */
+		const char *text = task->FirstChildElement(name)->GetText();
+		return text ? text : std::string();
+	}
+
+
+	static tinyxml2::XMLElement *
+	FindTransferInfo(tinyxml2::XMLElement *ftp, const TransferInfo &info)
 	{
 		if(ftp)
 		{
@@ -438,10 +2595,10 @@ namespace Rainbow{
 				int mode;
 				task->FirstChildElement("TransferMode")->QueryIntText(&mode);
 				temp.transferMode = static_cast<TransferInfo::TransferMode>(mode);
-				temp.host = task->FirstChildElement("Host")->GetText();
-				temp.serverPath = task->FirstChildElement("ServerPath")->GetText();
-				temp.localPath = task->FirstChildElement("LocalPath")->GetText();
-				temp.filename = task->FirstChildElement("Filename")->GetText();
+				temp.host = ChildText(task, "Host");
+				temp.serverPath = ChildText(task, "ServerPath");
+				temp.localPath = ChildText(task, "LocalPath");
+				temp.filename = ChildText(task, "Filename");
 				task->FirstChildElement("Offset")->QueryUnsigned64Text(&temp.offset);
 				if(temp == info)
 				{
@@ -450,224 +2607,799 @@ namespace Rainbow{
 				task = task->NextSiblingElement();
 			}
 		}
-		return nullptr;	
+		return nullptr;	
+	}
+
+
+	void DataPort::PutBreakInfo(const TransferInfo &info)
+	{
+		tinyxml2::XMLDocument doc;
+		doc.LoadFile("flFTP.xml");
+		tinyxml2::XMLElement *root = doc.FirstChildElement("root");
+		tinyxml2::XMLElement *ftp = root->FirstChildElement("flFTP");
+		if(ftp)
+		{
+			tinyxml2::XMLElement *task = FindTransferInfo(ftp, info);
+			
+			//has record
+			if(task)
+			{
+				tinyxml2::XMLElement *offsetNode = task->FirstChildElement("Offset");
+				offsetNode->SetText(info.offset);
+			}
+			else 
+			{
+				tinyxml2::XMLElement *new_task = doc.NewElement("task");
+				tinyxml2::XMLElement *transferMode = doc.NewElement("TransferMode");
+				tinyxml2::XMLElement *host = doc.NewElement("Host");
+				tinyxml2::XMLElement *serverPath = doc.NewElement("ServerPath");
+				tinyxml2::XMLElement *localPath = doc.NewElement("LocalPath");
+				tinyxml2::XMLElement *filename = doc.NewElement("Filename");
+				tinyxml2::XMLElement *offset = doc.NewElement("Offset");
+				transferMode->SetText(info.transferMode);
+				host->SetText(info.host.c_str());
+				serverPath->SetText(info.serverPath.c_str());
+				localPath->SetText(info.localPath.c_str());
+				filename->SetText(info.filename.c_str());
+				offset->SetText(info.offset);
+				new_task->InsertFirstChild(transferMode);
+				new_task->InsertEndChild(host);
+				new_task->InsertEndChild(serverPath);
+				new_task->InsertEndChild(localPath);
+				new_task->InsertEndChild(filename);
+				new_task->InsertEndChild(offset);
+				ftp->InsertEndChild(new_task);
+			}
+		}
+		doc.SaveFile("flFTP.xml");
 	}
 
 
-	void DataPort::PutBreakInfo(const TransferInfo &info)
+	void DataPort::DeleteBreakInfo(const TransferInfo &info)
 	{
 		tinyxml2::XMLDocument doc;
 		doc.LoadFile("flFTP.xml");
 		tinyxml2::XMLElement *root = doc.FirstChildElement("root");
 		tinyxml2::XMLElement *ftp = root->FirstChildElement("flFTP");
+
 		if(ftp)
 		{
-			tinyxml2::XMLElement *task = FindTransferInfo(ftp, info);
-			
-			//has record
-			if(task)
-			{
-				tinyxml2::XMLElement *offsetNode = task->FirstChildElement("Offset");
-				offsetNode->SetText(info.offset);
-			}
-			else 
+			tinyxml2::XMLElement *task = FindTransferInfo(ftp, info);
+			if(task)
+				ftp->DeleteChild(task);	
+		}
+		doc.SaveFile("flFTP.xml");
+	}
+
+	
+	bool operator!=(const TransferInfo &lhs, const TransferInfo &rhs)
+	{
+		return !(lhs == rhs);
+	}
+	
+	bool operator==(const TransferInfo &lhs, const TransferInfo &rhs)
+	{
+		if(lhs.filename == rhs.filename &&
+				lhs.host == rhs.host &&
+				lhs.serverPath == rhs.serverPath &&
+				lhs.localPath == rhs.localPath &&
+				lhs.transferMode == rhs.transferMode)
+			return true;
+		return false;
+	}
+	
+
+	int flFTP::SetTransferType(TransferType type)
+	{
+		if(CompleteTransfer() < 0)
+			return -1;
+
+		char command[BUFFER];
+		if(type == Ascii)
+		{
+			snprintf(command, BUFFER, "TYPE A\r\n");
+		}
+		else 
+		{
+			snprintf(command, BUFFER, "TYPE I\r\n");
+		}
+
+		if(_commPort->Send(command, strlen(command), 0) < 0)
+		{
+			_errorMessage = "Request not sent";
+			return -1;
+		}
+		
+		char message[BUFFER] = {0};
+		if(_commPort->Recv(message, BUFFER - 1, 0, FTP_COMMAND_SUCCESS, _errorMessage) < 0)
+			return -1;
+
+		_type = type;
+		return 0;
+	}
+
+
+	int flFTP::JoinServer(const std::string &host, const std::string &service)
+	{
+		_host = host;
+		_service = service;
+		if(_commPort->Connect(host, service) < 0)
+		{
+			_errorMessage = "connection failed";
+			return -1;
+		}
+		int ret;
+		char message[BUFFER] = { 0 };
+
+		ret = _commPort->Recv(message, BUFFER - 1, 0, FTP_SERVER_READY_OK, _errorMessage);
+		if(ret < 0)
+		{
+			return -1;
+		}
+
+		return 0;
+	}
+
+
+	int flFTP::Login(const std::string &username, const std::string &password)
+	{
+		_username = username;
+		_password = password;
+		
+		int n;
+		char command[BUFFER];
+		snprintf(command, BUFFER, "USER %s\r\n", username.c_str());
+		if((n = _commPort->Send(command, strlen(command), 0)) < 0)
+		{
+			_errorMessage = _commPort->GetErrorDesc();
+			return -1;
+		}
+
+		char message[BUFFER];
+		memset(message, 0x00, sizeof(message));
+		if((n = _commPort->Recv(message, BUFFER - 1, 0, 
+						FTP_CORRECT_USERNAME, _errorMessage)) < 0)
+		{
+			return -1;
+		}
+
+		memset(command, 0x00, sizeof(command));
+		snprintf(command, BUFFER, "PASS %s\r\n", password.c_str());
+		if((n = _commPort->Send(command, strlen(command), 0)) < 0)
+		{
+			_errorMessage = "Send failed";
+			return -1;
+		}
+
+		memset(message, 0x00, sizeof(message));
+		if((n = _commPort->Recv(message, BUFFER - 1, 0, 
+						FTP_LOGIN_SUCCESS, _errorMessage)) < 0)
+		{
+			return -1;
+		}
+
+		return 0;
+	}
+
+
+	int flFTP::Download(const std::string &filename, const std::string &destDir)
+	{
+		return DownloadFile(filename, destDir, -1);
+	}
+
+
+	int flFTP::DownloadFile(const std::string &filename, const std::string &destDir,
+			int64_t size)
+	{
+		if(CompleteTransfer() < 0 || DropSegments() < 0)
+			return -1;
+		_verifyFile.clear();
+		_verifyFailed = false;
+
+		_localPath = ConvToRealPath(destDir);
+		
+		InitTransferInfo(filename, TransferInfo::Download);
+		_transferInfo->offset = _getBreakPointFunc(*_transferInfo);
+		if(_dataPort->Mapping() == MapMemory)
+			_transferInfo->offset = 0;
+
+		/* without a sync the file may have lost what the breakpoint counts */
+		struct stat st;
+		if(_transferInfo->offset > 0 && 
+				(stat((destDir + filename).c_str(), &st) < 0 || (std::size_t)st.st_size < _transferInfo->offset))
+			_transferInfo->offset = 0;
+		if(_transferInfo->offset > 0 && 
+				VerifyTail(filename, destDir + filename, _transferInfo->offset) < 0)
+		{
+			/* the local copy is not what the server has, fetch it all again */
+			_transferInfo->offset = 0;
+			++_retries;
+			if(_metrics)
+				_metrics->AddRetry();
+		}
+
+		/*
+		 * None of PASV, SIZE and REST waits on the reply of another. REST
+		 * goes last, just before RETR: some servers forget the restart
+		 * offset on any command in between.
+		 */
+		std::vector<CommPort::Pipelined> commands{{"PASV\r\n", -1, ""}};
+		if(size < 0)
+			commands.push_back(CommPort::Pipelined{"SIZE " + filename + "\r\n", -1, ""});
+		commands.push_back(CommPort::Pipelined{
+				"REST " + std::to_string(_transferInfo->offset) + "\r\n", -1, ""});
+		if(RunCommands(commands) < 0)
+			return -1;
+		int port = PassivePort(commands[0]);
+		if(port < 0)
+			return -1;
+		if(_commPort->Check(commands.back(), FTP_NEED_FURTHER_COMM) < 0)
+			_transferInfo->offset = 0;
+		std::size_t serverFileSize = (std::size_t)size;
+		if(size < 0)
+			serverFileSize = (commands[1].code == 213 ?
+					(std::size_t)atoll(commands[1].reply.c_str() + 4) : (std::size_t)-1);
+
+		if(_dataPort->Connect(_host, std::to_string(port)) < 0)
+		{
+			_errorMessage = "data port connection failed";
+			return -1;
+		}
+		if(_commPort->Get(filename) < 0)
+		{
+			_errorMessage = _commPort->GetErrorDesc();
+			return -1;
+		}
+		_transferPending = true;
+
+		int ret = 0;
+		std::ios_base::openmode mode;
+		if(_transferInfo->offset == 0)
+			mode = std::ios::trunc | std::ios::out;
+		else
+			mode = std::ios::app;
+
+		if(_type == Binary)
+			mode |= std::ios::binary;
+
+		ret = _dataPort->GetFile(destDir + filename, serverFileSize, mode, *_transferInfo);
+		if(ret < 0)
+		{
+			_errorMessage = _dataPort->GetErrorDesc();
+			return -1;
+		}
+
+		if(_verify != HashNone)
+		{
+			_verifyFile = filename;
+			_verifyLocalFile = destDir + filename;
+		}
+
+		return ret;
+	}
+
+
+	int flFTP::Upload(const std::string &filename, const std::string &srcDir)
+	{
+		if(CompleteTransfer() < 0 || DropSegments() < 0)
+			return -1;
+
+		_localPath = ConvToRealPath(srcDir);
+
+		InitTransferInfo(filename, TransferInfo::Upload);
+		_transferInfo->offset = _getBreakPointFunc(*_transferInfo);
+
+		std::vector<CommPort::Pipelined> commands{{"PASV\r\n", -1, ""}};
+		if(_transferInfo->offset > 0)
+			commands.push_back(CommPort::Pipelined{"SIZE " + filename + "\r\n", -1, ""});
+		if(RunCommands(commands) < 0)
+			return -1;
+		int port = PassivePort(commands[0]);
+		if(port < 0)
+			return -1;
+
+		/* 
+		 * Only what the server stored can be appended to, which may 
+		 * be less than we had handed to the socket when interrupted.
+		 */
+		if(_transferInfo->offset > 0)
+		{
+			if(commands[1].code != 213)
+				_transferInfo->offset = 0;
+			else 
+				_transferInfo->offset = std::min(_transferInfo->offset,
+						(std::size_t)atoll(commands[1].reply.c_str() + 4));
+		}
+
+		if(_dataPort->Connect(_host, std::to_string(port)) < 0)
+		{
+			_errorMessage = "data port connection failed";
+			return -1;
+		}
+		/* STOR truncates the server's copy, so the local one must be there first */
+		std::size_t localSize;
+		if(_dataPort->OpenUpload(srcDir + filename, localSize) < 0)
+		{
+			_errorMessage = _dataPort->GetErrorDesc();
+			_dataPort->CancelUpload();
+			return -1;
+		}
+		if(localSize < _transferInfo->offset)
+		{
+			_errorMessage = "bad upload offset";
+			_dataPort->CancelUpload();
+			return -1;
+		}
+		if(_commPort->Put(filename, _transferInfo->offset > 0) < 0)
+		{
+			_errorMessage = _commPort->GetErrorDesc();
+			_dataPort->CancelUpload();
+			return -1;
+		}
+		_transferPending = true;
+
+		/* the data connection closes with it, the server then ends the transfer */
+		if(_dataPort->PutFile(_transferInfo->offset, *_transferInfo) < 0)
+		{
+			_errorMessage = _dataPort->GetErrorDesc();
+			return -1;
+		}
+		return 0;
+	}
+
+
+	int flFTP::SegmentedDownload(const std::string &filename, unsigned int segments,
+			const std::string &destDir)
+	{
+		/* every range is worth at least this much of a connection setup */
+		const std::size_t minSegment = 1 << 20;
+
+		if(segments <= 1 || _type != Binary)
+			return Download(filename, destDir);
+
+		/* the closing reply of the last transfer must not pass for that of SIZE */
+		if(CompleteTransfer() < 0 || DropSegments() < 0)
+			return -1;
+
+		std::size_t serverFileSize = _commPort->GetFileSize(filename);
+		if(serverFileSize == (std::size_t)-1 || serverFileSize < 2 * minSegment)
+			return Download(filename, destDir);
+		segments = std::min<std::size_t>(segments, serverFileSize / minSegment);
+
+		for(unsigned int i = 1; i < segments; ++i)
+		{
+			std::unique_ptr<flFTP> segment;
+			std::string errorDesc;
+			if(_pool)
+				segment = _pool->Acquire(_host, _service, _username, _password, errorDesc);
+			else 
+			{
+				segment = details::make_unique<flFTP>();
+				if(segment->Connection(_host, _service) < 0 || 
+						segment->Login(_username, _password) < 0)
+					segment.reset();
+			}
+			if(!segment)
+				break;
+			segment->SetPipelining(_pipelining, _pipelineTimeout);
+			segment->SetRateLimit(0);
+			segment->SetRateLimiter(&_dataPort->GetRateLimit());
+			segment->SetMetrics(_metrics);
+			if(segment->SetTransferType(_type) < 0 ||
+					(!_serverPath.empty() && segment->Cd(_serverPath) < 0))
+			{
+				/* the pool closes it unless it is fit for another user */
+				segment->SetRateLimiter(nullptr);
+				segment->SetMetrics(nullptr);
+				if(_pool)
+					_pool->Release(std::move(segment));
+				break;
+			}
+			for(auto elem : _progressList)
+				segment->AddIProgress(elem);
+			if(!_progressList.empty())
+				segment->SetProgressNotifier(_dataPort->GetProgressNotifier());
+			_segments.push_back(std::move(segment));
+		}
+
+		_localPath = ConvToRealPath(destDir);
+		InitTransferInfo(filename, TransferInfo::Download);
+
+		const std::string localFile = destDir + filename;
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		int fd = open(localFile.c_str(), flags, 0644);
+		if(fd < 0)
+		{
+			_errorMessage = "open file error";
+			return -1;
+		}
+		/* the ranges arrive in any order, the whole is reserved at once */
+		if(_dataPort->Preallocating())
+			Preallocate(fd, 0, serverFileSize);
+		close(fd);
+
+		auto received = std::make_shared<std::atomic<std::size_t>>(0);
+		std::size_t rangeSize = serverFileSize / (_segments.size() + 1);
+		std::size_t offset = 0;
+		for(auto &segment : _segments)
+		{
+			if(segment->DownloadRange(filename, localFile, offset, rangeSize, 
+						received, serverFileSize) < 0)
 			{
-				tinyxml2::XMLElement *new_task = doc.NewElement("task");
-				tinyxml2::XMLElement *transferMode = doc.NewElement("TransferMode");
-				tinyxml2::XMLElement *host = doc.NewElement("Host");
-				tinyxml2::XMLElement *serverPath = doc.NewElement("ServerPath");
-				tinyxml2::XMLElement *localPath = doc.NewElement("LocalPath");
-				tinyxml2::XMLElement *filename = doc.NewElement("Filename");
-				tinyxml2::XMLElement *offset = doc.NewElement("Offset");
-				transferMode->SetText(info.transferMode);
-				host->SetText(info.host.c_str());
-				serverPath->SetText(info.serverPath.c_str());
-				localPath->SetText(info.localPath.c_str());
-				filename->SetText(info.filename.c_str());
-				offset->SetText(info.offset);
-				new_task->InsertFirstChild(transferMode);
-				new_task->InsertEndChild(host);
-				new_task->InsertEndChild(serverPath);
-				new_task->InsertEndChild(localPath);
-				new_task->InsertEndChild(filename);
-				new_task->InsertEndChild(offset);
-				ftp->InsertEndChild(new_task);
+				_errorMessage = segment->GetErrorDesc();
+				StopDownload();
+				return -1;
 			}
+			offset += rangeSize;
 		}
-		doc.SaveFile("flFTP.xml");
+
+		/* the last range runs to the end of file, on our own connection */
+		if(DownloadRange(filename, localFile, offset, serverFileSize - offset, 
+					received, serverFileSize) < 0)
+		{
+			StopDownload();
+			return -1;
+		}
+		return 0;
 	}
 
 
-	void DataPort::DeleteBreakInfo(const TransferInfo &info)
+	int flFTP::DownloadRange(const std::string &filename, const std::string &localFile,
+			std::size_t offset, std::size_t length,
+			std::shared_ptr<std::atomic<std::size_t>> received, std::size_t total)
 	{
-		tinyxml2::XMLDocument doc;
-		doc.LoadFile("flFTP.xml");
-		tinyxml2::XMLElement *root = doc.FirstChildElement("root");
-		tinyxml2::XMLElement *ftp = root->FirstChildElement("flFTP");
+		if(CompleteTransfer() < 0)
+			return -1;
 
-		if(ftp)
+		std::vector<CommPort::Pipelined> commands{
+			{"PASV\r\n", -1, ""},
+			{"REST " + std::to_string(offset) + "\r\n", -1, ""}};
+		if(RunCommands(commands) < 0)
+			return -1;
+		int port = PassivePort(commands[0]);
+		if(port < 0)
+			return -1;
+		if(_commPort->Check(commands[1], FTP_NEED_FURTHER_COMM) < 0)
 		{
-			tinyxml2::XMLElement *task = FindTransferInfo(ftp, info);
-			if(task)
-				ftp->DeleteChild(task);	
+			_errorMessage = _commPort->GetErrorDesc();
+			return -1;
 		}
-		doc.SaveFile("flFTP.xml");
-	}
 
-	
-	bool operator!=(const TransferInfo &lhs, const TransferInfo &rhs)
-	{
-		return !(lhs == rhs);
+		if(_dataPort->Connect(_host, std::to_string(port)) < 0)
+		{
+			_errorMessage = "data port connection failed";
+			return -1;
+		}
+		if(_commPort->Get(filename) < 0)
+		{
+			_errorMessage = _commPort->GetErrorDesc();
+			return -1;
+		}
+		_transferPending = true;
+
+		_dataPort->ShareProgress(received, total);
+		if(_dataPort->GetFileRange(localFile, offset, length, *_transferInfo) < 0)
+		{
+			_errorMessage = _dataPort->GetErrorDesc();
+			return -1;
+		}
+		return 0;
 	}
-	
-	bool operator==(const TransferInfo &lhs, const TransferInfo &rhs)
+
+
+	void flFTP::SetBreakJournal(BreakJournal *journal)
 	{
-		if(lhs.filename == rhs.filename &&
-				lhs.host == rhs.host &&
-				lhs.serverPath == rhs.serverPath &&
-				lhs.localPath == rhs.localPath &&
-				lhs.transferMode == rhs.transferMode)
-			return true;
-		return false;
+		using std::placeholders::_1;
+		SetBreakRecordMethod(std::bind(&BreakJournal::Get, journal, _1),
+				std::bind(&BreakJournal::Put, journal, _1),
+				std::bind(&BreakJournal::Delete, journal, _1));
 	}
-	
 
-	int flFTP::SetTransferType(TransferType type)
+
+	int flFTP::Noop()
 	{
-		char command[BUFFER];
-		if(type == Ascii)
-		{
-			snprintf(command, BUFFER, "TYPE A\r\n");
-		}
-		else 
-		{
-			snprintf(command, BUFFER, "TYPE I\r\n");
-		}
+		if(CompleteTransfer() < 0)
+			return -1;
 
+		const char *command = "NOOP\r\n";
 		if(_commPort->Send(command, strlen(command), 0) < 0)
 		{
-			_errorMessage = "Request not sent";
+			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
-		
 		char message[BUFFER] = {0};
 		if(_commPort->Recv(message, BUFFER - 1, 0, FTP_COMMAND_SUCCESS, _errorMessage) < 0)
 			return -1;
-
-		_type = type;
 		return 0;
 	}
 
 
-	int flFTP::JoinServer(const std::string &host, const std::string &service)
+	int flFTP::Cd(const std::string &path)
 	{
-		_host = host;
-		if(_commPort->Connect(host, service) < 0)
-		{
-			_errorMessage = "connection failed";
+		if(CompleteTransfer() < 0)
 			return -1;
-		}
-		int ret;
-		char message[BUFFER] = { 0 };
 
-		ret = _commPort->Recv(message, BUFFER - 1, 0, FTP_SERVER_READY_OK, _errorMessage);
-		if(ret < 0)
+		std::vector<CommPort::Pipelined> commands{
+			{"CWD " + path + "\r\n", -1, ""},
+			{"PWD\r\n", -1, ""}};
+		if(RunCommands(commands) < 0 || _commPort->Check(commands[0], FTP_DIR_CHANGE) < 0)
 		{
+			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
-
+		if(commands[1].code == 257)
+			_serverPath = CommPort::ParsePwd(commands[1].reply);
+		else
+			_serverPath.clear();
 		return 0;
 	}
 
 
-	int flFTP::Login(const std::string &username, const std::string &password)
+	int flFTP::RunCommands(std::vector<CommPort::Pipelined> &commands)
 	{
-		_username = username;
-		_password = password;
-		
-		int n;
-		char command[BUFFER];
-		snprintf(command, BUFFER, "USER %s\r\n", username.c_str());
-		if((n = _commPort->Send(command, strlen(command), 0)) < 0)
+		if(_commPort->Pipeline(commands) == 0)
+			return 0;
+		if(!_pipelining || _commPort->Pipelining())
 		{
 			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
 
-		char message[BUFFER];
-		memset(message, 0x00, sizeof(message));
-		if((n = _commPort->Recv(message, BUFFER - 1, 0, 
-						FTP_CORRECT_USERNAME, _errorMessage)) < 0)
+		/* the server mishandled commands sent ahead, stop sending them */
+		_pipelining = false;
+		++_retries;
+		if(_metrics)
+			_metrics->AddRetry();
+		if(Reconnect() < 0)
+			return -1;
+		for(auto &command : commands)
 		{
+			command.code = -1;
+			command.reply.clear();
+		}
+		if(_commPort->Pipeline(commands) < 0)
+		{
+			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
+		return 0;
+	}
 
-		memset(command, 0x00, sizeof(command));
-		snprintf(command, BUFFER, "PASS %s\r\n", password.c_str());
-		if((n = _commPort->Send(command, strlen(command), 0)) < 0)
+
+	int flFTP::Reconnect()
+	{
+		std::string serverPath = _serverPath;
+		_commPort = details::make_unique<CommPort>();
+		_commPort->SetPipelining(_pipelining, _pipelineTimeout);
+		_commPort->SetMetrics(_metrics);
+		_transferPending = false;
+		if(JoinServer(_host, _service) < 0 || Login(_username, _password) < 0 ||
+				SetTransferType(_type) < 0)
+			return -1;
+		if(!serverPath.empty() && Cd(serverPath) < 0)
+			return -1;
+		return 0;
+	}
+
+
+	int flFTP::List(const std::string &path, Listing &listing)
+	{
+		return List(path, [&listing](const ListEntry &entry){ listing.Add(entry); });
+	}
+
+
+	int flFTP::List(const std::string &path, const std::function<void(const ListEntry&)> &callback)
+	{
+		if(CompleteTransfer() < 0)
+			return -1;
+
+		bool mlsd;
+		int code;
+		do
 		{
-			_errorMessage = "Send failed";
+			int port;
+			if((port = _commPort->PassiveMode()) < 0) 
+			{
+				_errorMessage = _commPort->GetErrorDesc();
+				return -1;
+			}
+			if(_dataPort->Connect(_host, std::to_string(port)) < 0)
+			{
+				_errorMessage = "data port connection failed";
+				return -1;
+			}
+			code = _commPort->List(path, mlsd);
+		/* refused MLSD, the next round sends LIST */
+		}while(mlsd && (code == 500 || code == 502));
+		if(code != 150 && code != 125)
+		{
+			_dataPort->Close();
+			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
 
-		memset(message, 0x00, sizeof(message));
-		if((n = _commPort->Recv(message, BUFFER - 1, 0, 
-						FTP_LOGIN_SUCCESS, _errorMessage)) < 0)
+		ListParser parser(mlsd, callback);
+		int ret = _dataPort->RecvStream([&parser](const char *data, std::size_t n)
+				{
+					parser.Feed(data, n);
+				});
+		parser.Finish();
+
+		char message[BUFFER] = {0};
+		if(_commPort->Recv(message, BUFFER - 1, 0, FTP_TRANSFER_COMPLETE, _errorMessage) < 0 ||
+				ret < 0)
 		{
+			if(ret < 0)
+				_errorMessage = _dataPort->GetErrorDesc();
 			return -1;
 		}
-
 		return 0;
 	}
 
 
-	int flFTP::Download(const std::string &filename, const std::string &destDir)
+	int64_t flFTP::ModifyTime(const std::string &filename)
 	{
-		int port;
-		if((port = _commPort->PassiveMode()) < 0) 
-		{
+		if(CompleteTransfer() < 0)
+			return -1;
+		int64_t mtime = _commPort->ModifyTime(filename);
+		if(mtime < 0)
 			_errorMessage = _commPort->GetErrorDesc();
+		return mtime;
+	}
+
+
+	TransferState flFTP::Wait()
+	{
+		for(auto &segment : _segments)
+			segment->Wait();
+		_dataPort->Wait();
+		CompleteTransfer();
+		if(!_verifyFile.empty() && _dataPort->State() == TransferState::Done)
+			VerifyReceived();
+		_verifyFile.clear();
+		return DownloadState();
+	}
+
+
+	/*
+	 * Compare the window before offset with the server's copy, return -1
+	 * only when they differ, not when the server cannot tell
+	 */
+	int flFTP::VerifyTail(const std::string &filename, const std::string &localFile,
+			std::size_t offset)
+	{
+		if(_verify == HashNone || _verifyWindow == 0)
+			return 0;
+
+		std::size_t start = offset - std::min(offset, _verifyWindow);
+		std::string remote;
+		if(_commPort->RangeHash(filename, _verify, start, offset, remote) < 0)
+			return 0;
+		std::unique_ptr<Hash> local = MakeHash(_verify);
+		if(HashFile(localFile, start, offset, *local) < 0)
 			return -1;
-		}
+		return SameDigest(local->HexDigest(), remote) ? 0 : -1;
+	}
 
-		_localPath = ConvToRealPath(destDir);
-		
-		InitTransferInfo(filename, TransferInfo::Download);
-		_transferInfo->offset = _getBreakPointFunc(*_transferInfo);
 
-		if(GotoBreakpoint(_transferInfo->offset) < 0)
-			_transferInfo->offset = 0;
-		std::size_t serverFileSize = _commPort->GetFileSize(filename);
+	void flFTP::VerifyReceived()
+	{
+		/* a download held in memory has no file, the mapping is all */
+		const MappedData *mapped = (_dataPort->Mapping() == MapMemory) ? _dataPort->Mapped() : nullptr;
+		struct stat st;
+		std::size_t size;
+		if(mapped)
+			size = mapped->Size();
+		else if(stat(_verifyLocalFile.c_str(), &st) == 0)
+			size = st.st_size;
+		else 
+			return;
+		std::string remote;
+		if(_dataPort->Digest().empty() || size == 0 || 
+				_commPort->RangeHash(_verifyFile, _verify, 0, size, remote) < 0)
+			return;
+
+		/* the stage hashed with the SetChecksum() algorithm */
+		std::string local = _dataPort->Digest();
+		if(_dataPort->HashType() != _verify)
+		{
+			std::unique_ptr<Hash> hash = MakeHash(_verify);
+			if(mapped)
+				hash->Update(mapped->Data(), size);
+			else if(HashFile(_verifyLocalFile, 0, size, *hash) < 0)
+				return;
+			local = hash->HexDigest();
+		}
+		if(!SameDigest(local, remote))
+		{
+			_verifyFailed = true;
+			_errorMessage = "checksum mismatch";
+		}
+	}
 
-		if(_dataPort->Connect(_host, std::to_string(port)) < 0)
+
+	/*
+	 * Once the data connection has ended the server closes the transfer
+	 * with a reply of its own, which must be read before the next command
+	 * or every later reply would be taken for the one before it.
+	 */
+	int flFTP::CompleteTransfer()
+	{
+		if(!_transferPending)
+			return 0;
+		if(_dataPort->State() == TransferState::Transport)
 		{
-			_errorMessage = "data port connection failed";
+			_errorMessage = "transfer in progress";
 			return -1;
 		}
-		if(_commPort->Get(filename) < 0)
+
+		_transferPending = false;
+		char message[BUFFER] = {0};
+		if(_commPort->Recv(message, BUFFER - 1, 0, FTP_TRANSFER_COMPLETE, _errorMessage) < 0)
 		{
-			_errorMessage = _commPort->GetErrorDesc();
-			return -1;
+			if(message[0] == '\0')
+				return -1;
+			/*
+			 * A 426 or 451 after an interrupted transfer ends it just as
+			 * well, after one that seemed whole the server cut it short
+			 */
+			if(message[0] == '4' || message[0] == '5')
+				_dataPort->Aborted(*_transferInfo);
 		}
+		return 0;
+	}
 
-		int ret = 0;
-		std::ios_base::openmode mode;
-		if(_transferInfo->offset == 0)
-			mode = std::ios::trunc | std::ios::out;
-		else
-			mode = std::ios::app;
 
-		if(_type == Binary)
-			mode |= std::ios::binary;
+	/* Those of an earlier segmented download would count towards the next transfer */
+	int flFTP::DropSegments()
+	{
+		for(auto &segment : _segments)
+		{
+			if(segment->DownloadState() == TransferState::Transport)
+			{
+				_errorMessage = "transfer in progress";
+				return -1;
+			}
+		}
+		ReleaseSegments();
+		return 0;
+	}
 
-		ret = _dataPort->GetFile(destDir + filename, serverFileSize, mode, *_transferInfo);
-		if(ret < 0)
+
+	void flFTP::ReleaseSegments()
+	{
+		for(auto &segment : _segments)
 		{
-			_errorMessage = _dataPort->GetErrorDesc();
-			return -1;
+			for(auto elem : _progressList)
+				segment->RemoveIProgress(elem);
+			segment->SetProgressNotifier(nullptr);
+			segment->SetRateLimiter(nullptr);
+			segment->SetMetrics(nullptr);
+			if(_pool)
+				_pool->Release(std::move(segment));
 		}
+		_segments.clear();
+	}
 
-		return ret;
+
+	TransferState flFTP::DownloadState()
+	{
+		if(_verifyFailed)
+			return TransferState::NetworkAnomaly;
+		TransferState state = _dataPort->State();
+		for(auto &segment : _segments)
+		{
+			TransferState segmentState = segment->DownloadState();
+			if(segmentState == TransferState::NetworkAnomaly || 
+					segmentState == TransferState::Suspend)
+				return segmentState;
+			if(segmentState != TransferState::Done && state == TransferState::Done)
+				state = TransferState::Transport;
+		}
+		return state;
 	}
 
 
@@ -678,12 +3410,30 @@ namespace Rainbow{
 			_serverPath(std::move(rhs._serverPath)),
 			_localPath(std::move(rhs._localPath)),
 			_host(std::move(rhs._host)),
+			_service(std::move(rhs._service)),
 			_username(std::move(rhs._username)),
 			_password(std::move(rhs._password)),
 			_errorMessage(std::move(rhs._errorMessage)),
+			_progressList(std::move(rhs._progressList)),
 			_commPort(rhs._commPort.release()),
-			_dataPort(rhs._dataPort.release())
-	{}
+			_dataPort(rhs._dataPort.release()),
+			_segments(std::move(rhs._segments)),
+			_transferPending(rhs._transferPending),
+			_pool(rhs._pool),
+			_mirrorCache(rhs._mirrorCache),
+			_metrics(rhs._metrics),
+			_retries(rhs._retries),
+			_pipelining(rhs._pipelining),
+			_pipelineTimeout(rhs._pipelineTimeout),
+			_verify(rhs._verify),
+			_checksum(rhs._checksum),
+			_verifyWindow(rhs._verifyWindow),
+			_verifyFile(std::move(rhs._verifyFile)),
+			_verifyLocalFile(std::move(rhs._verifyLocalFile)),
+			_verifyFailed(rhs._verifyFailed)
+	{
+		rhs._transferPending = false;
+	}
 
 	flFTP &flFTP::operator=(flFTP &&rhs) DFL_NOEXCEPT 
 	{
@@ -695,32 +3445,45 @@ namespace Rainbow{
 			_serverPath = std::move(rhs._serverPath);
 			_localPath = std::move(rhs._localPath);
 			_host = std::move(rhs._host);
+			_service = std::move(rhs._service);
 			_username = std::move(rhs._username);
 			_password = std::move(rhs._password);
 			_errorMessage = std::move(rhs._errorMessage);
+			_progressList = std::move(rhs._progressList);
 			_commPort.reset(rhs._commPort.release());
 			_dataPort.reset(rhs._dataPort.release());
+			ReleaseSegments();
+			_segments = std::move(rhs._segments);
+			_transferPending = rhs._transferPending;
+			_pool = rhs._pool;
+			_mirrorCache = rhs._mirrorCache;
+			_metrics = rhs._metrics;
+			_retries = rhs._retries;
+			_pipelining = rhs._pipelining;
+			_pipelineTimeout = rhs._pipelineTimeout;
+			_verify = rhs._verify;
+			_checksum = rhs._checksum;
+			_verifyWindow = rhs._verifyWindow;
+			_verifyFile = std::move(rhs._verifyFile);
+			_verifyLocalFile = std::move(rhs._verifyLocalFile);
+			_verifyFailed = rhs._verifyFailed;
+			rhs._transferPending = false;
 		}
 		return *this;
 	}
 
 
-	int flFTP::GotoBreakpoint(std::size_t offset)
+	int flFTP::PassivePort(CommPort::Pipelined &reply)
 	{
-		char command[BUFFER];
-		snprintf(command, BUFFER, "REST %zd\r\n", offset);
-		if(_commPort->Send(command, strlen(command), 0) < 0)
+		if(_commPort->Check(reply, FTP_PASSIVE_MODE) < 0)
 		{
 			_errorMessage = _commPort->GetErrorDesc();
 			return -1;
 		}
-		char message[BUFFER] = {0};
-		if(_commPort->Recv(message, BUFFER - 1, 0, 
-					FTP_NEED_FURTHER_COMM, _errorMessage) < 0)
-		{
-			return -1;
-		}
-		return offset;
+		int port = CommPort::GetPortFromMessage(&reply.reply[0]);
+		if(port < 0)
+			_errorMessage = "bad passive reply";
+		return port;
 	}
 
 
@@ -732,6 +3495,29 @@ namespace Rainbow{
 		_transferInfo->localPath = _localPath;
 		_transferInfo->host = _host;
 		_transferInfo->filename = filename;
+		_retries = 0;
+	}
+
+
+	TransferStats flFTP::GetTransferStats()
+	{
+		TransferStats stats = _dataPort->GetTransferStats();
+		stats.retries = _retries;
+		for(auto &segment : _segments)
+		{
+			TransferStats part = segment->GetTransferStats();
+			stats.bytes += part.bytes;
+			stats.seconds = std::max(stats.seconds, part.seconds);
+			stats.throughput += part.throughput;
+			stats.averageThroughput += part.averageThroughput;
+			if(part.firstByteSeconds >= 0 && 
+					(stats.firstByteSeconds < 0 || part.firstByteSeconds < stats.firstByteSeconds))
+				stats.firstByteSeconds = part.firstByteSeconds;
+			stats.diskWaitSeconds += part.diskWaitSeconds;
+			stats.networkWaitSeconds += part.networkWaitSeconds;
+			stats.retries += part.retries;
+		}
+		return stats;
 	}
 
 
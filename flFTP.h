@@ -4,8 +4,10 @@
 #include <type_traits>
 #include <memory>
 #include <map>
+#include <algorithm>
 #include <functional>
 #include <list>
+#include <vector>
 #include <fstream>
 
 #if defined(_WIN32)
@@ -20,6 +22,13 @@
 #include <atomic>
 #include <future>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "flHash.h"
+#include "flRate.h"
+#include "flStats.h"
+#include "flProgress.h"
+#include <deque>
 
 namespace Rainbow{ 
 
@@ -78,6 +87,19 @@ const unsigned int BUFFER = 512;
 			virtual int Recv(void *buf, size_t n, int flags) = 0;
 			void Close();
 
+			socket_t GetSocket() const
+			{
+				return _sock;
+			}
+
+			/* End the connection but keep the descriptor until Close() */
+			void Shutdown();
+
+			int SetNonBlocking();
+
+			/* Kernel receive buffer size (SO_RCVBUF), -1 on error */
+			int RecvBufferSize();
+
 			int GetLastError() const
 			{
 				return _error;
@@ -119,6 +141,13 @@ const unsigned int BUFFER = 512;
 			virtual int Send(const void *buffer, size_t n, int flags) override;
 			virtual int Recv(void *buf, size_t n, int flags) override; 
 
+			/*
+			 * Send up to n bytes of the file fd starting at offset and 
+			 * advance offset past them. Uses sendfile(2) where available 
+			 * so the data never enters user space.
+			 */
+			int SendFile(int fd, std::size_t &offset, std::size_t n);
+
 			virtual ~TcpSockClient() {}
 	};
 
@@ -141,17 +170,22 @@ namespace details{
 #define		FTP_COMMAND_SUCCESS				"200"
 #define		FTP_COMMAND_FAILED				"202"
 #define		FTP_FILE_SIZE					"213"
+#define		FTP_FILE_STATUS					"213"
 #define		FTP_SERVER_READY_OK				"220"
+#define		FTP_TRANSFER_COMPLETE			"226"
 #define		FTP_PASSIVE_MODE				"227"
 #define		FTP_LOGIN_SUCCESS				"230"
 #define     FTP_DIR_CHANGE					"250"
+#define		FTP_FILE_ACTION_OK				"250"
 #define		FTP_CURR_PATH					"257"
 #define		FTP_CORRECT_USERNAME			"331"
 #define		FTP_NEED_ACCOUNT_INFO			"332"
 #define		FTP_NEED_FURTHER_COMM			"350"
 #define		FTP_CANNOT_SERVICE				"421"
 #define		FTP_CANNOT_OPEN_DATA_CONN		"425"
+#define		FTP_TRANSFER_ABORTED			"426"
 #define		FTP_FILE_ACTION_NOT_TAKEN		"450"
+#define		FTP_LOCAL_ERROR					"451"
 #define		FTP_NOT_ENOUGH_DISK_SPACE		"452"
 #define		FTP_FORMAT_ERROR				"500"
 #define		FTP_PARAM_ERROR					"501"
@@ -164,6 +198,55 @@ namespace details{
 
 
 
+	/*
+	 * Control connection bytes, cut into replies as they arrive. A reply
+	 * is one line "ddd text", or the lines from "ddd-text" to the one
+	 * starting "ddd "; lines may end in CRLF or a bare LF, and a first
+	 * line without a code is a reply of its own so the stream can
+	 * recover. The socket reads straight into the buffer and replies
+	 * are handed out in place. Consuming one only moves the read
+	 * position; what is left is moved to the front when the back runs
+	 * out of room. The scan picks up where it stopped, so a long reply
+	 * arriving in pieces is looked at once.
+	 */
+	class ReplyBuffer
+	{
+		public:
+			/* Room for at least n more bytes, nullptr once a reply outgrows MaxReply */
+			char *Space(std::size_t n);
+
+			/* n bytes were written to Space() */
+			void Commit(std::size_t n)
+			{
+				_write += n;
+			}
+
+			/*
+			 * The first whole reply and its code, -1 if it has none;
+			 * false until one has arrived. It stays valid until Consume()
+			 * or Space().
+			 */
+			bool Next(const char *&reply, std::size_t &length, int &code);
+
+			/* Drop the reply Next() returned */
+			void Consume();
+
+			static const std::size_t MaxReply = 1 << 20;
+
+		private:
+			/* The code at p, -1 if p does not start with three digits */
+			static int Code(const char *p, std::size_t n);
+
+			std::vector<char> _data;
+			std::size_t _read = 0;			/* start of the first reply */
+			std::size_t _write = 0;			/* end of what was received */
+			std::size_t _line = 0;			/* start of the line being scanned */
+			std::size_t _scan = 0;			/* where the scan for its end resumes */
+			std::size_t _end = 0;			/* end of the first reply once whole, else 0 */
+			int			_code = -1;
+	};
+
+
 	class CommPort 
 	{
 		public:
@@ -187,12 +270,17 @@ namespace details{
 
 			std::size_t GetFileSize(const std::string &filename);
 
+			/* MDTM, seconds since the epoch UTC, -1 if the server cannot tell */
+			int64_t ModifyTime(const std::string &filename);
+
 			int Send(const void *buffer, size_t n , int flags)
 			{
 				int sendBytes;
 				sendBytes = _tcpSock->Send(buffer, n, flags);
 				if(sendBytes <= 0)
 					_errorMessage = "Send failed";
+				else if(_metrics)
+					Sent((const char *)buffer, sendBytes);
 
 				return sendBytes;
 			}
@@ -204,14 +292,88 @@ namespace details{
 
 			int Get(const std::string &filename);
 
+			/*
+			 * STOR filename, or APPE filename when append is set
+			 */
+			int Put(const std::string &filename, bool append);
+
+			/*
+			 * MLSD path, or LIST path once the server has refused MLSD on
+			 * this connection; mlsd tells which was sent. Return the reply
+			 * code, 150 or 125 when the listing follows, -1 if none came.
+			 */
+			int List(const std::string &path, bool &mlsd);
+
+			/* Whether listings come from MLSD, so their times are exact */
+			bool UsesMlsd() const
+			{
+				return !_noMlsd;
+			}
+
 			std::string Pwd();
 
+			/* The directory in a 257 reply to PWD */
+			static std::string ParsePwd(const std::string &reply);
+
+			/* A command of Pipeline() and the reply it got, code -1 if none */
+			struct Pipelined
+			{
+				std::string command;
+				int			code;
+				std::string reply;
+			};
+
+			/*
+			 * Send commands in one write and match the replies to them in
+			 * order, or send each after the reply to the one before while
+			 * pipelining is off. Every command gets its reply whatever its
+			 * code. Returns -1 when the connection broke, or when replies
+			 * had not all come within the pipeline timeout: a server that
+			 * drops commands sent ahead looks like that, so pipelining is
+			 * turned off and the connection must not carry more commands.
+			 */
+			int Pipeline(std::vector<Pipelined> &commands);
+
+			/* 0 if command got futureCode, else -1 with the reason in GetErrorDesc() */
+			int Check(const Pipelined &command, const std::string &futureCode)
+			{
+				return CheckRespondCode(command.reply, futureCode, _errorMessage) < 0 ? -1 : 0;
+			}
+
+			void SetPipelining(bool enable, std::chrono::milliseconds timeout)
+			{
+				_pipelining = enable;
+				_pipelineTimeout = timeout;
+			}
+
+			bool Pipelining() const
+			{
+				return _pipelining;
+			}
+
+			/* Time each command to its reply into metrics, nullptr for none */
+			void SetMetrics(Metrics *metrics)
+			{
+				_metrics = metrics;
+				_outstanding.clear();
+			}
+
+			/*
+			 * Server side digest of bytes [start, end) of filename, in hex
+			 * as the server sent it
+			 */
+			int RangeHash(const std::string &filename, HashAlgorithm algorithm,
+					std::size_t start, std::size_t end, std::string &digest);
+
 			/*
 			 * Entering Passive Mode
 			 * Return FTP data port
 			 */
 			int PassiveMode();
 
+			/* The data port of a 227 reply */
+			static int GetPortFromMessage(char *message);
+
 			//std::string GetServerSystem();
 
 			~CommPort() {}
@@ -229,19 +391,75 @@ namespace details{
 			int CheckRespondCode(const std::string &respondMessage,
 					const std::string &futureCode, std::string &errorDesc);
 
-			int GetPortFromMessage(char *message);
+			/*
+			 * Read until _replyBuffer holds a whole reply and return its
+			 * length, the reply left in reply and code; 0 if timeout 
+			 * passed first, a negative timeout waits for ever; -1 if the
+			 * connection broke
+			 */
+			int FillReply(std::chrono::milliseconds timeout, const char *&reply, int &code);
+
+			/* Send command, read a reply, return its code or -1 if none came */
+			int Command(const char *command, char *message);
+
+			/* n bytes of commands went out, each line awaits a reply */
+			void Sent(const char *p, std::size_t n);
+
+			/* The reply to the oldest outstanding command came with code */
+			void Replied(int code);
+
+			enum HashCommand
+			{
+				HashCommandHash = 1,
+				HashCommandXcrc = 2,
+				HashCommandXmd5 = 4
+			};
 
 			static const std::map<std::string, std::string> _errDescTable;
 			std::string		_errorMessage;
+			/* received but not yet returned, replies may arrive together */
+			ReplyBuffer		_replyBuffer;
+			/* HashCommand bits the server turned down */
+			unsigned int	_unsupportedHash = 0;
+			bool			_noMlsd = false;
+			bool			_pipelining = false;
+			std::chrono::milliseconds _pipelineTimeout{10000};
+			Metrics			*_metrics = nullptr;
+			struct Outstanding
+			{
+				Metrics::Command command;
+				std::chrono::steady_clock::time_point sent;
+				bool		timed;			/* false while a transfer awaits its 226 */
+			};
+			std::deque<Outstanding> _outstanding;
+			std::string		_sentName;		/* the command a partly sent line starts with */
+			bool			_sentNameDone = false;
 			std::unique_ptr<TcpSockClient> _tcpSock;
 
 	};
 
 
+	/*
+	 * Observes transfers, called from a ProgressNotifier's thread every
+	 * interval and once more when the transfer ends. A slow observer
+	 * slows only the notifier. From within these calls observers must
+	 * not be added or removed, nor transfers started.
+	 */
 	class IProgress
 	{
 		public:
-			virtual void DoProgress(double value) = 0;
+			/* The share of the file transferred */
+			virtual void DoProgress(double value)
+			{
+				(void)value;
+			}
+
+			/* The default hands DoProgress() the fraction */
+			virtual void OnProgress(const Progress &progress)
+			{
+				DoProgress(progress.fraction);
+			}
+
 			virtual ~IProgress(){}
 	};
 
@@ -270,29 +488,44 @@ namespace details{
 		public:
 			Thread() = default;
 
+			/*
+			 * The flag lives in the new thread's TLS, which goes away when
+			 * the thread ends; the thread forgets it under the lock on the
+			 * way out so Interrupt() never writes to a finished thread.
+			 */
 			template<typename FunctionType>
-			Thread(FunctionType f)
+			Thread(FunctionType f):
+				_state(std::make_shared<State>())
 			{
-				std::promise<InterruptFlag*> p;
-				_t = std::thread([f, &p]
+				std::promise<void> p;
+				std::shared_ptr<State> state = _state;
+				_t = std::thread([f, &p, state]
 					{
-					p.set_value(&this_thread_interrupt_flag);
+					{
+						std::lock_guard<std::mutex> lk(state->mt);
+						state->flag = &this_thread_interrupt_flag;
+					}
+					p.set_value();
 					f();
+					std::lock_guard<std::mutex> lk(state->mt);
+					state->flag = nullptr;
 					});
-				_flag = p.get_future().get();
+				p.get_future().wait();
 			}
 
 			void Interrupt()
 			{
-				if(_flag)
-					_flag->set();
+				if(!_state)
+					return;
+				std::lock_guard<std::mutex> lk(_state->mt);
+				if(_state->flag)
+					_state->flag->set();
 			}
 
 			Thread(Thread &&rhs) DFL_NOEXCEPT :
-				_flag(rhs._flag),
+				_state(std::move(rhs._state)),
 				_t(std::move(rhs._t))
 			{
-				rhs._flag = nullptr;
 			}
 
 			Thread &operator=(Thread &&rhs) DFL_NOEXCEPT
@@ -300,8 +533,7 @@ namespace details{
 				if(this != &rhs)
 				{
 					_t = std::move(rhs._t);
-					_flag = rhs._flag;
-					rhs._flag = nullptr;
+					_state = std::move(rhs._state);
 				}
 				return *this;
 			}
@@ -317,13 +549,18 @@ namespace details{
 
 			~Thread()
 			{
-				if(_flag)
-					_flag->set();
+				Interrupt();
 				if(_t.joinable())
 					_t.join();
 			}
 		private:
-			InterruptFlag *_flag = nullptr;
+			struct State
+			{
+				std::mutex		mt;
+				InterruptFlag	*flag = nullptr;
+			};
+
+			std::shared_ptr<State>	_state;
 			std::thread		_t;
 	};
 
@@ -357,6 +594,69 @@ namespace details{
 	};
 	
 
+	/*
+	 * TYPE A lines end in CRLF on the wire and in LF here: convert the n
+	 * bytes of data in place and return the length left. data must have
+	 * room for one byte past n. A CR ending the buffer is held back in
+	 * pendingCR until the next one tells whether it starts a CRLF; one
+	 * still held when the data ends is a CR of its own.
+	 */
+	std::size_t ToLocalText(char *data, std::size_t n, bool &pendingCR);
+
+
+	/* Where DataPort::SetMapping() puts a download */
+	enum MapMode
+	{
+		MapNone,		/* written to the file */
+		MapFile,		/* the file, mapped, is written in place */
+		MapMemory		/* anonymous memory only, no file */
+	};
+
+
+	/*
+	 * The bytes of a finished download left mapped for the caller, see
+	 * DataPort::SetMapping(). Unmapped when destroyed.
+	 */
+	class MappedData
+	{
+		public:
+			MappedData(char *data, std::size_t length, std::size_t size):
+				_data(data),
+				_length(length),
+				_size(size)
+			{}
+
+			MappedData(const MappedData&) = delete;
+			MappedData &operator=(const MappedData&) = delete;
+
+			const char *Data() const
+			{
+				return _data;
+			}
+
+			std::size_t Size() const
+			{
+				return _size;
+			}
+
+			~MappedData();
+
+		private:
+			char		*_data;
+			std::size_t _length;		/* mapped, at least _size */
+			std::size_t _size;
+	};
+
+
+	class BufferRing;
+	class Reactor;
+	class SessionPool;
+	class BreakJournal;
+	class Listing;
+	struct ListEntry;
+	class MirrorWalk;
+	class MirrorCache;
+
 	class DataPort
 	{
 		public:
@@ -375,6 +675,7 @@ namespace details{
 
 			int Connect(const std::string host, const std::string port)
 			{
+				_connectTime = std::chrono::steady_clock::now().time_since_epoch().count();
 				return _tcpSock->Connect(host, port);
 			}
 
@@ -382,15 +683,287 @@ namespace details{
 			int GetFile(const std::string &filename, std::size_t size, 
 					std::ios_base::openmode mode, TransferInfo &info);
 
+			/*
+			 * Open filename for PutFile() and tell its size, before the
+			 * server is asked to store anything
+			 */
+			int OpenUpload(const std::string &filename, std::size_t &size);
+
+			/*
+			 * Send the file OpenUpload() opened over the data connection
+			 * from offset to its end
+			 */
+			int PutFile(std::size_t offset, TransferInfo &info);
+
+			/*
+			 * Close the file OpenUpload() opened and the data connection,
+			 * so a server told to store it ends the transfer
+			 */
+			void CancelUpload();
+
+			/*
+			 * Receive length bytes from the data connection and write them
+			 * to filename starting at offset, leaving the rest of the file
+			 * untouched. No breakpoint is recorded for a range.
+			 */
+			int GetFileRange(const std::string &filename, std::size_t offset,
+					std::size_t length, TransferInfo &info);
+
+			/*
+			 * Receive until the server closes the data connection, handing
+			 * each buffer to sink as it arrives. Runs on the calling thread
+			 * and writes no file, it is meant for listings.
+			 */
+			int RecvStream(const std::function<void(const char *, std::size_t)> &sink);
+
+			/*
+			 * Report progress as the share of total that has arrived on
+			 * received, which may be fed by several data ports at once.
+			 */
+			void ShareProgress(std::shared_ptr<std::atomic<std::size_t>> received,
+					std::size_t total)
+			{
+				_sharedReceived = received;
+				_sharedTotal = total;
+			}
+
+			/*
+			 * Observers are looked at as a transfer starts: one added in
+			 * the middle of it is called from the next on, unless a
+			 * notifier was set. Once RemoveIProgress() returns the
+			 * observer is not called again.
+			 */
 			void AddIProgress(IProgress *iprogress)
 			{
+				std::lock_guard<std::mutex> lk(_progressMt);
 				_progressList.push_back(iprogress);
 			}
 			void RemoveIProgress(IProgress *iprogress)
 			{
+				std::lock_guard<std::mutex> lk(_progressMt);
 				_progressList.remove(iprogress);
 			}
 
+			/*
+			 * Call the observers from notifier, which may be shared with
+			 * other sessions and must outlive this one; nullptr to have
+			 * one of this port's own. Not to be changed during a transfer.
+			 */
+			void SetProgressNotifier(ProgressNotifier *notifier);
+
+			/* The notifier set, or this port's own */
+			ProgressNotifier *GetProgressNotifier();
+
+			/* How often this port's own notifier calls the observers */
+			void SetProgressInterval(std::chrono::milliseconds interval)
+			{
+				_progressInterval = interval;
+				if(_ownNotifier)
+					_ownNotifier->SetInterval(interval);
+			}
+
+			/*
+			 * Bounds of the receive buffer. Each transfer starts at initial,
+			 * or at the socket's SO_RCVBUF when initial is 0, and doubles 
+			 * towards max while reads keep filling it, i.e. while the data 
+			 * arrives faster than one read per wakeup can drain.
+			 */
+			void SetRecvBuffer(std::size_t initial, std::size_t max)
+			{
+				_initialBuffer = initial;
+				_maxBuffer = std::max(initial, max);
+			}
+
+			struct RecvStats
+			{
+				std::size_t recvCalls;
+				std::size_t recvBytes;
+				std::size_t bufferSize;
+			};
+			/* Counters of the current or last receive */
+			RecvStats GetRecvStats() const
+			{
+				return RecvStats{_recvCalls.load(), _recvBytes.load(), _bufferSize.load()};
+			}
+
+			/*
+			 * Number of pooled buffers between the thread draining the socket
+			 * and the thread writing the file, so a slow disk does not stall
+			 * the TCP window. Below 2 both steps run on one thread in turn.
+			 */
+			void SetPipelineDepth(unsigned int depth)
+			{
+				_pipelineDepth = depth;
+			}
+
+			/*
+			 * Receive binary downloads through io_uring when the library was
+			 * built with DFL_USE_IO_URING and the kernel allows it, otherwise
+			 * through recv() and the pipeline above. On by default.
+			 */
+			void SetIoUring(bool enable)
+			{
+				_ioUring = enable;
+			}
+
+			/*
+			 * Move binary downloads from the socket to the file with 
+			 * splice(2) through a pipe, so the data never enters user 
+			 * space. Linux only, off by default; takes precedence over
+			 * io_uring.
+			 */
+			void SetSplice(bool enable)
+			{
+				_splice = enable;
+			}
+
+			/*
+			 * Hash what downloads receive as it arrives, so the whole can
+			 * be checked without reading the file again. Splice is not 
+			 * used while hashing, the data must pass through user space.
+			 */
+			void SetHash(HashAlgorithm algorithm)
+			{
+				_hashAlgorithm = algorithm;
+			}
+
+			HashAlgorithm HashType() const
+			{
+				return _hashAlgorithm;
+			}
+
+			/* Digest of what the last download received, empty if not hashed */
+			std::string Digest()
+			{
+				return _hash ? _hash->HexDigest() : std::string();
+			}
+
+			/*
+			 * While downloading, sync the file and record the offset as a
+			 * breakpoint after every bytes received or every interval,
+			 * whichever comes first, so a killed process resumes from 
+			 * there. 0 turns either trigger off.
+			 */
+			void SetCheckpoint(std::size_t bytes, std::chrono::milliseconds interval)
+			{
+				_checkpointBytes = bytes;
+				_checkpointInterval = interval;
+			}
+
+			/*
+			 * Reserve the blocks of a download of known size before the
+			 * first byte arrives, so the file is laid out in few extents
+			 * and writes need not grow it one block at a time. The file
+			 * keeps the size of what has been written; blocks reserved
+			 * and left unused are given back when the transfer ends.
+			 * Linux only, on where the file system supports it; on by
+			 * default.
+			 */
+			void SetPreallocate(bool enable)
+			{
+				_preallocate = enable;
+			}
+
+			bool Preallocating() const
+			{
+				return _preallocate;
+			}
+
+			/*
+			 * Receive binary downloads of known size straight into a
+			 * mapping, for callers that read the data right away:
+			 * MapFile maps the file, preallocated to its full size, so
+			 * what arrives is in the page cache and the caller reads it
+			 * there; MapMemory keeps it in anonymous memory and writes no
+			 * file at all, nor resumes. Either way TakeMapping() hands
+			 * over the bytes once the download is Done. ASCII downloads
+			 * and ones of unknown size are written to the file under
+			 * MapFile and refused under MapMemory. Not used with a
+			 * reactor, nor for ranges. MapNone by default. POSIX only.
+			 */
+			void SetMapping(MapMode mode)
+			{
+				_mapMode = mode;
+			}
+
+			MapMode Mapping() const
+			{
+				return _mapMode;
+			}
+
+			/* The mapping of the last download if it is Done, nullptr otherwise */
+			std::unique_ptr<MappedData> TakeMapping()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return std::move(_mapped);
+			}
+
+			/* The same, left with the port */
+			const MappedData *Mapped()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _mapped.get();
+			}
+
+			/*
+			 * Let reactor drive the data socket instead of a thread of 
+			 * our own. Downloads then use the plain recv() loop and 
+			 * the pipeline, io_uring and splice settings are ignored.
+			 * A transfer under a rate limit keeps its own thread, the
+			 * reactor cannot put a socket aside until the tokens come.
+			 */
+			void SetReactor(Reactor *reactor)
+			{
+				_reactor = reactor;
+			}
+
+			/*
+			 * Hold each transfer to bytesPerSecond, 0 for no limit. May be
+			 * changed while a transfer runs.
+			 */
+			void SetRateLimit(uint64_t bytesPerSecond)
+			{
+				_rateLimit.SetRate(bytesPerSecond);
+			}
+
+			/*
+			 * Charge transfers to limiter and the limiters above it too,
+			 * such as one per host under one for the whole process, so
+			 * they share its rate with every data port charging it. Not
+			 * to be changed during a transfer; nullptr for none.
+			 */
+			void SetRateLimiter(RateLimiter *limiter)
+			{
+				_rateLimit.SetParent(limiter);
+			}
+
+			/* Count transfers into metrics too, nullptr for none */
+			void SetMetrics(Metrics *metrics)
+			{
+				_metrics = metrics;
+			}
+
+			/* How the current or last transfer is going; retries are left at 0 */
+			TransferStats GetTransferStats() const;
+
+			/* The bucket of this port's transfers, to chain others below it */
+			RateLimiter &GetRateLimit()
+			{
+				return _rateLimit;
+			}
+
+			struct PipelineStats
+			{
+				std::size_t queueDepth;			/* filled buffers waiting for the disk */
+				std::size_t maxQueueDepth;
+				std::size_t readerStalls;		/* the network waited for a free buffer */
+				std::size_t writerStalls;		/* the disk waited for data */
+				double readerStallSeconds;
+				double writerStallSeconds;
+			};
+			/* Counters of the current or last pipelined receive */
+			PipelineStats GetPipelineStats() const;
+
 			void SetBreakInfoFun(std::function<void(const TransferInfo&)> putFunc, 
 					std::function<void(const TransferInfo&)> deleteFunc)
 			{
@@ -404,8 +977,23 @@ namespace details{
 				return _transferState;
 			}
 
+			/*
+			 * The server failed a download whose data connection ended
+			 * as if whole, so its tail never came: keep what arrived as
+			 * the breakpoint and end the transfer NetworkAnomaly. No-op
+			 * for uploads, ranges and transfers that ended otherwise.
+			 */
+			void Aborted(TransferInfo &info);
+
+			/*
+			 * Block until the current transfer has ended and its observers
+			 * have heard so, return how it ended
+			 */
+			TransferState Wait();
+
 			void Close()
 			{
+				StopAsync();
 				_recvThread.Interrupt();
 				if(_recvThread.Joinable())
 					_recvThread.Join();
@@ -417,24 +1005,167 @@ namespace details{
 				return _errorMessage;
 			}
 
-			~DataPort() {}
+			~DataPort()
+			{
+				StopAsync();
+				if(_watched)
+					_watched->Remove(this);
+			}
 		private:
-			void RecviceFile(std::ofstream &fout, std::ios_base::openmode mode,
+			int OpenFile(const std::string &filename, int flags);
+
+			void RecviceFile(std::ios_base::openmode mode,
 					std::size_t size, TransferInfo &info);
 
+			void SendFile(std::size_t size, TransferInfo &info);
+
+			std::size_t InitialRecvBuffer();
+
+			void WriteFile(BufferRing *ring, TransferInfo *info);
+
+			int RecvUring(std::size_t size, TransferInfo &info);
+
+			/* Map the download's destination as SetMapping() asks, 1 if not to */
+			int MapOutput(const std::string &filename, int flags, std::size_t size,
+					std::size_t offset);
+
+			void RecvMapped(TransferInfo &info);
+
+			int RecvSplice(std::size_t size, TransferInfo &info);
+
+			int StartAsync(bool upload, std::size_t size, TransferInfo &info);
+
+			void StopAsync();
+
+			bool OnReadable();
+
+			bool OnWritable();
+
+			/* Sleep off the debt of the rate limits, false if interrupted */
+			bool Throttle();
+
+			/* A transfer of size bytes starts: reset its stats and progress */
+			void BeginTransfer(bool upload, std::size_t size);
+
+			/* n bytes went through: charge the rate limits, stats and metrics */
+			void Account(std::size_t n);
+
+			/* The transfer was blocked on the file and on the socket this long */
+			void Waited(std::chrono::steady_clock::duration disk, 
+					std::chrono::steady_clock::duration network);
+
+			/* recvSize of the file is there, recvBytes of it just now */
+			void ReportProgress(std::size_t recvSize, std::size_t recvBytes);
+
+			/* The bytes the observers are told of */
+			std::size_t ProgressBytes() const;
+
+			/* Tell the observers; false once the transfer's end is told */
+			bool NotifyProgress();
+
+			/* Stop the ticks of the last transfer, telling its end if untold */
+			void Unwatch();
+
+			void FinishRecv(TransferInfo &info, std::size_t offset, 
+					bool interrupted, bool failed);
+
+			void Checkpoint(TransferInfo &info, std::size_t written);
+
+			std::size_t ToLocalText(char *data, std::size_t n)
+			{
+				return Rainbow::ToLocalText(data, n, _pendingCR);
+			}
+
+			friend class BufferRing;
+			struct PipelineCounters
+			{
+				std::atomic<std::size_t> queueDepth{0};
+				std::atomic<std::size_t> maxQueueDepth{0};
+				std::atomic<std::size_t> readerStalls{0};
+				std::atomic<std::size_t> writerStalls{0};
+				std::atomic<long long> readerStallNanos{0};
+				std::atomic<long long> writerStallNanos{0};
+			};
+
 			void PutBreakInfo(const TransferInfo &breakInfo);
 
 			void DeleteBreakInfo(const TransferInfo &breakInfo);
 
-			static const int FileBuffer = 4096;
+			static const std::size_t MinRecvBuffer = 64 * 1024;
+			static const std::size_t MaxRecvBuffer = 4 * 1024 * 1024;
 			std::function<void(const TransferInfo&)> _putBreakPointFunc;
 			std::function<void(const TransferInfo&)> _deleteBreakPointFunc;
 			std::list<IProgress *> _progressList;
+			std::mutex	_progressMt;		/* guards _progressList */
+			ProgressNotifier *_notifier = nullptr;
+			std::unique_ptr<ProgressNotifier> _ownNotifier;
+			ProgressNotifier *_watched = nullptr;	/* ticking for the last transfer */
+			std::chrono::milliseconds _progressInterval{100};
+			/* written by the transfer, read by the notifier */
+			std::atomic<std::size_t> _progressBytes{0};
+			std::shared_ptr<std::atomic<std::size_t>> _progressShared;	/* counts instead */
+			std::atomic<std::size_t> _progressTotal{0};
+			std::atomic_bool _progressDone{false};
+			/* the notifier's own */
+			RateMeter	_progressMeter;
+			std::size_t _progressLast = 0;
 			std::string _errorMessage;
-			std::ofstream	_fout;
+			std::vector<char> _buffer;
+			std::size_t _initialBuffer = 0;
+			std::size_t _maxBuffer = MaxRecvBuffer;
+			std::atomic<std::size_t> _recvCalls{0};
+			std::atomic<std::size_t> _recvBytes{0};
+			std::atomic<std::size_t> _bufferSize{0};
+			unsigned int _pipelineDepth = 4;
+			bool		_ioUring = true;
+			bool		_splice = false;
+			Reactor		*_reactor = nullptr;
+			RateLimiter _rateLimit;
+			Metrics		*_metrics = nullptr;
+			bool		_upload = false;
+			RateMeter	_meter;
+			/* steady_clock ticks, of the transfer's data connection and end */
+			std::atomic<long long> _connectTime{0};
+			std::atomic<long long> _endTime{0};
+			std::atomic<long long> _firstByteTime{0};
+			std::atomic<std::size_t> _transferBytes{0};
+			std::atomic<long long> _diskWait{0};
+			std::atomic<long long> _networkWait{0};
+			struct AsyncTransfer
+			{
+				bool active = false;
+				std::size_t size = 0;
+				std::size_t transferred = 0;
+				std::size_t bufferSize = 0;
+				int fullReads = 0;
+				TransferInfo *info = nullptr;
+			} _async;
+			PipelineCounters _pipelineCounters;
+			int			_fd = -1;
+			std::size_t _writeOffset = 0;
+			bool		_preallocate = true;
+			std::size_t _reserved = 0;			/* the file's blocks reach this far */
+			MapMode		_mapMode = MapNone;
+			char		*_map = nullptr;		/* the current download's, see SetMapping */
+			std::size_t _mapSize = 0;
+			std::unique_ptr<MappedData> _mapped;
+			HashAlgorithm _hashAlgorithm = HashNone;
+			std::unique_ptr<Hash> _hash;
+			std::size_t _checkpointBytes = 256 * 1024 * 1024;
+			std::chrono::milliseconds _checkpointInterval{5000};
+			std::size_t _checkpointOffset = 0;
+			std::chrono::steady_clock::time_point _checkpointTime;
+			bool		_ranged = false;
+			bool		_resumable = false;		/* the last receive kept a breakpoint */
+			bool		_text = false;			/* TYPE A, CRLF becomes LF */
+			bool		_pendingCR = false;		/* the last buffer ended in CR */
+			std::size_t _remaining = 0;
+			std::shared_ptr<std::atomic<std::size_t>> _sharedReceived;
+			std::size_t _sharedTotal = 0;
 			std::unique_ptr<TcpSockClient> _tcpSock;
 			TransferState _transferState;
 			std::mutex _mt;
+			std::condition_variable _stateCond;
 			Thread		_recvThread;
 	};
 
@@ -463,6 +1194,11 @@ namespace details{
 			flFTP(flFTP &&rhs) DFL_NOEXCEPT;
 			flFTP &operator=(flFTP &&rhs) DFL_NOEXCEPT;
 
+			~flFTP()
+			{
+				ReleaseSegments();
+			}
+
 			int Connection(const std::string &host, int port = 21)
 			{
 				return JoinServer(host, std::to_string(port));
@@ -472,23 +1208,19 @@ namespace details{
 				return JoinServer(host, service);
 			}
 
-			int Cd(const std::string &path)
-			{
-				int ret = _commPort->Cd(path);
-				if(ret < 0)
-				{
-					_errorMessage = _commPort->GetErrorDesc();
-					return -1;
-				}
-				_serverPath = _commPort->Pwd();
-				return 0;
-			}
+			int Cd(const std::string &path);
 
 
 			TransferType GetTransferType()
 			{
 				return _type;
 			}
+
+			/* The server directory as of the last Cd(), empty before any */
+			std::string GetServerPath()
+			{
+				return _serverPath;
+			}
 			int SetTransferType(TransferType type);
 
 			int Login(const std::string &username, const std::string &password);
@@ -503,6 +1235,26 @@ namespace details{
 			 */
 			int Download(const std::string &filename, 
 					const std::string &destPath = std::string());
+
+			/*
+			 * Split the file into segments ranges and fetch them in parallel, 
+			 * each over its own control and data connection. The calling 
+			 * session carries the last range, the others log in again with
+			 * the same credentials. Falls back to Download() when the size
+			 * is unknown or too small to be worth splitting.
+			 * Segmented downloads are not resumable.
+			 */
+			int SegmentedDownload(const std::string &filename, unsigned int segments,
+					const std::string &destPath = std::string());
+
+			/*
+			 * Upload srcPath + filename into the current server directory.
+			 * A recorded breakpoint resumes with APPE from the size the 
+			 * server reports. If no parameter are passed to srcPath, upload
+			 * from the current working path by default
+			 */
+			int Upload(const std::string &filename, 
+					const std::string &srcPath = std::string());
 					
 			void SetBreakRecordMethod(std::function<std::size_t(const TransferInfo&)> getFunc,
 					std::function<void(const TransferInfo&)> putFunc, 
@@ -512,13 +1264,235 @@ namespace details{
 				_dataPort->SetBreakInfoFun(putFunc, deleteFunc);
 			}
 
+			/* Record breakpoints in journal rather than flFTP.xml */
+			void SetBreakJournal(BreakJournal *journal);
+
+			/* See DataPort::SetRecvBuffer */
+			void SetRecvBuffer(std::size_t initial, std::size_t max)
+			{
+				_dataPort->SetRecvBuffer(initial, max);
+			}
+
+			/* See DataPort::SetReactor */
+			void SetReactor(Reactor *reactor)
+			{
+				_dataPort->SetReactor(reactor);
+			}
+
+			/*
+			 * Check downloads against the server's HASH, XCRC or XMD5.
+			 * Before resuming, the last window bytes of the local file
+			 * are compared and a mismatch restarts from zero. Once done, 
+			 * Wait() compares the whole file, hashed as it arrived, and
+			 * reports NetworkAnomaly on a mismatch. Skipped where the 
+			 * server knows none of the commands. HashNone turns it off.
+			 */
+			void SetVerify(HashAlgorithm algorithm, std::size_t window = 1 << 20)
+			{
+				_verify = algorithm;
+				_verifyWindow = window;
+				_dataPort->SetHash(_checksum != HashNone ? _checksum : _verify);
+			}
+
+			/*
+			 * Hash every download as it arrives and keep the digest for 
+			 * Checksum(), so it never has to be read back from disk. The
+			 * same stage serves SetVerify(), when the two algorithms 
+			 * differ the whole file check reads the file instead.
+			 * HashNone turns it off.
+			 */
+			void SetChecksum(HashAlgorithm algorithm)
+			{
+				_checksum = algorithm;
+				_dataPort->SetHash(_checksum != HashNone ? _checksum : _verify);
+			}
+
+			/*
+			 * Upper case hex digest of the last download once it is Done,
+			 * empty otherwise and for segmented or ranged downloads
+			 */
+			std::string Checksum()
+			{
+				if(_dataPort->State() != TransferState::Done)
+					return std::string();
+				return _dataPort->Digest();
+			}
+
+			/*
+			 * See DataPort::SetRateLimit. The sessions of a segmented
+			 * download or of a Mirror() share the one rate between them.
+			 */
+			void SetRateLimit(uint64_t bytesPerSecond)
+			{
+				_dataPort->SetRateLimit(bytesPerSecond);
+			}
+
+			/* See DataPort::SetRateLimiter; limiter must outlive this session */
+			void SetRateLimiter(RateLimiter *limiter)
+			{
+				_dataPort->SetRateLimiter(limiter);
+			}
+
+			/*
+			 * Count commands, transfers and their bytes into metrics, and
+			 * those of the sessions this one opens for segments or a
+			 * mirror. It must outlive this session; nullptr for none.
+			 */
+			void SetMetrics(Metrics *metrics)
+			{
+				_metrics = metrics;
+				_commPort->SetMetrics(metrics);
+				_dataPort->SetMetrics(metrics);
+			}
+
+			/* How the current or last transfer is going, its segments summed */
+			TransferStats GetTransferStats();
+
+			/* See DataPort::SetCheckpoint */
+			void SetCheckpoint(std::size_t bytes, std::chrono::milliseconds interval)
+			{
+				_dataPort->SetCheckpoint(bytes, interval);
+			}
+
+			/* See DataPort::SetSplice */
+			void SetSplice(bool enable)
+			{
+				_dataPort->SetSplice(enable);
+			}
+
+			/* See DataPort::SetPreallocate; a segmented download reserves the whole file */
+			void SetPreallocate(bool enable)
+			{
+				_dataPort->SetPreallocate(enable);
+			}
+
+			/* See DataPort::SetMapping; applies to Download() */
+			void SetMapping(MapMode mode)
+			{
+				_dataPort->SetMapping(mode);
+			}
+
+			/* The mapping of the last download, once Wait() returned Done */
+			std::unique_ptr<MappedData> TakeMapping()
+			{
+				return _dataPort->TakeMapping();
+			}
+
+			/*
+			 * Take the extra connections of SegmentedDownload() from pool
+			 * and give them back once their ranges are done. The pool
+			 * must outlive this session.
+			 */
+			void SetSessionPool(SessionPool *pool)
+			{
+				_pool = pool;
+			}
+
+			/* Keep the control connection alive, fails if it is not */
+			int Noop();
+
+			/*
+			 * Send the commands that set up a transfer or a Cd(), like
+			 * PASV, SIZE and REST, in one write rather than each after the
+			 * reply to the last, saving all but one round trip of them.
+			 * Should the server lose commands sent ahead, no reply comes
+			 * within timeout; the session then logs in again and goes on
+			 * one command at a time. Sessions this one opens, for
+			 * segments or a mirror, pipeline too.
+			 */
+			void SetPipelining(bool enable,
+					std::chrono::milliseconds timeout = std::chrono::milliseconds(10000))
+			{
+				_pipelining = enable;
+				_pipelineTimeout = timeout;
+				_commPort->SetPipelining(enable, timeout);
+			}
+
+			/*
+			 * The entries of path on the server, the current directory
+			 * when path is empty. MLSD where the server has it, LIST 
+			 * otherwise. The listing is parsed as it streams in, so the 
+			 * callback form holds no more than a line of it at a time.
+			 * Blocks until the listing is complete.
+			 */
+			int List(const std::string &path, Listing &listing);
+			int List(const std::string &path, const std::function<void(const ListEntry&)> &callback);
+
+			/* Modification time of filename, seconds since the epoch UTC, -1 if unknown */
+			int64_t ModifyTime(const std::string &filename);
+
+			struct MirrorStats
+			{
+				std::size_t directories;
+				std::size_t files;
+				std::size_t downloaded;
+				std::size_t skipped;		/* same size and time as the local copy */
+				std::size_t failed;
+				std::size_t bytes;
+			};
+
+			/*
+			 * Make localDir a copy of the tree under remoteDir. The tree is
+			 * walked by sessions connections at once, logged in like this
+			 * one or taken from its SessionPool; each keeps the directories
+			 * it finds and takes from the others when it runs out. A file
+			 * is fetched unless the local one has the same size and time,
+			 * the time from MLSD or else from MDTM, and gets the remote
+			 * time once fetched. Symbolic links are not followed.
+			 * Nothing is deleted locally, and a file cut short is fetched
+			 * again in full on the next run. Blocks until the walk ends;
+			 * returns -1 if anything failed, the last reason in
+			 * GetErrorDesc().
+			 */
+			int Mirror(const std::string &remoteDir, const std::string &localDir,
+					unsigned int sessions = 4, MirrorStats *stats = nullptr);
+
+			/*
+			 * Let Mirror() consult cache and save what it learns to it
+			 * when done. A directory whose listing hashes as cached needs
+			 * no MDTM, nor does a file listed with the size and time it
+			 * is cached with; only a changed local copy is fetched again.
+			 * The cache must outlive this session.
+			 */
+			void SetMirrorCache(MirrorCache *cache)
+			{
+				_mirrorCache = cache;
+			}
+
+			/*
+			 * Block until the current transfer, and every segment of a
+			 * segmented download, has ended, then read the server's 
+			 * closing reply so the session can carry the next command.
+			 */
+			TransferState Wait();
+
 			void AddIProgress(IProgress *iprogress)
 			{
+				_progressList.push_back(iprogress);
 				_dataPort->AddIProgress(iprogress);
 			}
 			void RemoveIProgress(IProgress *iprogress)
 			{
+				_progressList.remove(iprogress);
 				_dataPort->RemoveIProgress(iprogress);
+				for(auto &segment : _segments)
+					segment->RemoveIProgress(iprogress);
+			}
+
+			/*
+			 * Call the observers from notifier, shared with other sessions
+			 * perhaps; see DataPort::SetProgressNotifier. Segments use this
+			 * session's notifier.
+			 */
+			void SetProgressNotifier(ProgressNotifier *notifier)
+			{
+				_dataPort->SetProgressNotifier(notifier);
+			}
+
+			/* How often observers are called, 100ms by default; see DataPort */
+			void SetProgressInterval(std::chrono::milliseconds interval)
+			{
+				_dataPort->SetProgressInterval(interval);
 			}
 
 			std::string GetErrorDesc()
@@ -526,30 +1500,61 @@ namespace details{
 				return _errorMessage;
 			}
 
+			/* Also stops an upload */
 			void StopDownload()
 			{
+				for(auto &segment : _segments)
+					segment->StopDownload();
 				_dataPort->Close();
 			}
 			bool Done()
 			{
-				return (_dataPort->State() == TransferState::Done);
-			}
-			TransferState DownloadState()
-			{
-				return _dataPort->State();
+				return (DownloadState() == TransferState::Done);
 			}
+			TransferState DownloadState();
 
 		private:
+			friend class SessionPool;
+			friend class MirrorWalk;
 
 			int JoinServer(const std::string &host, const std::string &service);
 
+			/*
+			 * CommPort::Pipeline(), but should the server lose pipelined
+			 * commands, log in again and run them one at a time
+			 */
+			int RunCommands(std::vector<CommPort::Pipelined> &commands);
+
+			/* A new control connection, logged in, typed and in _serverPath */
+			int Reconnect();
+
+			/* The data port of a PASV reply, -1 with _errorMessage set if none */
+			int PassivePort(CommPort::Pipelined &reply);
+
+			/* Download() of a file known to hold size bytes, SIZE asked if size < 0 */
+			int DownloadFile(const std::string &filename, const std::string &destDir,
+					int64_t size);
+
+			int DownloadRange(const std::string &filename, const std::string &localFile,
+					std::size_t offset, std::size_t length,
+					std::shared_ptr<std::atomic<std::size_t>> received, std::size_t total);
+
 			void InitTransferInfo(const std::string &filename, TransferInfo::TransferMode mode);
 
 			std::size_t GetBreakInfo(const TransferInfo &breakInfo);
 
 			void CreateXML();
 
-			int GotoBreakpoint(std::size_t offset);
+			int CompleteTransfer();
+
+			int VerifyTail(const std::string &filename, const std::string &localFile,
+					std::size_t offset);
+
+			void VerifyReceived();
+
+			void ReleaseSegments();
+
+			int DropSegments();
 			
 			std::unique_ptr<TransferInfo> _transferInfo;
 			TransferType _type;
@@ -557,11 +1562,27 @@ namespace details{
 			std::string _serverPath;
 			std::string _localPath;
 			std::string _host;
+			std::string _service;
 			std::string _username;
 			std::string _password;
 			std::string _errorMessage;
+			std::list<IProgress *> _progressList;
 			std::unique_ptr<CommPort> _commPort;
 			std::unique_ptr<DataPort> _dataPort;
+			std::vector<std::unique_ptr<flFTP>> _segments;
+			bool		_transferPending = false;
+			SessionPool *_pool = nullptr;
+			MirrorCache *_mirrorCache = nullptr;
+			Metrics		*_metrics = nullptr;
+			std::size_t _retries = 0;			/* of the current transfer */
+			bool		_pipelining = false;
+			std::chrono::milliseconds _pipelineTimeout{10000};
+			HashAlgorithm _verify = HashNone;
+			HashAlgorithm _checksum = HashNone;
+			std::size_t _verifyWindow = 0;
+			std::string _verifyFile;		/* the download Wait() still has to check */
+			std::string _verifyLocalFile;
+			bool		_verifyFailed = false;
 	};
 
 }	/* namespace Rainbow */
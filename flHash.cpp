@@ -0,0 +1,634 @@
+/**************************************************************
+      > File Name: flHash.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 19时26分52秒
+ **************************************************************/
+
+#include "flHash.h"
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <mutex>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DFL_HASH_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace Rainbow{
+
+	uint32_t Crc32::Update(uint32_t crc, const void *data, std::size_t n)
+	{
+		static uint32_t table[256];
+		static std::once_flag once;
+		std::call_once(once, []
+			{
+				for(uint32_t i = 0; i < 256; ++i)
+				{
+					uint32_t c = i;
+					for(int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+					table[i] = c;
+				}
+			});
+
+		const unsigned char *p = (const unsigned char *)data;
+		crc = ~crc;
+		for(std::size_t i = 0; i < n; ++i)
+			crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+
+	std::string Crc32::HexDigest() const
+	{
+		char hex[9];
+		snprintf(hex, sizeof(hex), "%08X", _crc);
+		return hex;
+	}
+
+
+	/* RFC 1321 */
+	Md5::Md5()
+	{
+		_state[0] = 0x67452301;
+		_state[1] = 0xefcdab89;
+		_state[2] = 0x98badcfe;
+		_state[3] = 0x10325476;
+	}
+
+
+	void Md5::Transform(const unsigned char *block)
+	{
+		static const uint32_t K[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+		static const int R[64] = {
+			7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+			5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+			4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+			6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21 };
+
+		uint32_t m[16];
+		for(int i = 0; i < 16; ++i)
+			m[i] = block[i * 4] | (block[i * 4 + 1] << 8) |
+				(block[i * 4 + 2] << 16) | ((uint32_t)block[i * 4 + 3] << 24);
+
+		uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+		for(int i = 0; i < 64; ++i)
+		{
+			uint32_t f;
+			int g;
+			if(i < 16)
+			{
+				f = (b & c) | (~b & d);
+				g = i;
+			}
+			else if(i < 32)
+			{
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			}
+			else if(i < 48)
+			{
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			}
+			else
+			{
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+			uint32_t t = d;
+			d = c;
+			c = b;
+			uint32_t x = a + f + K[i] + m[g];
+			b = b + ((x << R[i]) | (x >> (32 - R[i])));
+			a = t;
+		}
+		_state[0] += a;
+		_state[1] += b;
+		_state[2] += c;
+		_state[3] += d;
+	}
+
+
+	void Md5::Update(const void *data, std::size_t n)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		std::size_t used = _length % 64;
+		_length += n;
+
+		if(used > 0)
+		{
+			std::size_t take = std::min(n, 64 - used);
+			memcpy(_block + used, p, take);
+			p += take;
+			n -= take;
+			if(used + take < 64)
+				return;
+			Transform(_block);
+		}
+		for(; n >= 64; p += 64, n -= 64)
+			Transform(p);
+		memcpy(_block, p, n);
+	}
+
+
+	std::string Md5::HexDigest() const
+	{
+		/* pad a copy, so more data can still follow */
+		Md5 tail(*this);
+		unsigned char pad[72] = { 0x80 };
+		std::size_t used = _length % 64;
+		std::size_t padLength = (used < 56 ? 56 : 120) - used;
+		uint64_t bits = _length * 8;
+		for(int i = 0; i < 8; ++i)
+			pad[padLength + i] = (unsigned char)(bits >> (8 * i));
+		tail.Update(pad, padLength + 8);
+
+		char hex[33];
+		for(int i = 0; i < 16; ++i)
+			snprintf(hex + 2 * i, 3, "%02X", (tail._state[i / 4] >> (8 * (i % 4))) & 0xFF);
+		return hex;
+	}
+
+
+#ifdef DFL_HASH_X86
+	/*
+	 * The kernels below are compiled for the instructions they need and 
+	 * only called once cpuid says the CPU has them, so the library itself
+	 * still runs on any x86.
+	 */
+	static bool CpuHasSse42()
+	{
+		static const bool has = []
+			{
+				unsigned int eax, ebx, ecx, edx;
+				return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+			}();
+		return has;
+	}
+
+
+	static bool CpuHasSha()
+	{
+		static const bool has = []
+			{
+				unsigned int eax, ebx, ecx, edx;
+				if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1))
+					return false;
+				return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+			}();
+		return has;
+	}
+
+
+	__attribute__((target("sse4.2")))
+	static uint32_t Crc32cSse42(uint32_t crc, const unsigned char *p, std::size_t n)
+	{
+#ifdef __x86_64__
+		uint64_t crc64 = crc;
+		for(; n >= 8; p += 8, n -= 8)
+		{
+			uint64_t word;
+			memcpy(&word, p, 8);
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+		crc = (uint32_t)crc64;
+#endif
+		for(; n >= 4; p += 4, n -= 4)
+		{
+			uint32_t word;
+			memcpy(&word, p, 4);
+			crc = _mm_crc32_u32(crc, word);
+		}
+		for(; n > 0; ++p, --n)
+			crc = _mm_crc32_u8(crc, *p);
+		return crc;
+	}
+#endif
+
+
+	uint32_t Crc32c::Update(uint32_t crc, const void *data, std::size_t n)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		crc = ~crc;
+#ifdef DFL_HASH_X86
+		if(CpuHasSse42())
+			return ~Crc32cSse42(crc, p, n);
+#endif
+		static uint32_t table[256];
+		static std::once_flag once;
+		std::call_once(once, []
+			{
+				for(uint32_t i = 0; i < 256; ++i)
+				{
+					uint32_t c = i;
+					for(int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+					table[i] = c;
+				}
+			});
+		for(std::size_t i = 0; i < n; ++i)
+			crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+
+	std::string Crc32c::HexDigest() const
+	{
+		char hex[9];
+		snprintf(hex, sizeof(hex), "%08X", _crc);
+		return hex;
+	}
+
+
+	static const uint64_t Xxh64Prime1 = 11400714785074694791ULL;
+	static const uint64_t Xxh64Prime2 = 14029467366897019727ULL;
+	static const uint64_t Xxh64Prime3 = 1609587929392839161ULL;
+	static const uint64_t Xxh64Prime4 = 9650029242287828579ULL;
+	static const uint64_t Xxh64Prime5 = 2870177450012600261ULL;
+
+	static inline uint64_t Rotl64(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static inline uint64_t Xxh64Round(uint64_t acc, uint64_t input)
+	{
+		acc += input * Xxh64Prime2;
+		return Rotl64(acc, 31) * Xxh64Prime1;
+	}
+
+	static inline uint64_t Xxh64Merge(uint64_t acc, uint64_t value)
+	{
+		acc ^= Xxh64Round(0, value);
+		return acc * Xxh64Prime1 + Xxh64Prime4;
+	}
+
+	template<typename T>
+	static inline T Load(const unsigned char *p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+
+	Xxh64::Xxh64()
+	{
+		_acc[0] = Xxh64Prime1 + Xxh64Prime2;
+		_acc[1] = Xxh64Prime2;
+		_acc[2] = 0;
+		_acc[3] = 0 - Xxh64Prime1;
+	}
+
+
+	/* four independent lanes, which keeps the multipliers busy without SIMD */
+	void Xxh64::Update(const void *data, std::size_t n)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		std::size_t used = _length % 32;
+		_length += n;
+
+		if(used > 0)
+		{
+			std::size_t take = std::min(n, 32 - used);
+			memcpy(_block + used, p, take);
+			p += take;
+			n -= take;
+			if(used + take < 32)
+				return;
+			for(int i = 0; i < 4; ++i)
+				_acc[i] = Xxh64Round(_acc[i], Load<uint64_t>(_block + 8 * i));
+		}
+
+		uint64_t v1 = _acc[0], v2 = _acc[1], v3 = _acc[2], v4 = _acc[3];
+		for(; n >= 32; p += 32, n -= 32)
+		{
+			v1 = Xxh64Round(v1, Load<uint64_t>(p));
+			v2 = Xxh64Round(v2, Load<uint64_t>(p + 8));
+			v3 = Xxh64Round(v3, Load<uint64_t>(p + 16));
+			v4 = Xxh64Round(v4, Load<uint64_t>(p + 24));
+		}
+		_acc[0] = v1;
+		_acc[1] = v2;
+		_acc[2] = v3;
+		_acc[3] = v4;
+		memcpy(_block, p, n);
+	}
+
+
+	uint64_t Xxh64::Value() const
+	{
+		uint64_t h;
+		if(_length >= 32)
+		{
+			h = Rotl64(_acc[0], 1) + Rotl64(_acc[1], 7) + Rotl64(_acc[2], 12) + Rotl64(_acc[3], 18);
+			for(int i = 0; i < 4; ++i)
+				h = Xxh64Merge(h, _acc[i]);
+		}
+		else
+			h = _acc[2] + Xxh64Prime5;
+		h += _length;
+
+		const unsigned char *p = _block;
+		std::size_t n = _length % 32;
+		for(; n >= 8; p += 8, n -= 8)
+			h = Rotl64(h ^ Xxh64Round(0, Load<uint64_t>(p)), 27) * Xxh64Prime1 + Xxh64Prime4;
+		if(n >= 4)
+		{
+			h = Rotl64(h ^ (Load<uint32_t>(p) * Xxh64Prime1), 23) * Xxh64Prime2 + Xxh64Prime3;
+			p += 4;
+			n -= 4;
+		}
+		for(; n > 0; ++p, --n)
+			h = Rotl64(h ^ (*p * Xxh64Prime5), 11) * Xxh64Prime1;
+
+		h ^= h >> 33;
+		h *= Xxh64Prime2;
+		h ^= h >> 29;
+		h *= Xxh64Prime3;
+		h ^= h >> 32;
+		return h;
+	}
+
+
+	std::string Xxh64::HexDigest() const
+	{
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llX", (unsigned long long)Value());
+		return hex;
+	}
+
+
+	static const uint32_t Sha256K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+
+	static inline uint32_t Rotr32(uint32_t x, int r)
+	{
+		return (x >> r) | (x << (32 - r));
+	}
+
+
+	static void Sha256Blocks(uint32_t state[8], const unsigned char *p, std::size_t blocks)
+	{
+		for(; blocks > 0; --blocks, p += 64)
+		{
+			uint32_t w[64];
+			for(int i = 0; i < 16; ++i)
+				w[i] = ((uint32_t)p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+			for(int i = 16; i < 64; ++i)
+			{
+				uint32_t s0 = Rotr32(w[i - 15], 7) ^ Rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = Rotr32(w[i - 2], 17) ^ Rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for(int i = 0; i < 64; ++i)
+			{
+				uint32_t t1 = h + (Rotr32(e, 6) ^ Rotr32(e, 11) ^ Rotr32(e, 25)) +
+					((e & f) ^ (~e & g)) + Sha256K[i] + w[i];
+				uint32_t t2 = (Rotr32(a, 2) ^ Rotr32(a, 13) ^ Rotr32(a, 22)) +
+					((a & b) ^ (a & c) ^ (b & c));
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+	}
+
+
+#ifdef DFL_HASH_X86
+	/* Four rounds per step on the ABEF/CDGH state layout sha256rnds2 wants */
+	__attribute__((target("sha,sse4.1")))
+	static void Sha256BlocksShaNi(uint32_t state[8], const unsigned char *p, std::size_t blocks)
+	{
+		const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+		for(; blocks > 0; --blocks, p += 64)
+		{
+			__m128i abef = state0;
+			__m128i cdgh = state1;
+			__m128i w[4];
+			for(int g = 0; g < 16; ++g)
+			{
+				if(g < 4)
+					w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * g)), mask);
+				__m128i msg = _mm_add_epi32(w[g % 4], 
+						_mm_loadu_si128((const __m128i *)&Sha256K[4 * g]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+				if(g >= 3 && g <= 14)
+				{
+					__m128i &next = w[(g + 1) % 4];
+					next = _mm_add_epi32(next, _mm_alignr_epi8(w[g % 4], w[(g + 3) % 4], 4));
+					next = _mm_sha256msg2_epu32(next, w[g % 4]);
+				}
+				state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+				if(g >= 1 && g <= 12)
+					w[(g + 3) % 4] = _mm_sha256msg1_epu32(w[(g + 3) % 4], w[g % 4]);
+			}
+			state0 = _mm_add_epi32(state0, abef);
+			state1 = _mm_add_epi32(state1, cdgh);
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+		state1 = _mm_alignr_epi8(state1, tmp, 8);
+		_mm_storeu_si128((__m128i *)&state[0], state0);
+		_mm_storeu_si128((__m128i *)&state[4], state1);
+	}
+#endif
+
+
+	static void Sha256Transform(uint32_t state[8], const unsigned char *p, std::size_t blocks)
+	{
+#ifdef DFL_HASH_X86
+		if(CpuHasSha())
+			return Sha256BlocksShaNi(state, p, blocks);
+#endif
+		Sha256Blocks(state, p, blocks);
+	}
+
+
+	Sha256::Sha256()
+	{
+		static const uint32_t init[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		memcpy(_state, init, sizeof(_state));
+	}
+
+
+	void Sha256::Update(const void *data, std::size_t n)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		std::size_t used = _length % 64;
+		_length += n;
+
+		if(used > 0)
+		{
+			std::size_t take = std::min(n, 64 - used);
+			memcpy(_block + used, p, take);
+			p += take;
+			n -= take;
+			if(used + take < 64)
+				return;
+			Sha256Transform(_state, _block, 1);
+		}
+		Sha256Transform(_state, p, n / 64);
+		memcpy(_block, p + n / 64 * 64, n % 64);
+	}
+
+
+	std::string Sha256::HexDigest() const
+	{
+		Sha256 tail(*this);
+		unsigned char pad[72] = { 0x80 };
+		std::size_t used = _length % 64;
+		std::size_t padLength = (used < 56 ? 56 : 120) - used;
+		uint64_t bits = _length * 8;
+		for(int i = 0; i < 8; ++i)
+			pad[padLength + i] = (unsigned char)(bits >> (56 - 8 * i));
+		tail.Update(pad, padLength + 8);
+
+		char hex[65];
+		for(int i = 0; i < 8; ++i)
+			snprintf(hex + 8 * i, 9, "%08X", tail._state[i]);
+		return hex;
+	}
+
+
+	std::unique_ptr<Hash> MakeHash(HashAlgorithm algorithm)
+	{
+		switch(algorithm)
+		{
+			case HashCrc32:
+				return std::unique_ptr<Hash>(new Crc32);
+			case HashMd5:
+				return std::unique_ptr<Hash>(new Md5);
+			case HashCrc32c:
+				return std::unique_ptr<Hash>(new Crc32c);
+			case HashXxh64:
+				return std::unique_ptr<Hash>(new Xxh64);
+			case HashSha256:
+				return std::unique_ptr<Hash>(new Sha256);
+			default:
+				return nullptr;
+		}
+	}
+
+
+	const char *HashName(HashAlgorithm algorithm)
+	{
+		switch(algorithm)
+		{
+			case HashCrc32:
+				return "CRC32";
+			case HashMd5:
+				return "MD5";
+			case HashCrc32c:
+				return "CRC32C";
+			case HashXxh64:
+				return "XXH64";
+			case HashSha256:
+				return "SHA-256";
+			default:
+				return "";
+		}
+	}
+
+
+	int HashFile(const std::string &path, std::size_t start, std::size_t end, Hash &hash)
+	{
+		int flags = O_RDONLY;
+#ifdef _WIN32
+		flags |= _O_BINARY;
+#endif
+		int fd = open(path.c_str(), flags);
+		if(fd < 0)
+			return -1;
+		if(lseek(fd, start, SEEK_SET) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+
+		char buf[64 * 1024];
+		while(start < end)
+		{
+			int n = read(fd, buf, std::min(sizeof(buf), end - start));
+			if(n <= 0)
+			{
+				close(fd);
+				return -1;
+			}
+			hash.Update(buf, n);
+			start += n;
+		}
+		close(fd);
+		return 0;
+	}
+
+
+	bool SameDigest(const std::string &lhs, const std::string &rhs)
+	{
+		auto digits = [](const std::string &hex)
+		{
+			std::size_t i = 0;
+			if(hex.compare(0, 2, "0x") == 0 || hex.compare(0, 2, "0X") == 0)
+				i = 2;
+			while(i + 1 < hex.size() && hex[i] == '0')
+				++i;
+			std::string out;
+			for(; i < hex.size(); ++i)
+				out += (char)toupper((unsigned char)hex[i]);
+			return out;
+		};
+		return !lhs.empty() && digits(lhs) == digits(rhs);
+	}
+
+} /* Rainbow end */
@@ -0,0 +1,149 @@
+#ifndef FLHASH_H
+#define FLHASH_H
+#include <string>
+#include <memory>
+#include <cstdint>
+
+namespace Rainbow{
+
+	enum HashAlgorithm
+	{
+		HashNone,
+		HashCrc32,
+		HashMd5,
+		HashCrc32c,
+		HashXxh64,
+		HashSha256
+	};
+
+	/* Incremental digest of a byte stream */
+	class Hash
+	{
+		public:
+			virtual void Update(const void *data, std::size_t n) = 0;
+
+			/* Upper case hex of the digest of everything so far */
+			virtual std::string HexDigest() const = 0;
+
+			virtual ~Hash() {}
+	};
+
+
+	/* CRC-32 as used by zip, XCRC and HASH CRC32 */
+	class Crc32 : public Hash
+	{
+		public:
+			static uint32_t Update(uint32_t crc, const void *data, std::size_t n);
+
+			virtual void Update(const void *data, std::size_t n) override
+			{
+				_crc = Update(_crc, data, n);
+			}
+
+			uint32_t Value() const
+			{
+				return _crc;
+			}
+
+			virtual std::string HexDigest() const override;
+
+		private:
+			uint32_t	_crc = 0;
+	};
+
+
+	class Md5 : public Hash
+	{
+		public:
+			Md5();
+
+			virtual void Update(const void *data, std::size_t n) override;
+
+			virtual std::string HexDigest() const override;
+
+		private:
+			void Transform(const unsigned char *block);
+
+			uint32_t	_state[4];
+			uint64_t	_length = 0;
+			unsigned char _block[64];
+	};
+
+
+	/*
+	 * CRC-32C (Castagnoli), with the SSE4.2 crc32 instruction where the
+	 * CPU has it
+	 */
+	class Crc32c : public Hash
+	{
+		public:
+			static uint32_t Update(uint32_t crc, const void *data, std::size_t n);
+
+			virtual void Update(const void *data, std::size_t n) override
+			{
+				_crc = Update(_crc, data, n);
+			}
+
+			uint32_t Value() const
+			{
+				return _crc;
+			}
+
+			virtual std::string HexDigest() const override;
+
+		private:
+			uint32_t	_crc = 0;
+	};
+
+
+	/* XXH64 with seed 0 */
+	class Xxh64 : public Hash
+	{
+		public:
+			Xxh64();
+
+			virtual void Update(const void *data, std::size_t n) override;
+
+			uint64_t Value() const;
+
+			virtual std::string HexDigest() const override;
+
+		private:
+			uint64_t	_acc[4];
+			uint64_t	_length = 0;
+			unsigned char _block[32];
+	};
+
+
+	/* SHA-256, with the SHA extensions where the CPU has them */
+	class Sha256 : public Hash
+	{
+		public:
+			Sha256();
+
+			virtual void Update(const void *data, std::size_t n) override;
+
+			virtual std::string HexDigest() const override;
+
+		private:
+			uint32_t	_state[8];
+			uint64_t	_length = 0;
+			unsigned char _block[64];
+	};
+
+
+	/* nullptr for HashNone */
+	std::unique_ptr<Hash> MakeHash(HashAlgorithm algorithm);
+
+	/* The name the HASH command knows it by */
+	const char *HashName(HashAlgorithm algorithm);
+
+	/* Feed bytes [start, end) of the file at path to hash */
+	int HashFile(const std::string &path, std::size_t start, std::size_t end, Hash &hash);
+
+	/* Whether two hex digests are the same, ignoring case and leading zeros */
+	bool SameDigest(const std::string &lhs, const std::string &rhs);
+
+}	/* namespace Rainbow */
+
+#endif //FLHASH_H
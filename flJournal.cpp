@@ -0,0 +1,415 @@
+/**************************************************************
+      > File Name: flJournal.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 18时41分15秒
+ **************************************************************/
+
+#include "flJournal.h"
+#include "flHash.h"
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#	define fsync(fd) _commit(fd)
+#	define ftruncate(fd, size) _chsize_s(fd, size)
+#endif
+
+namespace Rainbow{
+
+	/*
+	 * Record layout:
+	 *   u32 crc32 of what follows the length
+	 *   u32 length of what follows
+	 *   u8  type, u8 transfer mode, u64 offset
+	 *   u32 lengths of host, serverPath, localPath and filename
+	 *   the four strings, without terminators
+	 */
+	static const std::size_t HeaderSize = 8;
+	static const std::size_t BodyFixedSize = 1 + 1 + 8 + 4 * 4;
+
+	/* compacting a small log is not worth the rename */
+	static const std::size_t MinCompactBytes = 1 << 20;
+
+
+	template<typename T>
+	static void PutValue(std::string &out, T value)
+	{
+		out.append((const char *)&value, sizeof(value));
+	}
+
+	template<typename T>
+	static T GetValue(const char *p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+
+	/* A rename is durable only once the directory holding it is synced */
+	static int SyncDirectory(const std::string &path)
+	{
+#ifdef _WIN32 
+		(void)path;
+		return 0;
+#else 
+		std::size_t slash = path.rfind('/');
+		std::string dir = (slash == std::string::npos) ? "." : 
+			(slash == 0 ? "/" : path.substr(0, slash));
+		int fd = open(dir.c_str(), O_RDONLY);
+		if(fd < 0)
+			return -1;
+		int ret = fsync(fd);
+		close(fd);
+		return ret;
+#endif 
+	}
+
+
+	static int WriteAll(int fd, const char *buf, std::size_t n)
+	{
+		while(n > 0)
+		{
+			int written = write(fd, buf, n);
+			if(written < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return -1;
+			}
+			buf += written;
+			n -= written;
+		}
+		return 0;
+	}
+
+
+	std::string BreakJournal::Key(const TransferInfo &info)
+	{
+		std::string key;
+		key.reserve(info.host.size() + info.serverPath.size() +
+				info.localPath.size() + info.filename.size() + 5);
+		key += (char)('0' + info.transferMode);
+		key += '\0';
+		key += info.host;
+		key += '\0';
+		key += info.serverPath;
+		key += '\0';
+		key += info.localPath;
+		key += '\0';
+		key += info.filename;
+		return key;
+	}
+
+
+	std::size_t BreakJournal::RecordSize(const TransferInfo &info)
+	{
+		return HeaderSize + BodyFixedSize + info.host.size() + info.serverPath.size() +
+			info.localPath.size() + info.filename.size();
+	}
+
+
+	void BreakJournal::Encode(std::string &out, RecordType type, const TransferInfo &info)
+	{
+		std::size_t start = out.size();
+		out.append(HeaderSize, '\0');
+		PutValue<uint8_t>(out, type);
+		PutValue<uint8_t>(out, info.transferMode);
+		PutValue<uint64_t>(out, info.offset);
+		PutValue<uint32_t>(out, info.host.size());
+		PutValue<uint32_t>(out, info.serverPath.size());
+		PutValue<uint32_t>(out, info.localPath.size());
+		PutValue<uint32_t>(out, info.filename.size());
+		out += info.host;
+		out += info.serverPath;
+		out += info.localPath;
+		out += info.filename;
+
+		uint32_t length = out.size() - start - HeaderSize;
+		uint32_t crc = Crc32::Update(0, &out[start + HeaderSize], length);
+		memcpy(&out[start], &crc, 4);
+		memcpy(&out[start + 4], &length, 4);
+	}
+
+
+	std::size_t BreakJournal::Replay(const std::string &data)
+	{
+		std::size_t pos = 0;
+		while(data.size() - pos >= HeaderSize + BodyFixedSize)
+		{
+			const char *p = data.data() + pos;
+			uint32_t crc = GetValue<uint32_t>(p);
+			uint32_t length = GetValue<uint32_t>(p + 4);
+			if(length < BodyFixedSize || data.size() - pos - HeaderSize < length ||
+					Crc32::Update(0, p + HeaderSize, length) != crc)
+				break;
+
+			const char *body = p + HeaderSize;
+			uint32_t sizes[4];
+			std::size_t strings = 0;
+			for(int i = 0; i < 4; ++i)
+			{
+				sizes[i] = GetValue<uint32_t>(body + 10 + 4 * i);
+				strings += sizes[i];
+			}
+			if(BodyFixedSize + strings != length)
+				break;
+
+			TransferInfo info;
+			info.transferMode = (TransferInfo::TransferMode)GetValue<uint8_t>(body + 1);
+			info.offset = GetValue<uint64_t>(body + 2);
+			const char *s = body + BodyFixedSize;
+			info.host.assign(s, sizes[0]);
+			s += sizes[0];
+			info.serverPath.assign(s, sizes[1]);
+			s += sizes[1];
+			info.localPath.assign(s, sizes[2]);
+			s += sizes[2];
+			info.filename.assign(s, sizes[3]);
+
+			std::string key = Key(info);
+			auto search = _index.find(key);
+			if(search != _index.end())
+			{
+				_liveBytes -= RecordSize(search->second);
+				_index.erase(search);
+			}
+			if(GetValue<uint8_t>(body) == PutRecord)
+			{
+				_liveBytes += RecordSize(info);
+				_index.emplace(std::move(key), std::move(info));
+			}
+			pos += HeaderSize + length;
+		}
+		return pos;
+	}
+
+
+	int BreakJournal::Open(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		CloseLocked();
+		_index.clear();
+		_liveBytes = 0;
+		_unsynced = 0;
+		_path = path;
+
+		int flags = O_RDWR | O_CREAT | O_APPEND;
+#ifdef _WIN32 
+		/* the records are binary, CRLF translation would break every CRC */
+		flags |= _O_BINARY;
+#endif
+		_fd = open(path.c_str(), flags, 0644);
+		if(_fd < 0)
+		{
+			_errorMessage = "open journal error";
+			return -1;
+		}
+
+		std::string data;
+		char buf[64 * 1024];
+		int n;
+		while((n = read(_fd, buf, sizeof(buf))) != 0)
+		{
+			if(n < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				_errorMessage = "read journal error";
+				return -1;
+			}
+			data.append(buf, n);
+		}
+
+		/* a crash mid-append leaves a torn record, drop it */
+		_fileBytes = Replay(data);
+		if(_fileBytes < data.size() && ftruncate(_fd, _fileBytes) < 0)
+		{
+			_errorMessage = "truncate journal error";
+			return -1;
+		}
+		_lastSync = std::chrono::steady_clock::now();
+		return 0;
+	}
+
+
+	std::size_t BreakJournal::Get(const TransferInfo &info)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		auto search = _index.find(Key(info));
+		return search == _index.end() ? 0 : search->second.offset;
+	}
+
+
+	void BreakJournal::Put(const TransferInfo &info)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		std::string key = Key(info);
+		auto search = _index.find(key);
+		if(search != _index.end())
+		{
+			_liveBytes -= RecordSize(search->second);
+			search->second = info;
+		}
+		else
+			_index.emplace(std::move(key), info);
+		_liveBytes += RecordSize(info);
+		Append(PutRecord, info);
+	}
+
+
+	void BreakJournal::Delete(const TransferInfo &info)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		auto search = _index.find(Key(info));
+		if(search == _index.end())
+			return;
+		_liveBytes -= RecordSize(search->second);
+		_index.erase(search);
+		Append(DeleteRecord, info);
+	}
+
+
+	void BreakJournal::Append(RecordType type, const TransferInfo &info)
+	{
+		if(_fd < 0)
+			return;
+
+		std::string record;
+		Encode(record, type, info);
+		if(WriteAll(_fd, record.data(), record.size()) < 0)
+		{
+			_errorMessage = "write journal error";
+			return;
+		}
+		_fileBytes += record.size();
+
+		if(++_unsynced >= _syncRecords ||
+				std::chrono::steady_clock::now() - _lastSync >= _syncInterval)
+			SyncLocked();
+		if(_fileBytes > MinCompactBytes && _fileBytes > 2 * _liveBytes)
+			CompactLocked();
+	}
+
+
+	int BreakJournal::Sync()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		return SyncLocked();
+	}
+
+
+	int BreakJournal::SyncLocked()
+	{
+		_lastSync = std::chrono::steady_clock::now();
+		if(_fd < 0 || _unsynced == 0)
+			return 0;
+		_unsynced = 0;
+		if(fsync(_fd) < 0)
+		{
+			_errorMessage = "sync journal error";
+			return -1;
+		}
+		return 0;
+	}
+
+
+	int BreakJournal::Compact()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		return CompactLocked();
+	}
+
+
+	/*
+	 * Write the live records beside the log and rename them over it, so
+	 * a crash leaves either the old log or the new one, never half of it.
+	 */
+	int BreakJournal::CompactLocked()
+	{
+		if(_fd < 0)
+			return -1;
+
+		std::string data;
+		data.reserve(_liveBytes);
+		for(auto &elem : _index)
+			Encode(data, PutRecord, elem.second);
+
+		const std::string tmpPath = _path + ".tmp";
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		int fd = open(tmpPath.c_str(), flags, 0644);
+		if(fd < 0)
+		{
+			_errorMessage = "open journal error";
+			return -1;
+		}
+		if(WriteAll(fd, data.data(), data.size()) < 0 || fsync(fd) < 0)
+		{
+			_errorMessage = "write journal error";
+			close(fd);
+			remove(tmpPath.c_str());
+			return -1;
+		}
+		close(fd);
+		if(rename(tmpPath.c_str(), _path.c_str()) < 0)
+		{
+			_errorMessage = "rename journal error";
+			remove(tmpPath.c_str());
+			return -1;
+		}
+		/* the new log is in place either way, only not yet durably */
+		int ret = 0;
+		if(SyncDirectory(_path) < 0)
+		{
+			_errorMessage = "sync journal error";
+			ret = -1;
+		}
+
+		close(_fd);
+		flags = O_RDWR | O_APPEND;
+#ifdef _WIN32 
+		flags |= _O_BINARY;
+#endif
+		_fd = open(_path.c_str(), flags, 0644);
+		if(_fd < 0)
+		{
+			_errorMessage = "open journal error";
+			return -1;
+		}
+		_fileBytes = data.size();
+		_unsynced = 0;
+		_lastSync = std::chrono::steady_clock::now();
+		return ret;
+	}
+
+
+	int BreakJournal::Close()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		return CloseLocked();
+	}
+
+
+	int BreakJournal::CloseLocked()
+	{
+		if(_fd < 0)
+			return 0;
+		int ret = SyncLocked();
+		close(_fd);
+		_fd = -1;
+		return ret;
+	}
+
+
+	BreakJournal::~BreakJournal()
+	{
+		Close();
+	}
+
+} /* Rainbow end */
@@ -0,0 +1,110 @@
+#ifndef FLJOURNAL_H
+#define FLJOURNAL_H
+#include "flFTP.h"
+#include <unordered_map>
+#include <chrono>
+
+namespace Rainbow{
+
+	/*
+	 * Breakpoints kept in an append-only binary log instead of flFTP.xml.
+	 * Each Put or Delete appends one CRC-checked record and an in-memory
+	 * index answers Get, so no call reads or rewrites the whole store.
+	 * Records are written at once but fsync'd in batches, every
+	 * syncRecords records or syncInterval, whichever comes first, and on
+	 * Close(). The interval is only looked at when a record is appended:
+	 * the last records before a lull wait for the next one, Sync() or
+	 * Close(). A record torn by a crash fails its CRC and ends the replay
+	 * on the next Open(). Once dead records outweigh live ones the log
+	 * is rewritten with only the live ones.
+	 * Safe to share between sessions and threads. The records are in
+	 * host byte order.
+	 */
+	class BreakJournal
+	{
+		public:
+			BreakJournal() = default;
+
+			BreakJournal(const BreakJournal&) = delete;
+			BreakJournal &operator=(const BreakJournal&) = delete;
+
+			/* Open or create path and replay it */
+			int Open(const std::string &path);
+
+			void SetSyncPolicy(unsigned int syncRecords, std::chrono::milliseconds syncInterval)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_syncRecords = std::max(syncRecords, 1u);
+				_syncInterval = syncInterval;
+			}
+
+			/* The recorded offset of info's transfer, 0 if none */
+			std::size_t Get(const TransferInfo &info);
+
+			void Put(const TransferInfo &info);
+
+			void Delete(const TransferInfo &info);
+
+			/* Write the records still pending to disk now */
+			int Sync();
+
+			/* Rewrite the log with only the live records */
+			int Compact();
+
+			/* Sync what is pending and close the log; Open() may follow */
+			int Close();
+
+			std::size_t Size()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _index.size();
+			}
+
+			std::string GetErrorDesc()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _errorMessage;
+			}
+
+			~BreakJournal();
+
+		private:
+			enum RecordType
+			{
+				PutRecord = 1,
+				DeleteRecord = 2
+			};
+
+			static std::string Key(const TransferInfo &info);
+
+			static std::size_t RecordSize(const TransferInfo &info);
+
+			static void Encode(std::string &out, RecordType type, const TransferInfo &info);
+
+			/* Apply the records in data, return the length of the intact prefix */
+			std::size_t Replay(const std::string &data);
+
+			void Append(RecordType type, const TransferInfo &info);
+
+			int SyncLocked();
+
+			int CompactLocked();
+
+			int CloseLocked();
+
+			std::mutex _mt;
+			std::string _path;
+			std::string _errorMessage;
+			int			_fd = -1;
+			std::unordered_map<std::string, TransferInfo> _index;
+			std::size_t _fileBytes = 0;
+			std::size_t _liveBytes = 0;
+			std::size_t _unsynced = 0;
+			unsigned int _syncRecords = 64;
+			std::chrono::milliseconds _syncInterval{1000};
+			std::chrono::steady_clock::time_point _lastSync;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLJOURNAL_H
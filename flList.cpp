@@ -0,0 +1,412 @@
+/**************************************************************
+      > File Name: flList.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 20时05分12秒
+ **************************************************************/
+
+#include "flList.h"
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#ifdef _WIN32
+#	define strncasecmp _strnicmp
+#endif
+
+namespace Rainbow{
+
+	/* std::max takes it by reference, so it needs a definition */
+	const std::size_t Listing::BlockSize;
+
+
+	void Listing::Add(const ListEntry &entry)
+	{
+		ListEntry copy = entry;
+		char *name = Allocate(entry.nameLength);
+		memcpy(name, entry.name, entry.nameLength);
+		copy.name = name;
+		_entries.push_back(copy);
+	}
+
+
+	void Listing::Clear()
+	{
+		_entries.clear();
+		_blocks.clear();
+		_blockUsed = BlockSize;
+	}
+
+
+	char *Listing::Allocate(std::size_t n)
+	{
+		/* a name longer than a block gets one of its own */
+		if(_blockUsed + n > BlockSize)
+		{
+			_blocks.emplace_back(new char[std::max(n, BlockSize)]);
+			_blockUsed = 0;
+		}
+		char *p = _blocks.back().get() + _blockUsed;
+		_blockUsed += n;
+		return p;
+	}
+
+
+	/* Days from 1970-01-01 to y-m-d of the proleptic Gregorian calendar */
+	static int64_t DaysFromCivil(int y, int m, int d)
+	{
+		y -= m <= 2;
+		int64_t era = (y >= 0 ? y : y - 399) / 400;
+		int64_t yoe = y - era * 400;
+		int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+		int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + doe - 719468;
+	}
+
+
+	static int64_t ToEpoch(int year, int month, int day, int hour, int minute, int second)
+	{
+		return DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	}
+
+
+	/* The value of n digits at p, -1 if any is not a digit */
+	static int Digits(const char *p, std::size_t n)
+	{
+		int value = 0;
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			if(!isdigit((unsigned char)p[i]))
+				return -1;
+			value = value * 10 + (p[i] - '0');
+		}
+		return value;
+	}
+
+
+	static bool AllDigits(const char *p, std::size_t n)
+	{
+		if(n == 0)
+			return false;
+		for(std::size_t i = 0; i < n; ++i)
+			if(!isdigit((unsigned char)p[i]))
+				return false;
+		return true;
+	}
+
+
+	/* 1 to 12 for an English month abbreviation, 0 otherwise */
+	static int Month(const char *p, std::size_t n)
+	{
+		static const char *months = "janfebmaraprmayjunjulaugsepoctnovdec";
+		if(n != 3)
+			return 0;
+		char lower[3];
+		for(int i = 0; i < 3; ++i)
+			lower[i] = tolower((unsigned char)p[i]);
+		for(int i = 0; i < 12; ++i)
+			if(memcmp(months + 3 * i, lower, 3) == 0)
+				return i + 1;
+		return 0;
+	}
+
+
+	static bool Dots(const ListEntry &entry)
+	{
+		return (entry.nameLength == 1 && entry.name[0] == '.') ||
+			(entry.nameLength == 2 && entry.name[0] == '.' && entry.name[1] == '.');
+	}
+
+
+	ListParser::ListParser(bool mlsd, Callback callback):
+		_mlsd(mlsd), _callback(std::move(callback)), _now(time(nullptr))
+	{}
+
+
+	/*
+	 * Whole lines are parsed where they lie in data; only a line cut by
+	 * the end of data is copied, to be completed by the next call.
+	 */
+	void ListParser::Feed(const char *data, std::size_t n)
+	{
+		const char *end = data + n;
+		if(!_partial.empty())
+		{
+			const char *newline = (const char *)memchr(data, '\n', n);
+			if(newline == nullptr)
+			{
+				_partial.append(data, n);
+				return;
+			}
+			_partial.append(data, newline - data);
+			Line(_partial.data(), _partial.size());
+			_partial.clear();
+			data = newline + 1;
+		}
+
+		const char *newline;
+		while((newline = (const char *)memchr(data, '\n', end - data)) != nullptr)
+		{
+			Line(data, newline - data);
+			data = newline + 1;
+		}
+		_partial.assign(data, end - data);
+	}
+
+
+	void ListParser::Finish()
+	{
+		if(!_partial.empty())
+			Line(_partial.data(), _partial.size());
+		_partial.clear();
+	}
+
+
+	void ListParser::Line(const char *line, std::size_t n)
+	{
+		if(n > 0 && line[n - 1] == '\r')
+			--n;
+		if(n == 0)
+			return;
+
+		ListEntry entry;
+		bool parsed;
+		if(_mlsd)
+			parsed = ParseMlsd(line, n, entry);
+		else if(isdigit((unsigned char)line[0]))
+			parsed = ParseDos(line, n, entry);
+		else
+			parsed = ParseUnix(line, n, _now, entry);
+		if(parsed && !Dots(entry))
+			_callback(entry);
+	}
+
+
+	/*
+	 * RFC 3659: "fact=value;fact=value; name". The facts used are type,
+	 * size (sizd for directories) and modify, YYYYMMDDHHMMSS[.sss] UTC.
+	 */
+	bool ListParser::ParseMlsd(const char *line, std::size_t n, ListEntry &entry)
+	{
+		const char *space = (const char *)memchr(line, ' ', n);
+		if(space == nullptr)
+			return false;
+		entry.name = space + 1;
+		entry.nameLength = line + n - entry.name;
+		if(entry.nameLength == 0)
+			return false;
+
+		const char *fact = line;
+		while(fact < space)
+		{
+			const char *semicolon = (const char *)memchr(fact, ';', space - fact);
+			const char *factEnd = semicolon ? semicolon : space;
+			const char *equals = (const char *)memchr(fact, '=', factEnd - fact);
+			if(equals != nullptr)
+			{
+				std::size_t keyLength = equals - fact;
+				const char *value = equals + 1;
+				std::size_t valueLength = factEnd - value;
+				if(keyLength == 4 && strncasecmp(fact, "type", 4) == 0)
+				{
+					if(valueLength == 4 && strncasecmp(value, "file", 4) == 0)
+						entry.type = ListEntry::File;
+					else if(valueLength == 3 && strncasecmp(value, "dir", 3) == 0)
+						entry.type = ListEntry::Directory;
+					/* the directory itself and its parent */
+					else if((valueLength == 4 && strncasecmp(value, "cdir", 4) == 0) ||
+							(valueLength == 4 && strncasecmp(value, "pdir", 4) == 0))
+						return false;
+					else if(valueLength >= 13 && strncasecmp(value, "OS.unix=slink", 13) == 0)
+						entry.type = ListEntry::Link;
+					else
+						entry.type = ListEntry::Other;
+				}
+				else if((keyLength == 4 && strncasecmp(fact, "size", 4) == 0) ||
+						(keyLength == 4 && strncasecmp(fact, "sizd", 4) == 0))
+				{
+					if(AllDigits(value, valueLength))
+						entry.size = strtoll(value, nullptr, 10);
+				}
+				else if(keyLength == 6 && strncasecmp(fact, "modify", 6) == 0)
+					entry.mtime = ParseTime(value, valueLength);
+			}
+			fact = factEnd + 1;
+		}
+		return true;
+	}
+
+
+	int64_t ListParser::ParseTime(const char *p, std::size_t n)
+	{
+		if(n < 14)
+			return -1;
+		int year = Digits(p, 4), month = Digits(p + 4, 2);
+		int day = Digits(p + 6, 2), hour = Digits(p + 8, 2);
+		int minute = Digits(p + 10, 2), second = Digits(p + 12, 2);
+		if(year < 0 || month < 1 || day < 1 || hour < 0 || minute < 0 || second < 0)
+			return -1;
+		return ToEpoch(year, month, day, hour, minute, second);
+	}
+
+
+	/*
+	 * "-rw-r--r--   1 owner group   1234 Jan 31 12:00 name" or with the
+	 * year in place of the time; some servers leave out the group or the
+	 * link count, so the date is found by its shape and the size is the
+	 * field before it. Links lose their " -> target".
+	 */
+	bool ListParser::ParseUnix(const char *line, std::size_t n, time_t now, ListEntry &entry)
+	{
+		switch(line[0])
+		{
+			case '-':
+				entry.type = ListEntry::File;
+				break;
+			case 'd':
+				entry.type = ListEntry::Directory;
+				break;
+			case 'l':
+				entry.type = ListEntry::Link;
+				break;
+			case 'b': case 'c': case 'p': case 's':
+				entry.type = ListEntry::Other;
+				break;
+			default:
+				return false;
+		}
+
+		const int MaxFields = 9;
+		const char *field[MaxFields];
+		std::size_t length[MaxFields];
+		int fields = 0;
+		const char *p = line, *end = line + n;
+		int month = 0;
+		int at = -1;
+		while(fields < MaxFields && at < 0)
+		{
+			while(p < end && *p == ' ')
+				++p;
+			if(p == end)
+				return false;
+			field[fields] = p;
+			while(p < end && *p != ' ')
+				++p;
+			length[fields] = p - field[fields];
+			++fields;
+
+			/* month, day, then a time or a year */
+			if(fields >= 5 && (month = Month(field[fields - 3], length[fields - 3])) != 0 &&
+					AllDigits(field[fields - 2], length[fields - 2]) && length[fields - 2] <= 2 &&
+					AllDigits(field[fields - 4], length[fields - 4]))
+				at = fields - 3;
+		}
+		if(at < 0 || p == end)
+			return false;
+
+		int day = Digits(field[at + 1], length[at + 1]);
+		const char *clock = field[at + 2];
+		std::size_t clockLength = length[at + 2];
+		if(clockLength == 5 && clock[2] == ':')
+		{
+			int hour = Digits(clock, 2), minute = Digits(clock + 3, 2);
+			if(hour < 0 || minute < 0)
+				return false;
+			/* within the last six months, in the future means last year */
+			struct tm today;
+#ifdef _WIN32
+			gmtime_s(&today, &now);
+#else
+			gmtime_r(&now, &today);
+#endif
+			int year = today.tm_year + 1900;
+			int64_t mtime = ToEpoch(year, month, day, hour, minute, 0);
+			if(mtime > (int64_t)now + 86400)
+				mtime = ToEpoch(year - 1, month, day, hour, minute, 0);
+			entry.mtime = mtime;
+		}
+		else if(clockLength == 4 && AllDigits(clock, 4))
+			entry.mtime = ToEpoch(Digits(clock, 4), month, day, 0, 0, 0);
+		else
+			return false;
+
+		entry.size = strtoll(field[at - 1], nullptr, 10);
+		/* one space separates the date from the name, which may begin with more */
+		entry.name = p + 1;
+		entry.nameLength = end - entry.name;
+		if(entry.type == ListEntry::Link)
+		{
+			for(const char *arrow = entry.name; arrow + 4 <= end; ++arrow)
+				if(memcmp(arrow, " -> ", 4) == 0)
+				{
+					entry.nameLength = arrow - entry.name;
+					break;
+				}
+		}
+		return entry.nameLength > 0;
+	}
+
+
+	/* "01-31-24  12:00PM       <DIR>          name" or a size for <DIR> */
+	bool ListParser::ParseDos(const char *line, std::size_t n, ListEntry &entry)
+	{
+		const char *p = line, *end = line + n;
+		const char *field[3];
+		std::size_t length[3];
+		for(int i = 0; i < 3; ++i)
+		{
+			while(p < end && *p == ' ')
+				++p;
+			field[i] = p;
+			while(p < end && *p != ' ')
+				++p;
+			length[i] = p - field[i];
+			if(p == end)
+				return false;
+		}
+		while(p < end && *p == ' ')
+			++p;
+		if(p == end)
+			return false;
+
+		/* MM-DD-YY or MM-DD-YYYY */
+		const char *date = field[0];
+		if((length[0] != 8 && length[0] != 10) || date[2] != '-' || date[5] != '-')
+			return false;
+		int month = Digits(date, 2), day = Digits(date + 3, 2);
+		int year = Digits(date + 6, length[0] - 6);
+		if(month < 1 || day < 1 || year < 0)
+			return false;
+		if(length[0] == 8)
+			year += year < 70 ? 2000 : 1900;
+
+		/* HH:MM with AM or PM, or 24 hour HH:MM */
+		const char *clock = field[1];
+		if(length[1] < 5 || clock[2] != ':')
+			return false;
+		int hour = Digits(clock, 2), minute = Digits(clock + 3, 2);
+		if(hour < 0 || minute < 0)
+			return false;
+		if(length[1] == 7)
+		{
+			bool pm = toupper((unsigned char)clock[5]) == 'P';
+			hour = hour % 12 + (pm ? 12 : 0);
+		}
+		entry.mtime = ToEpoch(year, month, day, hour, minute, 0);
+
+		if(length[2] == 5 && strncasecmp(field[2], "<DIR>", 5) == 0)
+			entry.type = ListEntry::Directory;
+		else if(AllDigits(field[2], length[2]))
+		{
+			entry.type = ListEntry::File;
+			entry.size = strtoll(field[2], nullptr, 10);
+		}
+		else
+			return false;
+
+		entry.name = p;
+		entry.nameLength = end - p;
+		return true;
+	}
+
+} /* Rainbow end */
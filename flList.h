@@ -0,0 +1,135 @@
+#ifndef FLLIST_H
+#define FLLIST_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+
+namespace Rainbow{
+
+	/*
+	 * One name of a directory listing. name is not NUL terminated; in a
+	 * ListParser callback it points into the data being parsed and is
+	 * only valid for the call, in a Listing it lives as long as the
+	 * Listing does.
+	 */
+	struct ListEntry
+	{
+		enum Type : uint8_t
+		{
+			File,
+			Directory,
+			Link,
+			Other
+		};
+
+		const char	*name = nullptr;
+		int64_t		size = -1;			/* bytes, -1 if not listed */
+		int64_t		mtime = -1;			/* seconds since the epoch UTC, -1 if not listed */
+		uint32_t	nameLength = 0;
+		Type		type = Other;
+
+		std::string Name() const
+		{
+			return std::string(name, nameLength);
+		}
+	};
+
+
+	/*
+	 * Entries of a listing in one vector of fixed size records, with the
+	 * names packed into 64KB blocks beside it, so a million entries cost
+	 * a few allocations instead of a million. Movable, not copyable.
+	 */
+	class Listing
+	{
+		public:
+			typedef std::vector<ListEntry>::const_iterator const_iterator;
+
+			Listing() = default;
+			Listing(Listing&&) = default;
+			Listing &operator=(Listing&&) = default;
+
+			/* Copy entry, name included, to the end */
+			void Add(const ListEntry &entry);
+
+			void Clear();
+
+			std::size_t Size() const
+			{
+				return _entries.size();
+			}
+
+			const ListEntry &operator[](std::size_t i) const
+			{
+				return _entries[i];
+			}
+
+			const_iterator begin() const
+			{
+				return _entries.begin();
+			}
+
+			const_iterator end() const
+			{
+				return _entries.end();
+			}
+
+			/* Bytes held by entries and names */
+			std::size_t MemoryUsage() const
+			{
+				return _entries.capacity() * sizeof(ListEntry) + _blocks.size() * BlockSize;
+			}
+
+		private:
+			char *Allocate(std::size_t n);
+
+			static const std::size_t BlockSize = 64 * 1024;
+			std::vector<ListEntry> _entries;
+			std::vector<std::unique_ptr<char[]>> _blocks;
+			std::size_t _blockUsed = BlockSize;
+	};
+
+
+	/*
+	 * Turns the bytes of an MLSD or LIST reply into ListEntry as they
+	 * arrive, whatever the chunking. LIST lines may be Unix ls -l or
+	 * DOS/IIS style, told apart line by line. Lines that are neither,
+	 * like "total 42", and the entries "." and ".." are skipped.
+	 */
+	class ListParser
+	{
+		public:
+			typedef std::function<void(const ListEntry&)> Callback;
+
+			ListParser(bool mlsd, Callback callback);
+
+			void Feed(const char *data, std::size_t n);
+
+			/* The data has ended, parse a last line without a newline */
+			void Finish();
+
+			static bool ParseMlsd(const char *line, std::size_t n, ListEntry &entry);
+
+			/* now dates the ls -l entries that show a time instead of a year */
+			static bool ParseUnix(const char *line, std::size_t n, time_t now, ListEntry &entry);
+
+			static bool ParseDos(const char *line, std::size_t n, ListEntry &entry);
+
+			/* YYYYMMDDHHMMSS[.sss] UTC, as MLSD and MDTM give it, -1 if malformed */
+			static int64_t ParseTime(const char *p, std::size_t n);
+
+		private:
+			void Line(const char *line, std::size_t n);
+
+			bool		_mlsd;
+			Callback	_callback;
+			time_t		_now;
+			std::string _partial;		/* a line split across Feed() calls */
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLLIST_H
@@ -0,0 +1,446 @@
+/**************************************************************
+      > File Name: flMirror.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 20时48分37秒
+ **************************************************************/
+
+#include "flFTP.h"
+#include "flList.h"
+#include "flCache.h"
+#include "flSession.h"
+#include <deque>
+#include <cerrno>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/utime.h>
+#	define mkdir(path, mode) _mkdir(path)
+#	define utime _utime
+#	define utimbuf _utimbuf
+#else
+#include <utime.h>
+#endif
+
+namespace Rainbow{
+
+	/*
+	 * Each session owns a deque of directories still to list. It pushes
+	 * what it finds at the back and pops from the back, so it goes depth
+	 * first and its work stays near the directory it is in; a session
+	 * with nothing left steals from the front of another's, taking the
+	 * shallowest and so likely the largest subtree. The walk ends when
+	 * no directory is queued or being listed.
+	 */
+	class MirrorWalk
+	{
+		public:
+			MirrorWalk(std::vector<std::unique_ptr<flFTP>> &sessions, MirrorCache *cache):
+				_sessions(sessions),
+				_cache(cache)
+			{
+				for(std::size_t i = 0; i < sessions.size(); ++i)
+					_queues.emplace_back(details::make_unique<Queue>());
+				_stats = flFTP::MirrorStats{0, 0, 0, 0, 0, 0};
+			}
+
+			void Push(std::size_t self, const std::string &remote, const std::string &local);
+
+			void Run(std::size_t self);
+
+			flFTP::MirrorStats Stats() const
+			{
+				return _stats;
+			}
+
+			std::string GetErrorDesc() const
+			{
+				return _errorMessage;
+			}
+
+		private:
+			struct Directory
+			{
+				std::string remote;
+				std::string local;
+			};
+
+			struct Queue
+			{
+				std::mutex mt;
+				std::deque<Directory> directories;
+			};
+
+			bool Take(std::size_t self, Directory &directory);
+
+			void Process(flFTP &session, std::size_t self, const Directory &directory);
+
+			/* mtime is set to the exact time of entry, -1 if it is not known */
+			int Fetch(flFTP &session, const ListEntry &entry, const Directory &directory,
+					bool exactTime, bool unchanged, int64_t &mtime);
+
+			void Fail(const std::string &what, const std::string &why);
+
+			std::vector<std::unique_ptr<flFTP>> &_sessions;
+			MirrorCache *_cache;
+			std::vector<std::unique_ptr<Queue>> _queues;
+			/* directories pushed and not yet done, and those of them still queued */
+			std::atomic<std::size_t> _outstanding{0};
+			std::atomic<std::size_t> _queued{0};
+			std::mutex _idleMt;
+			std::condition_variable _idleCond;
+			std::mutex _statsMt;
+			flFTP::MirrorStats _stats;
+			std::string _errorMessage;
+	};
+
+
+	static std::string JoinPath(const std::string &dir, const std::string &name)
+	{
+		if(dir.empty() || dir.back() == '/')
+			return dir + name;
+		return dir + '/' + name;
+	}
+
+
+	/*
+	 * Whether name, as the server listed it, stays inside the directory
+	 * it is joined to; a broken or hostile server may send "../x"
+	 */
+	static bool LocalName(const std::string &name)
+	{
+		if(name.empty() || name == "." || name == ".." ||
+				name.find_first_of(std::string("/\0", 2)) != std::string::npos)
+			return false;
+#ifdef _WIN32
+		if(name.find_first_of("\\:") != std::string::npos)
+			return false;
+#endif
+		return true;
+	}
+
+
+	/* Create path and whatever of its parents is missing */
+	static int MakeDirs(const std::string &path)
+	{
+		for(std::size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+		{
+			std::string part = path.substr(0, slash);
+			if(!part.empty() && mkdir(part.c_str(), 0755) < 0 && errno != EEXIST)
+				return -1;
+			if(slash == std::string::npos)
+				return 0;
+		}
+	}
+
+
+	void MirrorWalk::Push(std::size_t self, const std::string &remote, const std::string &local)
+	{
+		++_outstanding;
+		{
+			std::lock_guard<std::mutex> lk(_queues[self]->mt);
+			_queues[self]->directories.push_back(Directory{remote, local});
+			++_queued;
+		}
+		/* taking the lock orders this with an idle session's check */
+		{
+			std::lock_guard<std::mutex> lk(_idleMt);
+		}
+		_idleCond.notify_one();
+	}
+
+
+	bool MirrorWalk::Take(std::size_t self, Directory &directory)
+	{
+		for(;;)
+		{
+			for(std::size_t i = 0; i < _queues.size(); ++i)
+			{
+				Queue &queue = *_queues[(self + i) % _queues.size()];
+				std::lock_guard<std::mutex> lk(queue.mt);
+				if(queue.directories.empty())
+					continue;
+				if(i == 0)
+				{
+					directory = std::move(queue.directories.back());
+					queue.directories.pop_back();
+				}
+				else
+				{
+					directory = std::move(queue.directories.front());
+					queue.directories.pop_front();
+				}
+				--_queued;
+				return true;
+			}
+
+			std::unique_lock<std::mutex> lk(_idleMt);
+			_idleCond.wait(lk, [this]{ return _outstanding == 0 || _queued > 0; });
+			if(_outstanding == 0)
+				return false;
+		}
+	}
+
+
+	void MirrorWalk::Run(std::size_t self)
+	{
+		Directory directory;
+		while(Take(self, directory))
+		{
+			Process(*_sessions[self], self, directory);
+			if(--_outstanding == 0)
+			{
+				std::lock_guard<std::mutex> lk(_idleMt);
+				_idleCond.notify_all();
+			}
+		}
+	}
+
+
+	void MirrorWalk::Process(flFTP &session, std::size_t self, const Directory &directory)
+	{
+		{
+			std::lock_guard<std::mutex> lk(_statsMt);
+			++_stats.directories;
+		}
+		if(session.Cd(directory.remote) < 0)
+		{
+			Fail(directory.remote, session.GetErrorDesc());
+			return;
+		}
+		Listing listing;
+		if(session.List("", listing) < 0)
+		{
+			Fail(directory.remote, session.GetErrorDesc());
+			return;
+		}
+		bool exactTime = session._commPort->UsesMlsd();
+
+		/* a listing the cache has seen means no file changed remotely */
+		uint64_t hash = 0;
+		bool unchanged = false;
+		if(_cache)
+		{
+			uint64_t cachedHash;
+			hash = MirrorCache::ListingHash(listing);
+			unchanged = _cache->Find(directory.remote, cachedHash) && cachedHash == hash;
+		}
+
+		/* queue the subdirectories first, so idle sessions can take them now */
+		bool complete = true;
+		for(auto &entry : listing)
+		{
+			if(entry.type != ListEntry::Directory)
+				continue;
+			if(!LocalName(entry.Name()))
+			{
+				Fail(JoinPath(directory.remote, entry.Name()), "bad name");
+				complete = false;
+				continue;
+			}
+			std::string local = JoinPath(directory.local, entry.Name());
+			if(mkdir(local.c_str(), 0755) < 0 && errno != EEXIST)
+			{
+				Fail(local, "mkdir error");
+				continue;
+			}
+			Push(self, JoinPath(directory.remote, entry.Name()), local);
+		}
+
+		std::vector<MirrorCache::File> files;
+		for(auto &entry : listing)
+		{
+			if(entry.type != ListEntry::File)
+				continue;
+			if(!LocalName(entry.Name()))
+			{
+				Fail(JoinPath(directory.remote, entry.Name()), "bad name");
+				complete = false;
+				continue;
+			}
+			int64_t mtime;
+			if(Fetch(session, entry, directory, exactTime, unchanged, mtime) < 0)
+				complete = false;
+			else if(_cache && !unchanged)
+				files.push_back(MirrorCache::File{entry.Name(), entry.size, entry.mtime, mtime});
+		}
+
+		/* a directory that failed is left out, so the next run looks again */
+		if(!_cache || !complete)
+			return;
+		if(unchanged)
+			_cache->Keep(directory.remote);
+		else
+			_cache->Put(directory.remote, hash, std::move(files));
+	}
+
+
+	int MirrorWalk::Fetch(flFTP &session, const ListEntry &entry, const Directory &directory,
+			bool exactTime, bool unchanged, int64_t &mtime)
+	{
+		const std::string name = entry.Name();
+		const std::string localFile = JoinPath(directory.local, name);
+		{
+			std::lock_guard<std::mutex> lk(_statsMt);
+			++_stats.files;
+		}
+
+		/* LIST times are to the minute at best, MDTM or the cache has the seconds */
+		mtime = entry.mtime;
+		if(!exactTime && _cache)
+		{
+			int64_t cached = _cache->Time(directory.remote, entry);
+			if(cached >= 0 || unchanged)
+			{
+				mtime = cached;
+				exactTime = true;
+			}
+		}
+		struct stat st;
+		bool sameSize = (stat(localFile.c_str(), &st) == 0 &&
+				entry.size >= 0 && st.st_size == entry.size);
+		if(!exactTime && sameSize)
+		{
+			mtime = session.ModifyTime(name);
+			exactTime = true;
+		}
+		if(sameSize && (mtime < 0 || st.st_mtime == mtime))
+		{
+			std::lock_guard<std::mutex> lk(_statsMt);
+			++_stats.skipped;
+			return 0;
+		}
+
+		if(session.DownloadFile(name, JoinPath(directory.local, ""), entry.size) < 0 ||
+				session.Wait() != TransferState::Done)
+		{
+			Fail(localFile, session.GetErrorDesc());
+			return -1;
+		}
+		if(!exactTime)
+			mtime = session.ModifyTime(name);
+		if(mtime >= 0)
+		{
+			struct utimbuf times;
+			times.actime = mtime;
+			times.modtime = mtime;
+			utime(localFile.c_str(), &times);
+		}
+
+		std::lock_guard<std::mutex> lk(_statsMt);
+		++_stats.downloaded;
+		if(stat(localFile.c_str(), &st) == 0)
+			_stats.bytes += st.st_size;
+		return 0;
+	}
+
+
+	void MirrorWalk::Fail(const std::string &what, const std::string &why)
+	{
+		std::lock_guard<std::mutex> lk(_statsMt);
+		++_stats.failed;
+		_errorMessage = what + ": " + why;
+	}
+
+
+	int flFTP::Mirror(const std::string &remoteDir, const std::string &localDir,
+			unsigned int sessions, MirrorStats *stats)
+	{
+		if(CompleteTransfer() < 0)
+			return -1;
+
+		/* the other sessions start elsewhere, so walk from an absolute path */
+		std::string root = remoteDir;
+		if(root.empty() || root[0] != '/')
+		{
+			std::string cwd = _serverPath.empty() ? _commPort->Pwd() : _serverPath;
+			if(!cwd.empty())
+				root = root.empty() ? cwd : JoinPath(cwd, root);
+		}
+		if(MakeDirs(localDir) < 0)
+		{
+			_errorMessage = "mkdir error";
+			return -1;
+		}
+
+		std::vector<std::unique_ptr<flFTP>> workers;
+		std::string errorDesc;
+		/* a session that fails its TYPE is replaced, a few times over at most */
+		const unsigned int wanted = std::max(sessions, 1u);
+		for(unsigned int attempt = 0; workers.size() < wanted && attempt < 2 * wanted; ++attempt)
+		{
+			std::unique_ptr<flFTP> session;
+			if(_pool)
+				session = _pool->Acquire(_host, _service, _username, _password, errorDesc);
+			else
+			{
+				session = details::make_unique<flFTP>();
+				if(session->Connection(_host, _service) < 0 ||
+						session->Login(_username, _password) < 0)
+				{
+					errorDesc = session->GetErrorDesc();
+					session.reset();
+				}
+			}
+			if(!session)
+				break;
+			session->SetPipelining(_pipelining, _pipelineTimeout);
+			session->SetRateLimit(0);
+			session->SetRateLimiter(&_dataPort->GetRateLimit());
+			session->SetMetrics(_metrics);
+			if(session->SetTransferType(Binary) < 0)
+			{
+				/* the pool closes it unless it is fit for another user */
+				errorDesc = session->GetErrorDesc();
+				session->SetRateLimiter(nullptr);
+				session->SetMetrics(nullptr);
+				if(_pool)
+					_pool->Release(std::move(session));
+				continue;
+			}
+			/* a whole file is fetched again rather than resumed */
+			session->SetBreakRecordMethod([](const TransferInfo&){ return (std::size_t)0; },
+					[](const TransferInfo&){}, [](const TransferInfo&){});
+			workers.push_back(std::move(session));
+		}
+		if(workers.empty())
+		{
+			_errorMessage = errorDesc;
+			return -1;
+		}
+
+		MirrorWalk walk(workers, _mirrorCache);
+		walk.Push(0, root, localDir);
+		std::vector<std::thread> threads;
+		for(std::size_t i = 1; i < workers.size(); ++i)
+			threads.emplace_back(&MirrorWalk::Run, &walk, i);
+		walk.Run(0);
+		for(auto &t : threads)
+			t.join();
+
+		for(auto &session : workers)
+		{
+			session->SetRateLimiter(nullptr);
+			session->SetMetrics(nullptr);
+			if(_pool)
+				_pool->Release(std::move(session));
+		}
+
+		MirrorStats result = walk.Stats();
+		if(stats)
+			*stats = result;
+		/* directories that failed were left out of the cache, save the rest */
+		if(_mirrorCache && _mirrorCache->Save(root) < 0)
+		{
+			_errorMessage = _mirrorCache->GetErrorDesc();
+			return -1;
+		}
+		if(result.failed > 0)
+		{
+			_errorMessage = walk.GetErrorDesc();
+			return -1;
+		}
+		return 0;
+	}
+
+} /* Rainbow end */
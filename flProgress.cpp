@@ -0,0 +1,138 @@
+/**************************************************************
+      > File Name: flProgress.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 23时52分07秒
+ **************************************************************/
+
+#include "flProgress.h"
+
+namespace Rainbow{
+
+	void ProgressNotifier::SetInterval(std::chrono::milliseconds interval)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_interval = interval;
+	}
+
+
+	std::chrono::milliseconds ProgressNotifier::Interval()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		return _interval;
+	}
+
+
+	void ProgressNotifier::Add(const void *key, Tick tick)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		auto it = _ticks.find(key);
+		if(it != _ticks.end() && it->second.flush)
+			--_flushes;
+		_ticks[key] = Entry{std::move(tick), ++_generation, false};
+		if(!_thread.joinable())
+			_thread = std::thread(&ProgressNotifier::Run, this);
+	}
+
+
+	void ProgressNotifier::Remove(const void *key)
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		auto it = _ticks.find(key);
+		if(it != _ticks.end())
+		{
+			if(it->second.flush)
+				--_flushes;
+			_ticks.erase(it);
+		}
+		/* from within a tick the call in progress is the caller's own */
+		if(std::this_thread::get_id() != _thread.get_id())
+			_cond.wait(lk, [this, key]{ return _running != key; });
+	}
+
+
+	void ProgressNotifier::Flush(const void *key)
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		auto it = _ticks.find(key);
+		if(it == _ticks.end() || std::this_thread::get_id() == _thread.get_id())
+			return;
+		uint64_t generation = it->second.generation;
+		if(!it->second.flush)
+		{
+			it->second.flush = true;
+			++_flushes;
+		}
+		_cond.notify_all();
+		_cond.wait(lk, [this, key, generation]
+			{
+				auto it = _ticks.find(key);
+				return it == _ticks.end() || it->second.generation != generation ||
+					(!it->second.flush && _running != key);
+			});
+	}
+
+
+	void ProgressNotifier::Run()
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		auto next = std::chrono::steady_clock::now() + _interval;
+		while(!_stop)
+		{
+			_cond.wait_until(lk, next, [this]{ return _stop || _flushes > 0; });
+			if(_stop)
+				break;
+			/* every tick once an interval, in between only those flushed */
+			auto now = std::chrono::steady_clock::now();
+			bool round = (now >= next);
+			if(round)
+				next = now + _interval;
+
+			auto it = _ticks.begin();
+			while(it != _ticks.end())
+			{
+				if(!round && !it->second.flush)
+				{
+					++it;
+					continue;
+				}
+				if(it->second.flush)
+				{
+					it->second.flush = false;
+					--_flushes;
+				}
+				const void *key = it->first;
+				Entry entry = it->second;
+				_running = key;
+				lk.unlock();
+				bool keep = entry.tick();
+				lk.lock();
+				_running = nullptr;
+				_cond.notify_all();
+
+				/* the tick may have been removed, or replaced, meanwhile */
+				it = _ticks.find(key);
+				if(!keep && it != _ticks.end() && it->second.generation == entry.generation)
+				{
+					if(it->second.flush)
+						--_flushes;
+					_ticks.erase(it);
+				}
+				it = _ticks.upper_bound(key);
+			}
+		}
+	}
+
+
+	ProgressNotifier::~ProgressNotifier()
+	{
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_stop = true;
+		}
+		_cond.notify_all();
+		if(_thread.joinable())
+			_thread.join();
+	}
+
+}	/* namespace Rainbow */
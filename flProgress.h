@@ -0,0 +1,92 @@
+#ifndef FLPROGRESS_H
+#define FLPROGRESS_H
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+namespace Rainbow{
+
+	/* Where a transfer stands, as handed to IProgress::OnProgress() */
+	struct Progress
+	{
+		std::size_t bytes;			/* of the file so far, a resumed part included */
+		std::size_t total;			/* 0 if unknown */
+		double fraction;			/* bytes / total, 0 if unknown */
+		double throughput;			/* bytes per second, RateMeter::Rate() */
+		double averageThroughput;	/* RateMeter::Average() */
+		double eta;					/* seconds left at the average, -1 if unknown */
+		bool done;					/* the transfer has ended, however it did */
+	};
+
+
+	/*
+	 * Calls the ticks added to it from a thread of its own, once every
+	 * interval, so progress observers run neither on the transfer
+	 * threads nor any more often than that. The thread starts with the
+	 * first Add(). One notifier may serve any number of sessions; it
+	 * must outlive them.
+	 */
+	class ProgressNotifier
+	{
+		public:
+			/* Return false to be removed */
+			typedef std::function<bool()> Tick;
+
+			explicit ProgressNotifier(std::chrono::milliseconds interval =
+					std::chrono::milliseconds(100)):
+				_interval(interval)
+			{}
+
+			ProgressNotifier(const ProgressNotifier&) = delete;
+			ProgressNotifier &operator=(const ProgressNotifier&) = delete;
+
+			void SetInterval(std::chrono::milliseconds interval);
+
+			std::chrono::milliseconds Interval();
+
+			/* Call tick every interval from now on, in place of any tick of key */
+			void Add(const void *key, Tick tick);
+
+			/*
+			 * Stop calling the tick of key. A call of it in progress is
+			 * waited out, unless Remove() is made from within a tick.
+			 */
+			void Remove(const void *key);
+
+			/*
+			 * Call the tick of key now rather than at the next interval,
+			 * and wait for it unless made from within a tick
+			 */
+			void Flush(const void *key);
+
+			~ProgressNotifier();
+
+		private:
+			struct Entry
+			{
+				Tick tick;
+				uint64_t generation;
+				bool flush;
+			};
+
+			void Run();
+
+			std::mutex	_mt;
+			std::condition_variable _cond;
+			std::map<const void *, Entry> _ticks;
+			uint64_t	_generation = 0;
+			const void	*_running = nullptr;
+			std::size_t _flushes = 0;			/* entries with flush set */
+			std::chrono::milliseconds _interval;
+			bool		_stop = false;
+			std::thread _thread;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLPROGRESS_H
@@ -0,0 +1,233 @@
+/**************************************************************
+      > File Name: flQueue.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 17时58分36秒
+ **************************************************************/
+
+#include "flQueue.h"
+#include <sys/stat.h>
+
+namespace Rainbow{
+
+	TransferQueue::TransferQueue(unsigned int maxSessions, unsigned int maxPerHost,
+			unsigned int retries):
+		_maxPerHost(std::max(maxPerHost, 1u)),
+		_retries(retries),
+		_pool(std::max(maxPerHost, 1u))
+	{
+		for(unsigned int i = 0; i < std::max(maxSessions, 1u); ++i)
+			_workers.emplace_back(&TransferQueue::Run, this);
+	}
+
+
+	void TransferQueue::Add(const Job &job)
+	{
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_stopping = false;
+			_hosts[job.host + '\n' + job.service].pending.push_back(Entry{job, 0});
+			++_pending;
+		}
+		_workCond.notify_one();
+	}
+
+
+	/*
+	 * Take the first job of a host below its limit. Hosts are few next
+	 * to jobs, so this stays cheap however long the queue grows.
+	 */
+	bool TransferQueue::NextJob(Entry &entry, std::string &hostKey)
+	{
+		for(auto &elem : _hosts)
+		{
+			Host &host = elem.second;
+			if(host.pending.empty() || host.running >= _maxPerHost)
+				continue;
+			entry = std::move(host.pending.front());
+			host.pending.pop_front();
+			++host.running;
+			hostKey = elem.first;
+			return true;
+		}
+		return false;
+	}
+
+
+	void TransferQueue::Run()
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		for(;;)
+		{
+			Entry entry;
+			std::string hostKey;
+			_workCond.wait(lk, [&]{ return _stop || NextJob(entry, hostKey); });
+			if(_stop)
+				break;
+
+			--_pending;
+			++_running;
+			if(!_started)
+			{
+				_started = true;
+				_startTime = std::chrono::steady_clock::now();
+			}
+			lk.unlock();
+
+			const Job &job = entry.job;
+			std::string errorDesc;
+			TransferState state = TransferState::NetworkAnomaly;
+			std::unique_ptr<flFTP> session = _pool.Acquire(job.host, job.service,
+					job.username, job.password, errorDesc);
+			if(session)
+			{
+				state = Transfer(*session, job, errorDesc);
+				_pool.Release(std::move(session));
+			}
+
+			std::size_t bytes = 0;
+			struct stat st;
+			if(state == TransferState::Done &&
+					stat((job.localPath + job.filename).c_str(), &st) == 0)
+				bytes = st.st_size;
+
+			lk.lock();
+			--_running;
+			--_hosts[hostKey].running;
+			_finishTime = std::chrono::steady_clock::now();
+			/* Suspend means Stop() interrupted it */
+			bool retry = (state == TransferState::NetworkAnomaly && !_stop && !_stopping &&
+					++entry.attempts <= _retries);
+			if(retry)
+			{
+				++_retried;
+				++_pending;
+				_hosts[hostKey].pending.push_back(std::move(entry));
+			}
+			else
+			{
+				if(state == TransferState::Done)
+				{
+					++_done;
+					_bytes += bytes;
+				}
+				else
+					++_failed;
+				Callback callback = _callback;
+				if(callback)
+				{
+					lk.unlock();
+					callback(entry.job, state, errorDesc);
+					lk.lock();
+				}
+			}
+
+			/* a slot on this host is free again */
+			_workCond.notify_all();
+			if(_pending == 0 && _running == 0)
+				_idleCond.notify_all();
+		}
+	}
+
+
+	TransferState TransferQueue::Transfer(flFTP &session, const Job &job,
+			std::string &errorDesc)
+	{
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			if(_stop || _stopping)
+				return TransferState::Suspend;
+			_active.push_back(&session);
+			if(_getBreakPointFunc)
+				session.SetBreakRecordMethod(_getBreakPointFunc, _putBreakPointFunc,
+						_deleteBreakPointFunc);
+			else
+				session.SetBreakRecordMethod([](const TransferInfo&){ return (std::size_t)0; },
+						[](const TransferInfo&){}, [](const TransferInfo&){});
+		}
+
+		/* a reused session is often where this job needs it already */
+		int ret = 0;
+		if(!job.serverPath.empty() && session.GetServerPath() != job.serverPath)
+			ret = session.Cd(job.serverPath);
+		if(ret == 0 && session.GetTransferType() != flFTP::Binary)
+			ret = session.SetTransferType(flFTP::Binary);
+		if(ret == 0)
+		{
+			if(job.transferMode == TransferInfo::Upload)
+				ret = session.Upload(job.filename, job.localPath);
+			else
+				ret = session.Download(job.filename, job.localPath);
+		}
+
+		TransferState state = TransferState::NetworkAnomaly;
+		if(ret == 0)
+		{
+			{
+				/* a Stop() before the transfer began had nothing to interrupt */
+				std::lock_guard<std::mutex> lk(_mt);
+				if(_stopping)
+					session.StopDownload();
+			}
+			state = session.Wait();
+		}
+		if(state != TransferState::Done)
+			errorDesc = session.GetErrorDesc();
+
+		std::lock_guard<std::mutex> lk(_mt);
+		_active.remove(&session);
+		return state;
+	}
+
+
+	void TransferQueue::Wait()
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		_idleCond.wait(lk, [this]{ return _pending == 0 && _running == 0; });
+	}
+
+
+	void TransferQueue::Stop()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_stopping = true;
+		for(auto &elem : _hosts)
+		{
+			_failed += elem.second.pending.size();
+			elem.second.pending.clear();
+		}
+		_pending = 0;
+		for(auto session : _active)
+			session->StopDownload();
+		if(_running == 0)
+			_idleCond.notify_all();
+	}
+
+
+	TransferQueue::Stats TransferQueue::GetStats()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		double seconds = 0;
+		if(_started)
+		{
+			auto end = (_pending || _running) ? std::chrono::steady_clock::now() : _finishTime;
+			seconds = std::chrono::duration<double>(end - _startTime).count();
+		}
+		return Stats{_pending, _running, _done, _failed, _retried, _bytes, seconds,
+			seconds > 0 ? _bytes / seconds : 0};
+	}
+
+
+	TransferQueue::~TransferQueue()
+	{
+		Stop();
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_stop = true;
+		}
+		_workCond.notify_all();
+		for(auto &t : _workers)
+			t.join();
+	}
+
+} /* Rainbow end */
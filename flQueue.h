@@ -0,0 +1,134 @@
+#ifndef FLQUEUE_H
+#define FLQUEUE_H
+#include "flFTP.h"
+#include "flSession.h"
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+
+namespace Rainbow{
+
+	/*
+	 * Runs many transfers over a bounded number of sessions, at most
+	 * maxSessions at once and at most maxPerHost against one server.
+	 * Sessions come from a pool of our own, so consecutive files on a
+	 * host share a logged-in control connection. A failed transfer is
+	 * queued again up to retries times.
+	 * Transfers are not resumable unless SetBreakRecordMethod() is given
+	 * functions that are safe to call from several threads at once.
+	 */
+	class TransferQueue
+	{
+		public:
+			struct Job
+			{
+				TransferInfo::TransferMode transferMode = TransferInfo::Download;
+				std::string host;
+				std::string service = "21";
+				std::string username = "anonymous";
+				std::string password;
+				std::string serverPath;			/* absolute, sessions are shared across jobs */
+				std::string localPath;			/* as destPath/srcPath of flFTP */
+				std::string filename;
+			};
+
+			/* Called on a worker thread once a job is done or out of retries */
+			typedef std::function<void(const Job&, TransferState, const std::string&)> Callback;
+
+			TransferQueue(unsigned int maxSessions = 8, unsigned int maxPerHost = 4,
+					unsigned int retries = 2);
+
+			TransferQueue(const TransferQueue&) = delete;
+			TransferQueue &operator=(const TransferQueue&) = delete;
+
+			void Add(const Job &job);
+
+			void SetCallback(Callback callback)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_callback = callback;
+			}
+
+			void SetBreakRecordMethod(std::function<std::size_t(const TransferInfo&)> getFunc,
+					std::function<void(const TransferInfo&)> putFunc,
+					std::function<void(const TransferInfo&)> deleteFunc)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				_getBreakPointFunc = getFunc;
+				_putBreakPointFunc = putFunc;
+				_deleteBreakPointFunc = deleteFunc;
+			}
+
+			/* Block until every job added so far has finished */
+			void Wait();
+
+			/*
+			 * Drop the waiting jobs and interrupt the running ones, those
+			 * a worker has taken but not yet started too. Jobs added
+			 * afterwards run as usual.
+			 */
+			void Stop();
+
+			struct Stats
+			{
+				std::size_t pending;
+				std::size_t running;
+				std::size_t done;
+				std::size_t failed;
+				std::size_t retries;
+				std::size_t bytes;				/* of the jobs done */
+				double seconds;					/* since the first job started */
+				double bytesPerSecond;
+			};
+			Stats GetStats();
+
+			~TransferQueue();
+
+		private:
+			struct Entry
+			{
+				Job job;
+				unsigned int attempts;
+			};
+
+			struct Host
+			{
+				std::deque<Entry> pending;
+				unsigned int running = 0;
+			};
+
+			bool NextJob(Entry &entry, std::string &hostKey);
+
+			void Run();
+
+			TransferState Transfer(flFTP &session, const Job &job, std::string &errorDesc);
+
+			unsigned int _maxPerHost;
+			unsigned int _retries;
+			SessionPool _pool;
+			std::mutex _mt;
+			std::condition_variable _workCond;
+			std::condition_variable _idleCond;
+			bool		_stop = false;			/* the workers are to exit */
+			bool		_stopping = false;		/* Stop() was called since the last Add() */
+			std::unordered_map<std::string, Host> _hosts;
+			std::list<flFTP *> _active;
+			Callback	_callback;
+			std::function<std::size_t(const TransferInfo&)> _getBreakPointFunc;
+			std::function<void(const TransferInfo&)> _putBreakPointFunc;
+			std::function<void(const TransferInfo&)> _deleteBreakPointFunc;
+			std::size_t _pending = 0;
+			std::size_t _running = 0;
+			std::size_t _done = 0;
+			std::size_t _failed = 0;
+			std::size_t _retried = 0;
+			std::size_t _bytes = 0;
+			bool		_started = false;
+			std::chrono::steady_clock::time_point _startTime;
+			std::chrono::steady_clock::time_point _finishTime;
+			std::vector<std::thread> _workers;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLQUEUE_H
@@ -0,0 +1,119 @@
+/**************************************************************
+      > File Name: flRate.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 22时07分45秒
+ **************************************************************/
+
+#include "flRate.h"
+#include <algorithm>
+#include <thread>
+
+namespace Rainbow{
+
+	const std::chrono::milliseconds RateLimiter::Slice(20);
+	const std::chrono::milliseconds RateLimiter::MaxSleep(100);
+	const std::chrono::milliseconds RateLimiter::Burst(100);
+	const std::size_t RateLimiter::MinQuantum;
+
+
+	void RateLimiter::SetRate(uint64_t bytesPerSecond)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		Refill(_rate);
+		_rate = bytesPerSecond;
+		_tokens = std::min(_tokens, 
+				std::chrono::duration<double>(Burst).count() * bytesPerSecond);
+	}
+
+
+	void RateLimiter::SetClock(Clock clock)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_clock = clock;
+		_last = clock();
+		_tokens = 0;
+	}
+
+
+	bool RateLimiter::Limited() const
+	{
+		for(const RateLimiter *bucket = this; bucket; bucket = bucket->_parent)
+			if(bucket->_rate != 0)
+				return true;
+		return false;
+	}
+
+
+	std::size_t RateLimiter::Quantum(std::size_t n) const
+	{
+		for(const RateLimiter *bucket = this; bucket; bucket = bucket->_parent)
+		{
+			uint64_t rate = bucket->_rate;
+			if(rate == 0)
+				continue;
+			uint64_t slice = rate * Slice.count() / 1000;
+			n = std::min<std::size_t>(n, std::max<uint64_t>(slice, MinQuantum));
+		}
+		return n;
+	}
+
+
+	void RateLimiter::Consume(std::size_t n)
+	{
+		for(RateLimiter *bucket = this; bucket; bucket = bucket->_parent)
+		{
+			uint64_t rate = bucket->_rate;
+			if(rate == 0)
+				continue;
+			std::lock_guard<std::mutex> lk(bucket->_mt);
+			bucket->Refill(rate);
+			bucket->_tokens -= n;
+		}
+	}
+
+
+	std::chrono::nanoseconds RateLimiter::Delay()
+	{
+		double seconds = 0;
+		for(RateLimiter *bucket = this; bucket; bucket = bucket->_parent)
+		{
+			uint64_t rate = bucket->_rate;
+			if(rate == 0)
+				continue;
+			std::lock_guard<std::mutex> lk(bucket->_mt);
+			bucket->Refill(rate);
+			if(bucket->_tokens < 0)
+				seconds = std::max(seconds, -bucket->_tokens / rate);
+		}
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::duration<double>(seconds));
+	}
+
+
+	bool RateLimiter::Wait()
+	{
+		std::chrono::nanoseconds delay = Delay();
+		if(delay.count() == 0)
+			return true;
+		std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(delay, MaxSleep));
+		return delay <= MaxSleep;
+	}
+
+
+	void RateLimiter::Refill(uint64_t rate)
+	{
+		auto now = _clock();
+		double elapsed = std::chrono::duration<double>(now - _last).count();
+		_last = std::max(_last, now);
+		if(rate == 0)
+		{
+			_tokens = 0;
+			return;
+		}
+		if(elapsed > 0)
+			_tokens = std::min(_tokens + elapsed * rate, 
+					std::chrono::duration<double>(Burst).count() * rate);
+	}
+
+}	/* namespace Rainbow */
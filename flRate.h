@@ -0,0 +1,111 @@
+#ifndef FLRATE_H
+#define FLRATE_H
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace Rainbow{
+
+	/*
+	 * A token bucket of bytesPerSecond, 0 for no limit, chained to the
+	 * bucket of parent so that anything moved through it counts against
+	 * every bucket above too: a transfer under a host under the whole
+	 * process, say. The bucket may go into debt; a transfer moves up to
+	 * Quantum() at once, charges it with Consume() and then waits in
+	 * Wait() until the chain has paid it back. A wait thus covers a
+	 * slice of the slowest rate in the chain, not a single read, and
+	 * the rate holds at any buffer size. Rates may be changed at any
+	 * time from any thread and apply from the next Quantum() on.
+	 * A parent must outlive its children.
+	 */
+	class RateLimiter
+	{
+		public:
+			typedef std::chrono::steady_clock::time_point (*Clock)();
+
+			explicit RateLimiter(uint64_t bytesPerSecond = 0, RateLimiter *parent = nullptr):
+				_rate(bytesPerSecond),
+				_parent(parent),
+				_clock(Now),
+				_last(Now())
+			{}
+
+			RateLimiter(const RateLimiter&) = delete;
+			RateLimiter &operator=(const RateLimiter&) = delete;
+
+			void SetRate(uint64_t bytesPerSecond);
+
+			uint64_t Rate() const
+			{
+				return _rate;
+			}
+
+			/* Not to be changed while a transfer is charging this bucket */
+			void SetParent(RateLimiter *parent)
+			{
+				_parent = parent;
+			}
+
+			RateLimiter *Parent() const
+			{
+				return _parent;
+			}
+
+			/*
+			 * Read the time from clock rather than steady_clock, for tests.
+			 * The bucket starts over, empty as of clock's now. Each bucket
+			 * of a chain keeps time by its own clock.
+			 */
+			void SetClock(Clock clock);
+
+			/* Whether any bucket of the chain has a rate */
+			bool Limited() const;
+
+			/* At most n, and no more than a slice of the slowest rate in the chain */
+			std::size_t Quantum(std::size_t n) const;
+
+			/* n bytes went through, charge every bucket of the chain */
+			void Consume(std::size_t n);
+
+			/*
+			 * How long until every bucket of the chain is out of debt,
+			 * zero if all are now
+			 */
+			std::chrono::nanoseconds Delay();
+
+			/*
+			 * Sleep for Delay(), but for no longer than MaxSleep so the
+			 * caller can look at its interrupt flag and a new rate takes
+			 * effect. Return true if the chain has no debt left.
+			 */
+			bool Wait();
+
+			/* The time one Quantum() lasts at the rate it was cut for */
+			static const std::chrono::milliseconds Slice;
+			static const std::chrono::milliseconds MaxSleep;
+
+		private:
+			/* Top up the tokens for the time since the last call; _mt held */
+			void Refill(uint64_t rate);
+
+			static std::chrono::steady_clock::time_point Now()
+			{
+				return std::chrono::steady_clock::now();
+			}
+
+			/* Tokens saved up while idle, as time at the rate */
+			static const std::chrono::milliseconds Burst;
+			static const std::size_t MinQuantum = 16 * 1024;
+			std::atomic<uint64_t> _rate;
+			RateLimiter *_parent;
+			Clock		_clock;
+			std::mutex _mt;
+			double		_tokens = 0;
+			std::chrono::steady_clock::time_point _last;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLRATE_H
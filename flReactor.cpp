@@ -0,0 +1,166 @@
+/**************************************************************
+      > File Name: flReactor.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 16时02分41秒
+ **************************************************************/
+
+#include "flReactor.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace Rainbow{
+
+#ifdef __linux__
+
+	Reactor::Reactor(unsigned int threads):
+		_stop(false)
+	{
+		_epfd = epoll_create1(EPOLL_CLOEXEC);
+		_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if(_epfd < 0 || _wakefd < 0)
+			return;
+
+		/* level triggered and never read, so it wakes every thread */
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = _wakefd;
+		epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev);
+
+		for(unsigned int i = 0; i < std::max(threads, 1u); ++i)
+			_threads.emplace_back(&Reactor::Run, this);
+	}
+
+
+	int Reactor::Add(socket_t sd, Event event, Handler handler)
+	{
+		if(_epfd < 0 || _threads.empty())
+			return -1;
+
+		auto entry = std::make_shared<Entry>();
+		entry->handler = std::move(handler);
+		entry->events = (event == Readable ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+
+		std::lock_guard<std::mutex> lk(_mt);
+		struct epoll_event ev;
+		ev.events = entry->events;
+		ev.data.fd = sd;
+		if(epoll_ctl(_epfd, EPOLL_CTL_ADD, sd, &ev) < 0)
+			return -1;
+		_entries[sd] = entry;
+		return 0;
+	}
+
+
+	bool Reactor::Remove(socket_t sd)
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		auto it = _entries.find(sd);
+		if(it == _entries.end())
+			return false;
+
+		std::shared_ptr<Entry> entry = it->second;
+		entry->removed = true;
+		epoll_ctl(_epfd, EPOLL_CTL_DEL, sd, NULL);
+		_entries.erase(it);
+		_idle.wait(lk, [&entry]{ return !entry->running; });
+		return !entry->finished;
+	}
+
+
+	void Reactor::Run()
+	{
+		struct epoll_event events[16];
+		while(!_stop)
+		{
+			int n = epoll_wait(_epfd, events, 16, -1);
+			if(n < 0 && errno != EINTR)
+				break;
+
+			for(int i = 0; i < n && !_stop; ++i)
+			{
+				socket_t sd = events[i].data.fd;
+				if(sd == _wakefd)
+					continue;
+
+				std::shared_ptr<Entry> entry;
+				{
+					std::lock_guard<std::mutex> lk(_mt);
+					auto it = _entries.find(sd);
+					if(it == _entries.end() || it->second->removed)
+						continue;
+					entry = it->second;
+					entry->running = true;
+				}
+
+				bool keep = entry->handler();
+
+				std::lock_guard<std::mutex> lk(_mt);
+				entry->running = false;
+				if(!keep)
+					entry->finished = true;
+				if(!entry->removed)
+				{
+					if(keep)
+					{
+						struct epoll_event ev;
+						ev.events = entry->events;
+						ev.data.fd = sd;
+						epoll_ctl(_epfd, EPOLL_CTL_MOD, sd, &ev);
+					}
+					else
+					{
+						epoll_ctl(_epfd, EPOLL_CTL_DEL, sd, NULL);
+						_entries.erase(sd);
+					}
+				}
+				_idle.notify_all();
+			}
+		}
+	}
+
+
+	Reactor::~Reactor()
+	{
+		_stop = true;
+		if(_wakefd >= 0)
+		{
+			uint64_t one = 1;
+			ssize_t ret = write(_wakefd, &one, sizeof(one));
+			(void)ret;
+		}
+		for(auto &t : _threads)
+			t.join();
+		if(_wakefd >= 0)
+			close(_wakefd);
+		if(_epfd >= 0)
+			close(_epfd);
+	}
+
+#else
+
+	Reactor::Reactor(unsigned int):
+		_stop(false)
+	{}
+
+	int Reactor::Add(socket_t, Event, Handler)
+	{
+		return -1;
+	}
+
+	bool Reactor::Remove(socket_t)
+	{
+		return false;
+	}
+
+	void Reactor::Run()
+	{}
+
+	Reactor::~Reactor()
+	{}
+
+#endif
+
+} /* Rainbow end */
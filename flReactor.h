@@ -0,0 +1,78 @@
+#ifndef FLREACTOR_H
+#define FLREACTOR_H
+#include "flFTP.h"
+#include <unordered_map>
+#include <condition_variable>
+
+namespace Rainbow{
+
+	/*
+	 * A few threads waiting on one epoll set. A DataPort given a reactor
+	 * hands its data socket over instead of starting a thread for every
+	 * transfer, so thousands of transfers share a handful of threads.
+	 * The control connection stays blocking in the caller's thread.
+	 * Linux only; elsewhere Add() fails and data ports keep their threads.
+	 * The reactor must outlive every data port using it.
+	 */
+	class Reactor
+	{
+		public:
+			enum Event
+			{
+				Readable,
+				Writable
+			};
+
+			/*
+			 * Run on a pool thread whenever the socket is ready. Return true
+			 * to keep watching it, false when done with it. A socket is
+			 * never handled by two threads at once.
+			 */
+			typedef std::function<bool()> Handler;
+
+			explicit Reactor(unsigned int threads = 2);
+
+			Reactor(const Reactor&) = delete;
+			Reactor &operator=(const Reactor&) = delete;
+
+			int Add(socket_t sd, Event event, Handler handler);
+
+			/*
+			 * Stop watching sd and wait for a running handler to return.
+			 * Return false if the handler had already finished with sd.
+			 */
+			bool Remove(socket_t sd);
+
+			/* Number of sockets being watched */
+			std::size_t Watching()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _entries.size();
+			}
+
+			~Reactor();
+
+		private:
+			struct Entry
+			{
+				Handler handler;
+				unsigned int events;
+				bool running = false;
+				bool finished = false;
+				bool removed = false;
+			};
+
+			void Run();
+
+			int _epfd = -1;
+			int _wakefd = -1;
+			std::atomic_bool _stop;
+			std::mutex _mt;
+			std::condition_variable _idle;
+			std::unordered_map<socket_t, std::shared_ptr<Entry>> _entries;
+			std::vector<std::thread> _threads;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLREACTOR_H
@@ -0,0 +1,831 @@
+/**************************************************************
+      > File Name: flServer.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 22时41分19秒
+ **************************************************************/
+
+#include "flServer.h"
+#include "flHash.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace Rainbow{
+
+	/* Content() repeats with this period, so one buffer serves every offset */
+	static const std::size_t ContentPeriod = 251;
+	static const std::size_t SendChunk = 1 << 20;
+
+
+	static double ThreadCpuSeconds()
+	{
+#ifdef RUSAGE_THREAD
+		struct rusage usage;
+		if(getrusage(RUSAGE_THREAD, &usage) < 0)
+			return 0;
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+			(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+		return 0;
+#endif
+	}
+
+
+	/* Absolute, without "." or "..", "/" for the root */
+	static std::string Resolve(const std::string &cwd, const std::string &path)
+	{
+		std::string full = (!path.empty() && path[0] == '/') ? path : cwd + '/' + path;
+		std::vector<std::string> parts;
+		std::size_t begin = 0;
+		while(begin <= full.size())
+		{
+			std::size_t end = full.find('/', begin);
+			if(end == std::string::npos)
+				end = full.size();
+			std::string part = full.substr(begin, end - begin);
+			if(part == "..")
+			{
+				if(!parts.empty())
+					parts.pop_back();
+			}
+			else if(!part.empty() && part != ".")
+				parts.push_back(part);
+			begin = end + 1;
+		}
+		std::string result;
+		for(auto &part : parts)
+			result += '/' + part;
+		return result.empty() ? "/" : result;
+	}
+
+
+	/* Hex digest of bytes [start, end) of any file */
+	static std::string ContentDigest(HashAlgorithm algorithm, std::size_t start, std::size_t end)
+	{
+		std::unique_ptr<Hash> hash = MakeHash(algorithm);
+		std::vector<char> data(SendChunk);
+		while(start < end)
+		{
+			std::size_t n = std::min(end - start, SendChunk);
+			LoopbackServer::Content(start, data.data(), n);
+			hash->Update(data.data(), n);
+			start += n;
+		}
+		return hash->HexDigest();
+	}
+
+
+	static std::string FormatTime(int64_t mtime, const char *format)
+	{
+		time_t t = (time_t)mtime;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		char text[32];
+		strftime(text, sizeof(text), format, &tm);
+		return text;
+	}
+
+
+	class LoopbackServer::Session
+	{
+		public:
+			Session(LoopbackServer &server, int sd):
+				_server(server),
+				_sd(sd)
+			{}
+
+			~Session()
+			{
+				if(_pasv >= 0)
+					close(_pasv);
+			}
+
+			void Run();
+
+		private:
+			/* The next command line, false once the client is gone */
+			bool ReadLine(std::string &line);
+
+			void Reply(const std::string &text);
+
+			void Handle(const std::string &command, const std::string &argument);
+
+			/* The connection to the last PASV port, -1 if none came */
+			int AcceptData();
+
+			void Retrieve(const std::string &path);
+
+			void Store(const std::string &path, bool append);
+
+			void List(const std::string &path, bool mlsd, bool namesOnly);
+
+			LoopbackServer &_server;
+			int			_sd;
+			int			_pasv = -1;
+			std::string _cwd = "/";
+			std::size_t _rest = 0;
+			HashAlgorithm _hash = HashSha256;	/* as OPTS HASH sets it */
+			std::size_t _rangStart = 0;
+			std::size_t _rangEnd = (std::size_t)-1;	/* inclusive, -1 for none */
+			std::string _input;
+			std::string _command;
+			std::chrono::steady_clock::time_point _arrived;
+	};
+
+
+	bool LoopbackServer::Session::ReadLine(std::string &line)
+	{
+		std::size_t newline;
+		while((newline = _input.find('\n')) == std::string::npos)
+		{
+			bool idle = _input.empty();
+			char buffer[4096];
+			ssize_t n = recv(_sd, buffer, sizeof(buffer), 0);
+			if(n <= 0)
+				return false;
+			_arrived = std::chrono::steady_clock::now();
+			_input.append(buffer, n);
+			if(idle)
+			{
+				std::lock_guard<std::mutex> lk(_server._mt);
+				++_server._stats.turns;
+			}
+		}
+		line = _input.substr(0, newline);
+		if(!line.empty() && line.back() == '\r')
+			line.pop_back();
+		_input.erase(0, newline + 1);
+
+		std::lock_guard<std::mutex> lk(_server._mt);
+		if(_server._dropPipelined)
+			_input.clear();
+		return true;
+	}
+
+
+	void LoopbackServer::Session::Reply(const std::string &text)
+	{
+		auto due = _arrived;
+		{
+			std::lock_guard<std::mutex> lk(_server._mt);
+			due += _server._latency;
+			auto search = _server._replyDelays.find(_command);
+			if(search != _server._replyDelays.end())
+				due += search->second;
+		}
+		std::this_thread::sleep_until(due);
+		std::string message = text + "\r\n";
+		send(_sd, message.data(), message.size(), MSG_NOSIGNAL);
+	}
+
+
+	void LoopbackServer::Session::Run()
+	{
+		_arrived = std::chrono::steady_clock::now();
+		Reply("220 flFTP loopback server ready");
+		std::string line;
+		while(ReadLine(line))
+		{
+			double cpu = ThreadCpuSeconds();
+			std::size_t space = line.find(' ');
+			_command = line.substr(0, space);
+			std::transform(_command.begin(), _command.end(), _command.begin(), ::toupper);
+			std::string argument = (space == std::string::npos) ? "" : line.substr(space + 1);
+
+			Fault fault{0, 0};
+			{
+				std::lock_guard<std::mutex> lk(_server._mt);
+				++_server._stats.commands;
+				++_server._commands[_command];
+				auto search = _server._faults.find(_command);
+				if(search != _server._faults.end())
+				{
+					fault = search->second;
+					if(--search->second.times == 0)
+						_server._faults.erase(search);
+				}
+			}
+			if(fault.times > 0)
+				Reply(std::to_string(fault.code) + " injected failure");
+			else if(_command == "QUIT")
+			{
+				Reply("221 bye");
+				break;
+			}
+			else
+				Handle(_command, argument);
+			_server.AddCpu(ThreadCpuSeconds() - cpu);
+		}
+	}
+
+
+	void LoopbackServer::Session::Handle(const std::string &command, const std::string &argument)
+	{
+		LoopbackServer &server = _server;
+		const std::string path = Resolve(_cwd, argument);
+
+		if(command == "USER")
+			Reply("331 password please");
+		else if(command == "PASS")
+			Reply("230 logged in");
+		else if(command == "SYST")
+			Reply("215 UNIX Type: L8");
+		else if(command == "TYPE" || command == "NOOP")
+			Reply("200 ok");
+		else if(command == "FEAT")
+			Reply("211-Features\r\n MLSD\r\n SIZE\r\n MDTM\r\n REST STREAM\r\n"
+					" HASH CRC32;MD5;CRC32C;XXH64;SHA-256*\r\n RANG STREAM\r\n XCRC\r\n XMD5\r\n211 End");
+		else if(command == "PWD")
+			Reply("257 \"" + _cwd + "\" is the current directory");
+		else if(command == "CWD" || command == "CDUP")
+		{
+			std::string dir = (command == "CDUP") ? Resolve(_cwd, "..") : path;
+			bool exists;
+			{
+				std::lock_guard<std::mutex> lk(server._mt);
+				exists = (dir == "/" || server._dirs.count(dir) > 0);
+			}
+			if(!exists)
+				Reply("550 no such directory");
+			else
+			{
+				_cwd = dir;
+				Reply("250 ok");
+			}
+		}
+		else if(command == "PASV")
+		{
+			if(_pasv >= 0)
+				close(_pasv);
+			_pasv = socket(AF_INET, SOCK_STREAM, 0);
+			struct sockaddr_in sin;
+			memset(&sin, 0, sizeof(sin));
+			sin.sin_family = AF_INET;
+			sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			socklen_t len = sizeof(sin);
+			if(_pasv < 0 || bind(_pasv, (sockaddr *)&sin, sizeof(sin)) < 0 ||
+					listen(_pasv, 1) < 0 || getsockname(_pasv, (sockaddr *)&sin, &len) < 0)
+			{
+				Reply("425 cannot open data port");
+				return;
+			}
+			int port = ntohs(sin.sin_port);
+			char text[64];
+			snprintf(text, sizeof(text), "227 Entering Passive Mode (127,0,0,1,%d,%d)",
+					port / 256, port % 256);
+			Reply(text);
+		}
+		else if(command == "SIZE" || command == "MDTM")
+		{
+			/* as strict servers do, only RETR, STOR and APPE may follow REST */
+			_rest = 0;
+			File file{0, 0};
+			bool exists;
+			{
+				std::lock_guard<std::mutex> lk(server._mt);
+				auto search = server._files.find(path);
+				exists = (search != server._files.end());
+				if(exists)
+					file = search->second;
+			}
+			if(!exists)
+				Reply("550 no such file");
+			else if(command == "SIZE")
+				Reply("213 " + std::to_string(file.size));
+			else
+				Reply("213 " + FormatTime(file.mtime, "%Y%m%d%H%M%S"));
+		}
+		else if(command == "REST")
+		{
+			_rest = strtoull(argument.c_str(), NULL, 10);
+			Reply("350 restarting at " + std::to_string(_rest));
+		}
+		else if(command == "OPTS")
+		{
+			std::string name = argument.substr(std::min<std::size_t>(argument.size(), 5));
+			std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+			HashAlgorithm known[] = {HashCrc32, HashMd5, HashCrc32c, HashXxh64, HashSha256};
+			auto search = std::find_if(std::begin(known), std::end(known),
+					[&](HashAlgorithm algorithm){ return name == HashName(algorithm); });
+			if(argument.compare(0, 5, "HASH ") != 0)
+				Reply("501 unknown option");
+			else if(search == std::end(known))
+				Reply("504 unknown algorithm");
+			else
+			{
+				_hash = *search;
+				Reply("200 " + name);
+			}
+		}
+		else if(command == "RANG")
+		{
+			unsigned long long start, end;
+			if(sscanf(argument.c_str(), "%llu %llu", &start, &end) != 2 || start > end)
+				Reply("501 bad range");
+			else
+			{
+				_rangStart = start;
+				_rangEnd = end;
+				Reply("350 range set");
+			}
+		}
+		else if(command == "HASH" || command == "XCRC" || command == "XMD5")
+		{
+			/* HASH takes the range from RANG, the others from their arguments */
+			std::string name = argument;
+			std::size_t start = 0, end = (std::size_t)-1;
+			if(command == "HASH")
+			{
+				start = _rangStart;
+				if(_rangEnd != (std::size_t)-1)
+					end = _rangEnd + 1;
+				_rangStart = 0;
+				_rangEnd = (std::size_t)-1;
+			}
+			else
+			{
+				std::size_t space = argument.find(' ');
+				name = argument.substr(0, space);
+				unsigned long long first, last;
+				if(space != std::string::npos &&
+						sscanf(argument.c_str() + space, "%llu %llu", &first, &last) == 2)
+				{
+					start = first;
+					end = last;
+				}
+			}
+			File file{0, 0};
+			bool exists;
+			{
+				std::lock_guard<std::mutex> lk(server._mt);
+				auto search = server._files.find(Resolve(_cwd, name));
+				exists = (search != server._files.end());
+				if(exists)
+					file = search->second;
+			}
+			end = std::min(end, file.size);
+			if(!exists)
+				Reply("550 no such file");
+			else if(start > end)
+				Reply("501 bad range");
+			else if(command == "HASH")
+				Reply("213 " + std::string(HashName(_hash)) + " " + std::to_string(start) + "-" +
+						std::to_string(end > start ? end - 1 : start) + " " + ContentDigest(_hash, start, end) + " " + name);
+			else
+				Reply("250 " + ContentDigest(command == "XCRC" ? HashCrc32 : HashMd5, start, end));
+		}
+		else if(command == "RETR")
+			Retrieve(path);
+		else if(command == "STOR" || command == "APPE")
+			Store(path, command == "APPE");
+		else if(command == "MLSD" || command == "LIST" || command == "NLST")
+		{
+			bool mlsd = (command == "MLSD");
+			bool enabled;
+			{
+				std::lock_guard<std::mutex> lk(server._mt);
+				enabled = server._mlsd;
+			}
+			if(mlsd && !enabled)
+				Reply("500 unknown command");
+			else
+				/* LIST options such as -a are not paths */
+				List((!argument.empty() && argument[0] == '-') ? _cwd : path,
+						mlsd, command == "NLST");
+		}
+		else if(command == "ABOR")
+			Reply("226 nothing to abort");
+		else
+			Reply("502 not implemented");
+	}
+
+
+	int LoopbackServer::Session::AcceptData()
+	{
+		if(_pasv < 0)
+			return -1;
+		struct pollfd pfd;
+		pfd.fd = _pasv;
+		pfd.events = POLLIN;
+		int sd = -1;
+		/* look at the stop flag now and then, the client may never come */
+		for(int waited = 0; waited < 50 && !_server._stop; ++waited)
+		{
+			if(poll(&pfd, 1, 100) > 0)
+			{
+				sd = accept(_pasv, NULL, NULL);
+				break;
+			}
+		}
+		close(_pasv);
+		_pasv = -1;
+		if(sd >= 0)
+		{
+			std::lock_guard<std::mutex> lk(_server._mt);
+			++_server._stats.dataConnections;
+		}
+		return sd;
+	}
+
+
+	void LoopbackServer::Session::Retrieve(const std::string &path)
+	{
+		LoopbackServer &server = _server;
+		std::size_t size = 0, limit = (std::size_t)-1;
+		bool exists;
+		{
+			std::lock_guard<std::mutex> lk(server._mt);
+			auto search = server._files.find(path);
+			exists = (search != server._files.end());
+			if(exists)
+			{
+				size = search->second.size;
+				if(server._drops > 0)
+				{
+					--server._drops;
+					limit = server._dropAfter;
+				}
+			}
+		}
+		if(!exists)
+		{
+			Reply("550 no such file");
+			return;
+		}
+		std::size_t offset = std::min(_rest, size);
+		_rest = 0;
+
+		Reply("150 opening data connection");
+		int sd = AcceptData();
+		if(sd < 0)
+		{
+			Reply("425 no data connection");
+			return;
+		}
+
+		static const std::string pattern = []
+		{
+			std::string data(SendChunk + ContentPeriod, '\0');
+			Content(0, &data[0], data.size());
+			return data;
+		}();
+		std::size_t end = size - offset > limit ? offset + limit : size;
+		bool failed = false;
+		while(offset < end)
+		{
+			while(!server._bandwidth.Wait())
+				if(server._stop)
+					break;
+			std::size_t n = server._bandwidth.Quantum(std::min(end - offset, SendChunk));
+			ssize_t sent = send(sd, pattern.data() + offset % ContentPeriod, n, MSG_NOSIGNAL);
+			if(sent <= 0 || server._stop)
+			{
+				failed = true;
+				break;
+			}
+			server._bandwidth.Consume(sent);
+			offset += sent;
+			std::lock_guard<std::mutex> lk(server._mt);
+			server._stats.bytesSent += sent;
+		}
+		close(sd);
+		Reply((failed || end < size) ? "426 connection closed, transfer aborted" :
+				"226 transfer complete");
+	}
+
+
+	void LoopbackServer::Session::Store(const std::string &path, bool append)
+	{
+		Reply("150 opening data connection");
+		int sd = AcceptData();
+		if(sd < 0)
+		{
+			Reply("425 no data connection");
+			return;
+		}
+		std::vector<char> buffer(SendChunk);
+		std::size_t received = 0;
+		ssize_t n;
+		while((n = recv(sd, buffer.data(), buffer.size(), 0)) > 0)
+			received += n;
+		close(sd);
+
+		{
+			std::lock_guard<std::mutex> lk(_server._mt);
+			_server._stats.bytesReceived += received;
+			File &file = _server._files[path];
+			std::size_t base = append ? file.size : std::min(_rest, file.size);
+			file.size = base + received;
+			file.mtime = time(NULL);
+			for(std::size_t slash = path.rfind('/'); slash != 0 && slash != std::string::npos;
+					slash = path.rfind('/', slash - 1))
+				_server._dirs.insert(path.substr(0, slash));
+		}
+		_rest = 0;
+		Reply(n < 0 ? "426 connection closed, transfer aborted" : "226 transfer complete");
+	}
+
+
+	void LoopbackServer::Session::List(const std::string &path, bool mlsd, bool namesOnly)
+	{
+		LoopbackServer &server = _server;
+		std::string text;
+		bool exists;
+		{
+			std::lock_guard<std::mutex> lk(server._mt);
+			exists = (path == "/" || server._dirs.count(path) > 0);
+			const std::string prefix = (path == "/") ? "/" : path + '/';
+			std::set<std::string> subdirs;
+			std::map<std::string, File> files;
+			for(auto &listed : server._listed)
+			{
+				if(listed.dir != path)
+					continue;
+				if(listed.directory)
+					subdirs.insert(listed.name);
+				else
+					files[listed.name] = File{1, 1500000000};
+			}
+			for(auto it = server._files.lower_bound(prefix);
+					it != server._files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+			{
+				std::string name = it->first.substr(prefix.size());
+				std::size_t slash = name.find('/');
+				if(slash != std::string::npos)
+					subdirs.insert(name.substr(0, slash));
+				else
+					files[name] = it->second;
+			}
+			for(auto &elem : files)
+			{
+				const std::string &name = elem.first;
+				const File &file = elem.second;
+				if(namesOnly)
+					text += name;
+				else if(mlsd)
+					text += "type=file;size=" + std::to_string(file.size) + ";modify=" +
+						FormatTime(file.mtime, "%Y%m%d%H%M%S") + "; " + name;
+				else
+				{
+					char line[64];
+					snprintf(line, sizeof(line), "-rw-r--r-- 1 ftp ftp %12zu ", file.size);
+					text += line + FormatTime(file.mtime, "%b %d  %Y") + ' ' + name;
+				}
+				text += "\r\n";
+			}
+			for(auto &name : subdirs)
+			{
+				if(namesOnly)
+					text += name;
+				else if(mlsd)
+					text += "type=dir;modify=" + FormatTime(1500000000, "%Y%m%d%H%M%S") + "; " + name;
+				else
+					text += "drwxr-xr-x 2 ftp ftp         4096 " +
+						FormatTime(1500000000, "%b %d  %Y") + ' ' + name;
+				text += "\r\n";
+			}
+		}
+
+		if(!exists)
+		{
+			Reply("550 no such directory");
+			return;
+		}
+		Reply("150 here comes the listing");
+		int sd = AcceptData();
+		if(sd < 0)
+		{
+			Reply("425 no data connection");
+			return;
+		}
+		std::size_t sent = 0;
+		while(sent < text.size())
+		{
+			ssize_t n = send(sd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+			if(n <= 0)
+				break;
+			sent += n;
+		}
+		close(sd);
+		{
+			std::lock_guard<std::mutex> lk(server._mt);
+			server._stats.bytesSent += sent;
+		}
+		Reply(sent < text.size() ? "426 connection closed, transfer aborted" :
+				"226 listing sent");
+	}
+
+
+	int LoopbackServer::Start(int port)
+	{
+		_listen = socket(AF_INET, SOCK_STREAM, 0);
+		if(_listen < 0)
+		{
+			_errorMessage = "socket error";
+			return -1;
+		}
+		int on = 1;
+		setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		struct sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin.sin_port = htons(port);
+		socklen_t len = sizeof(sin);
+		if(bind(_listen, (sockaddr *)&sin, sizeof(sin)) < 0 || listen(_listen, 64) < 0 ||
+				getsockname(_listen, (sockaddr *)&sin, &len) < 0)
+		{
+			_errorMessage = "bind error";
+			close(_listen);
+			_listen = -1;
+			return -1;
+		}
+		_port = ntohs(sin.sin_port);
+		_stop = false;
+		_acceptor = std::thread(&LoopbackServer::Accept, this);
+		return 0;
+	}
+
+
+	void LoopbackServer::Stop()
+	{
+		if(_listen < 0)
+			return;
+		_stop = true;
+		/* wakes accept() */
+		shutdown(_listen, SHUT_RDWR);
+		_acceptor.join();
+		close(_listen);
+		_listen = -1;
+
+		std::vector<std::thread> threads;
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			for(int sd : _sockets)
+				shutdown(sd, SHUT_RDWR);
+			threads.swap(_threads);
+		}
+		for(auto &t : threads)
+			t.join();
+	}
+
+
+	void LoopbackServer::Accept()
+	{
+		while(!_stop)
+		{
+			int sd = accept(_listen, NULL, NULL);
+			if(sd < 0)
+			{
+				if(errno == EINTR || errno == ECONNABORTED)
+					continue;
+				break;
+			}
+			int on = 1;
+			setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			std::lock_guard<std::mutex> lk(_mt);
+			if(_stop)
+			{
+				close(sd);
+				break;
+			}
+			++_stats.sessions;
+			_sockets.insert(sd);
+			_threads.emplace_back(&LoopbackServer::Serve, this, sd);
+		}
+	}
+
+
+	void LoopbackServer::Serve(int sd)
+	{
+		{
+			Session session(*this, sd);
+			session.Run();
+		}
+		std::lock_guard<std::mutex> lk(_mt);
+		_sockets.erase(sd);
+		close(sd);
+	}
+
+
+	void LoopbackServer::AddCpu(double seconds)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_stats.cpuSeconds += seconds;
+	}
+
+
+	void LoopbackServer::AddFile(const std::string &path, std::size_t size, int64_t mtime)
+	{
+		const std::string file = Resolve("/", path);
+		std::lock_guard<std::mutex> lk(_mt);
+		_files[file] = File{size, mtime};
+		for(std::size_t slash = file.rfind('/'); slash != 0 && slash != std::string::npos;
+				slash = file.rfind('/', slash - 1))
+			_dirs.insert(file.substr(0, slash));
+	}
+
+
+	void LoopbackServer::SetLatency(std::chrono::microseconds latency)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_latency = latency;
+	}
+
+
+	void LoopbackServer::SetBandwidth(uint64_t bytesPerSecond)
+	{
+		_bandwidth.SetRate(bytesPerSecond);
+	}
+
+
+	void LoopbackServer::SetReplyDelay(const std::string &command, std::chrono::milliseconds delay)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_replyDelays[command] = delay;
+	}
+
+
+	void LoopbackServer::FailCommand(const std::string &command, int code, unsigned int times)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		if(times == 0)
+			_faults.erase(command);
+		else
+			_faults[command] = Fault{code, times};
+	}
+
+
+	void LoopbackServer::DropDataAfter(std::size_t bytes, unsigned int times)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_dropAfter = bytes;
+		_drops = times;
+	}
+
+
+	void LoopbackServer::SetDropPipelined(bool drop)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_dropPipelined = drop;
+	}
+
+
+	void LoopbackServer::SetMlsd(bool enable)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_mlsd = enable;
+	}
+
+
+	void LoopbackServer::AddListed(const std::string &dir, const std::string &name, bool directory)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_listed.push_back(Listed{dir, name, directory});
+	}
+
+
+	LoopbackServer::Stats LoopbackServer::GetStats()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		return _stats;
+	}
+
+
+	std::size_t LoopbackServer::Commands(const std::string &command)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		auto search = _commands.find(command);
+		return search == _commands.end() ? 0 : search->second;
+	}
+
+
+	void LoopbackServer::ResetStats()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_stats = Stats();
+		_commands.clear();
+	}
+
+
+	void LoopbackServer::Content(std::size_t offset, char *data, std::size_t n)
+	{
+		for(std::size_t i = 0; i < n; ++i)
+			data[i] = (char)((offset + i) % ContentPeriod);
+	}
+
+}	/* namespace Rainbow */
@@ -0,0 +1,167 @@
+#ifndef FLSERVER_H
+#define FLSERVER_H
+#include "flRate.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace Rainbow{
+
+	/*
+	 * A small FTP server on a loopback port, for benchmarks and tests
+	 * that must not depend on a real server. Files are synthetic: only
+	 * their sizes and times are kept, byte i of every file is i % 251
+	 * and what is uploaded is counted and dropped. HASH with RANG,
+	 * XCRC and XMD5 digest that content. Each control connection has
+	 * a thread of its own, which also drives its data connections.
+	 * Latency, bandwidth, slow replies and failures can be set up
+	 * beforehand or while clients are connected. POSIX only.
+	 */
+	class LoopbackServer
+	{
+		public:
+			struct Stats
+			{
+				std::size_t sessions;
+				std::size_t commands;
+				std::size_t turns;			/* times the server sat waiting for a client */
+				std::size_t dataConnections;
+				std::size_t bytesSent;
+				std::size_t bytesReceived;
+				double cpuSeconds;			/* spent by the server's threads */
+			};
+
+			LoopbackServer() = default;
+
+			LoopbackServer(const LoopbackServer&) = delete;
+			LoopbackServer &operator=(const LoopbackServer&) = delete;
+
+			/* Listen on 127.0.0.1 at port, one the kernel picks when 0 */
+			int Start(int port = 0);
+
+			/* Close every connection and wait for their threads */
+			void Stop();
+
+			int Port() const
+			{
+				return _port;
+			}
+
+			/* path is absolute; its directories come into being with it */
+			void AddFile(const std::string &path, std::size_t size, int64_t mtime = 1500000000);
+
+			/*
+			 * Every reply leaves latency after the command it answers
+			 * arrived, so each round trip a client makes costs it; commands
+			 * that arrive together are delayed together.
+			 */
+			void SetLatency(std::chrono::microseconds latency);
+
+			/* All data connections together send at most bytesPerSecond, 0 for no limit */
+			void SetBandwidth(uint64_t bytesPerSecond);
+
+			/* Replies to command, e.g. "RETR", leave delay later still */
+			void SetReplyDelay(const std::string &command, std::chrono::milliseconds delay);
+
+			/* Answer the next times uses of command with code and nothing else */
+			void FailCommand(const std::string &command, int code, unsigned int times = 1);
+
+			/* Close the next times downloads after bytes, replying 426 */
+			void DropDataAfter(std::size_t bytes, unsigned int times = 1);
+
+			/*
+			 * Throw away commands that arrive behind another before it is
+			 * answered, as some servers do with pipelined commands
+			 */
+			void SetDropPipelined(bool drop);
+
+			/* Answer MLSD with 500 so clients fall back to LIST */
+			void SetMlsd(bool enable);
+
+			/*
+			 * List name in dir just as it is, a file or a directory that
+			 * no path leads to: one with a slash, as a broken or hostile
+			 * server may send
+			 */
+			void AddListed(const std::string &dir, const std::string &name, bool directory);
+
+			Stats GetStats();
+
+			/* Times command was received */
+			std::size_t Commands(const std::string &command);
+
+			void ResetStats();
+
+			std::string GetErrorDesc()
+			{
+				return _errorMessage;
+			}
+
+			/* Content of every file from offset on */
+			static void Content(std::size_t offset, char *data, std::size_t n);
+
+			~LoopbackServer()
+			{
+				Stop();
+			}
+
+		private:
+			struct File
+			{
+				std::size_t size;
+				int64_t mtime;
+			};
+
+			struct Listed
+			{
+				std::string dir;
+				std::string name;
+				bool directory;
+			};
+
+			struct Fault
+			{
+				int code;
+				unsigned int times;
+			};
+
+			class Session;
+
+			void Accept();
+
+			void Serve(int sd);
+
+			void AddCpu(double seconds);
+
+			int			_listen = -1;
+			int			_port = 0;
+			std::atomic_bool _stop{false};
+			std::string _errorMessage;
+			std::thread _acceptor;
+			std::mutex	_mt;
+			std::vector<std::thread> _threads;
+			std::set<int> _sockets;
+			std::map<std::string, File> _files;
+			std::set<std::string> _dirs;
+			std::vector<Listed> _listed;
+			std::chrono::microseconds _latency{0};
+			std::map<std::string, std::chrono::milliseconds> _replyDelays;
+			std::map<std::string, Fault> _faults;
+			std::size_t _dropAfter = 0;
+			unsigned int _drops = 0;
+			bool		_dropPipelined = false;
+			bool		_mlsd = true;
+			RateLimiter _bandwidth;
+			Stats		_stats = Stats();
+			std::map<std::string, std::size_t> _commands;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLSERVER_H
@@ -0,0 +1,183 @@
+/**************************************************************
+      > File Name: flSession.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 17时20分08秒
+ **************************************************************/
+
+#include "flSession.h"
+
+namespace Rainbow{
+
+	SessionPool::SessionPool(std::size_t maxIdle, std::chrono::seconds keepalive,
+			std::chrono::seconds idleTimeout):
+		_maxIdle(maxIdle),
+		_keepalive(keepalive),
+		_idleTimeout(idleTimeout)
+	{
+		_maintainer = std::thread(&SessionPool::Maintain, this);
+	}
+
+
+	std::string SessionPool::Key(const std::string &host, const std::string &service,
+			const std::string &username)
+	{
+		return host + '\n' + service + '\n' + username;
+	}
+
+
+	std::unique_ptr<flFTP> SessionPool::Acquire(const std::string &host,
+			const std::string &service, const std::string &username,
+			const std::string &password, std::string &errorDesc)
+	{
+		const std::string key = Key(host, service, username);
+		for(;;)
+		{
+			std::unique_ptr<flFTP> session;
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				auto search = _idle.find(key);
+				if(search != _idle.end())
+				{
+					auto &sessions = search->second;
+					auto it = std::find_if(sessions.begin(), sessions.end(),
+							[&password](const IdleSession &idle)
+							{ return idle.session->_password == password; });
+					if(it != sessions.end())
+					{
+						session = std::move(it->session);
+						sessions.erase(it);
+					}
+				}
+			}
+			if(!session)
+				break;
+
+			/* the server may have dropped it since the last keepalive */
+			if(session->Noop() == 0)
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				++_reused;
+				return session;
+			}
+			std::lock_guard<std::mutex> lk(_mt);
+			++_evicted;
+		}
+
+		auto session = details::make_unique<flFTP>();
+		if(session->Connection(host, service) < 0 ||
+				session->Login(username, password) < 0 ||
+				session->SetTransferType(flFTP::Binary) < 0)
+		{
+			errorDesc = session->GetErrorDesc();
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> lk(_mt);
+		++_created;
+		return session;
+	}
+
+
+	void SessionPool::Release(std::unique_ptr<flFTP> session)
+	{
+		if(!session)
+			return;
+		/* its own segments go back first, or would be closed with it */
+		session->ReleaseSegments();
+
+		TransferState state = session->_dataPort->State();
+		if(state == TransferState::Transport || state == TransferState::NetworkAnomaly ||
+				session->CompleteTransfer() < 0)
+			return;
+
+		std::unique_ptr<flFTP> oldest;
+		std::lock_guard<std::mutex> lk(_mt);
+		auto &sessions = _idle[Key(session->_host, session->_service, session->_username)];
+		auto now = std::chrono::steady_clock::now();
+		sessions.push_front(IdleSession{std::move(session), now, now});
+		if(sessions.size() > _maxIdle)
+		{
+			oldest = std::move(sessions.back().session);
+			sessions.pop_back();
+			++_evicted;
+		}
+	}
+
+
+	SessionPool::Stats SessionPool::GetStats()
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		std::size_t idle = 0;
+		for(auto &elem : _idle)
+			idle += elem.second.size();
+		return Stats{idle, _created, _reused, _evicted};
+	}
+
+
+	void SessionPool::Maintain()
+	{
+		std::unique_lock<std::mutex> lk(_mt);
+		while(!_stop)
+		{
+			_stopCond.wait_for(lk, std::chrono::seconds(1));
+			if(_stop)
+				break;
+
+			/* NOOP and close outside the lock, the server may be slow */
+			std::vector<std::unique_ptr<flFTP>> expired;
+			std::vector<std::pair<std::string, IdleSession>> due;
+			auto now = std::chrono::steady_clock::now();
+			for(auto &elem : _idle)
+			{
+				auto &sessions = elem.second;
+				for(auto it = sessions.begin(); it != sessions.end(); )
+				{
+					if(now - it->releasedAt >= _idleTimeout)
+						expired.push_back(std::move(it->session));
+					else if(now - it->checkedAt >= _keepalive)
+						due.emplace_back(elem.first, std::move(*it));
+					else
+					{
+						++it;
+						continue;
+					}
+					it = sessions.erase(it);
+				}
+			}
+			_evicted += expired.size();
+			lk.unlock();
+
+			expired.clear();
+			for(auto &elem : due)
+			{
+				if(elem.second.session->Noop() < 0)
+					elem.second.session.reset();
+				elem.second.checkedAt = std::chrono::steady_clock::now();
+			}
+
+			lk.lock();
+			for(auto &elem : due)
+			{
+				if(!elem.second.session)
+				{
+					++_evicted;
+					continue;
+				}
+				/* idle longer than anything released since, so it goes last */
+				_idle[elem.first].push_back(std::move(elem.second));
+			}
+		}
+	}
+
+
+	SessionPool::~SessionPool()
+	{
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_stop = true;
+		}
+		_stopCond.notify_all();
+		_maintainer.join();
+	}
+
+} /* Rainbow end */
@@ -0,0 +1,84 @@
+#ifndef FLSESSION_H
+#define FLSESSION_H
+#include "flFTP.h"
+#include <unordered_map>
+#include <chrono>
+
+namespace Rainbow{
+
+	/*
+	 * Logged-in sessions kept open between transfers and keyed by host,
+	 * port and user, so a transfer skips the connect, greeting and login
+	 * round trips. Idle sessions get a NOOP every keepalive interval so
+	 * the server does not drop them, are checked with another NOOP when
+	 * handed out and are closed after idleTimeout without use.
+	 * New sessions are switched to binary; a reused one comes back in
+	 * whatever directory and transfer type its last user left it.
+	 */
+	class SessionPool
+	{
+		public:
+			explicit SessionPool(std::size_t maxIdle = 4,
+					std::chrono::seconds keepalive = std::chrono::seconds(30),
+					std::chrono::seconds idleTimeout = std::chrono::seconds(300));
+
+			SessionPool(const SessionPool&) = delete;
+			SessionPool &operator=(const SessionPool&) = delete;
+
+			/*
+			 * An idle session of username on host:service, or a new one
+			 * logged in with password. nullptr on failure, with the reason
+			 * in errorDesc.
+			 */
+			std::unique_ptr<flFTP> Acquire(const std::string &host, const std::string &service,
+					const std::string &username, const std::string &password,
+					std::string &errorDesc);
+
+			/*
+			 * Hand a session back for reuse. One still transferring or
+			 * whose last transfer failed is closed instead, as are the
+			 * oldest beyond maxIdle for the same key.
+			 */
+			void Release(std::unique_ptr<flFTP> session);
+
+			struct Stats
+			{
+				std::size_t idle;
+				std::size_t created;
+				std::size_t reused;
+				std::size_t evicted;		/* timed out or failed a NOOP */
+			};
+			Stats GetStats();
+
+			~SessionPool();
+
+		private:
+			struct IdleSession
+			{
+				std::unique_ptr<flFTP> session;
+				std::chrono::steady_clock::time_point releasedAt;
+				std::chrono::steady_clock::time_point checkedAt;
+			};
+
+			static std::string Key(const std::string &host, const std::string &service,
+					const std::string &username);
+
+			void Maintain();
+
+			std::size_t _maxIdle;
+			std::chrono::seconds _keepalive;
+			std::chrono::seconds _idleTimeout;
+			std::mutex _mt;
+			std::condition_variable _stopCond;
+			bool		_stop = false;
+			/* most recently released first */
+			std::unordered_map<std::string, std::list<IdleSession>> _idle;
+			std::size_t _created = 0;
+			std::size_t _reused = 0;
+			std::size_t _evicted = 0;
+			std::thread _maintainer;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLSESSION_H
@@ -0,0 +1,422 @@
+/**************************************************************
+      > File Name: flStats.cpp
+      > Author: 逮枫灵
+      > mail: Albert@sshenp.com
+      > Created Time: 2026年10月17日 星期六 23时18分52秒
+ **************************************************************/
+
+#include "flStats.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+namespace Rainbow{
+
+	const std::size_t Histogram::Buckets;
+	const std::size_t Histogram::Shards;
+	const std::chrono::milliseconds RateMeter::Interval(100);
+	const std::chrono::milliseconds RateMeter::Decay(1000);
+
+
+	/* Each thread keeps to one shard, handed out in turn */
+	static std::size_t ThreadShard()
+	{
+		static std::atomic<std::size_t> next{0};
+		thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+		return shard;
+	}
+
+
+	std::size_t Histogram::BucketOf(uint64_t value)
+	{
+		if(value < 8)
+			return value;
+		int exponent = 63;
+		while(!(value >> exponent))
+			--exponent;
+		std::size_t bucket = (exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+		return std::min(bucket, Buckets - 1);
+	}
+
+
+	uint64_t Histogram::BucketUpper(std::size_t bucket)
+	{
+		if(bucket < 8)
+			return bucket;
+		/* the last bucket also counts everything past it */
+		if(bucket >= Buckets - 1)
+			return UINT64_MAX;
+		int exponent = bucket / 8 + 2;
+		uint64_t lower = (uint64_t)(8 + bucket % 8) << (exponent - 3);
+		return lower + ((uint64_t)1 << (exponent - 3)) - 1;
+	}
+
+
+	void Histogram::Record(uint64_t value)
+	{
+		Shard &shard = _shards[ThreadShard() % Shards];
+		shard.buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		shard.sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+
+	Histogram::Snapshot Histogram::Snap() const
+	{
+		Snapshot snapshot{0, 0, std::vector<uint64_t>(Buckets)};
+		for(const Shard &shard : _shards)
+		{
+			snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+			for(std::size_t i = 0; i < Buckets; ++i)
+				snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+		}
+		/* from the buckets, so the two agree while others record */
+		for(uint64_t n : snapshot.buckets)
+			snapshot.count += n;
+		return snapshot;
+	}
+
+
+	uint64_t Histogram::Snapshot::Percentile(double q) const
+	{
+		if(count == 0)
+			return 0;
+		/* the rank of the quantile, from 1 */
+		uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * count));
+		uint64_t seen = 0;
+		for(std::size_t i = 0; i < buckets.size(); ++i)
+		{
+			seen += buckets[i];
+			if(seen >= rank)
+				return BucketUpper(i);
+		}
+		return BucketUpper(buckets.size() - 1);
+	}
+
+
+	void RateMeter::Start(std::chrono::steady_clock::time_point now)
+	{
+		_bytes = 0;
+		_sampleBytes = 0;
+		_sampleTime = now;
+		_sampled = false;
+		_rate.store(0, std::memory_order_relaxed);
+		_average.store(0, std::memory_order_relaxed);
+	}
+
+
+	void RateMeter::Add(std::size_t n, std::chrono::steady_clock::time_point now)
+	{
+		_bytes += n;
+		if(now - _sampleTime < Interval)
+			return;
+		double elapsed = std::chrono::duration<double>(now - _sampleTime).count();
+		double rate = (_bytes - _sampleBytes) / elapsed;
+		double average = rate;
+		if(_sampled)
+		{
+			double weight = 1 - std::exp(-elapsed / std::chrono::duration<double>(Decay).count());
+			average = _average.load(std::memory_order_relaxed);
+			average += weight * (rate - average);
+		}
+		_rate.store(rate, std::memory_order_relaxed);
+		_average.store(average, std::memory_order_relaxed);
+		_sampleBytes = _bytes;
+		_sampleTime = now;
+		_sampled = true;
+	}
+
+
+	static const char *const CommandNames[Metrics::CommandCount] = {
+		"USER", "PASS", "TYPE", "CWD", "PWD", "PASV", "REST", "SIZE", "MDTM", "RETR",
+		"STOR", "APPE", "LIST", "MLSD", "NOOP", "FEAT", "OPTS", "HASH", "XCRC", "XMD5",
+		"OTHER"
+	};
+
+
+	Metrics::Command Metrics::CommandOf(const char *name, std::size_t n)
+	{
+		for(int i = 0; i < Other; ++i)
+		{
+			const char *known = CommandNames[i];
+			std::size_t length = strlen(known);
+			if(n != length)
+				continue;
+			std::size_t j = 0;
+			while(j < n && toupper((unsigned char)name[j]) == known[j])
+				++j;
+			if(j == n)
+				return (Command)i;
+		}
+		return Other;
+	}
+
+
+	const char *Metrics::CommandName(Command command)
+	{
+		return CommandNames[command];
+	}
+
+
+	void Metrics::TransferEnded(bool interrupted, bool failed)
+	{
+		if(failed)
+			_transfersFailed.fetch_add(1, std::memory_order_relaxed);
+		else if(interrupted)
+			_transfersInterrupted.fetch_add(1, std::memory_order_relaxed);
+		else
+			_transfersDone.fetch_add(1, std::memory_order_relaxed);
+	}
+
+
+	Metrics::Snapshot Metrics::Snap()
+	{
+		Snapshot snapshot;
+		snapshot.bytesReceived = _bytesReceived.load(std::memory_order_relaxed);
+		snapshot.bytesSent = _bytesSent.load(std::memory_order_relaxed);
+		snapshot.transfersStarted = _transfersStarted.load(std::memory_order_relaxed);
+		snapshot.transfersDone = _transfersDone.load(std::memory_order_relaxed);
+		snapshot.transfersFailed = _transfersFailed.load(std::memory_order_relaxed);
+		snapshot.transfersInterrupted = _transfersInterrupted.load(std::memory_order_relaxed);
+		snapshot.retries = _retries.load(std::memory_order_relaxed);
+		snapshot.diskWaitSeconds = _diskWaitNanos.load(std::memory_order_relaxed) / 1e9;
+		snapshot.networkWaitSeconds = _networkWaitNanos.load(std::memory_order_relaxed) / 1e9;
+		snapshot.firstByte = _firstByte.Snap();
+		for(int i = 0; i < CommandCount; ++i)
+			snapshot.replies[i] = _replies[i].Snap();
+
+		auto now = std::chrono::steady_clock::now();
+		uint64_t bytes = snapshot.bytesReceived + snapshot.bytesSent;
+		std::lock_guard<std::mutex> lk(_mt);
+		snapshot.throughput = 0;
+		if(_snapped)
+		{
+			double elapsed = std::chrono::duration<double>(now - _lastSnap).count();
+			if(elapsed > 0)
+				snapshot.throughput = (bytes - _lastBytes) / elapsed;
+			double weight = 1 - std::exp(-elapsed /
+					std::chrono::duration<double>(RateMeter::Decay).count());
+			_averageThroughput += weight * (snapshot.throughput - _averageThroughput);
+		}
+		_lastBytes = bytes;
+		_lastSnap = now;
+		_snapped = true;
+		snapshot.averageThroughput = _averageThroughput;
+		return snapshot;
+	}
+
+
+	/* Cumulative Prometheus buckets, in seconds, of a histogram of microseconds */
+	static void PrometheusHistogram(std::string &text, const char *name, const std::string &labels,
+			const Histogram::Snapshot &histogram)
+	{
+		static const double bounds[] = {
+			0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+			0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+		};
+		const std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+		char line[256];
+		std::size_t bucket = 0;
+		uint64_t cumulative = 0;
+		for(double bound : bounds)
+		{
+			/* a bucket counts below a bound once all of it is */
+			for(; bucket < histogram.buckets.size() &&
+					Histogram::BucketUpper(bucket) <= bound * 1e6; ++bucket)
+				cumulative += histogram.buckets[bucket];
+			snprintf(line, sizeof(line), "%s_bucket%sle=\"%g\"} %llu\n", name, prefix.c_str(),
+					bound, (unsigned long long)cumulative);
+			text += line;
+		}
+		const std::string plain = labels.empty() ? "" : "{" + labels + "}";
+		snprintf(line, sizeof(line), "%s_bucket%sle=\"+Inf\"} %llu\n%s_sum%s %.6f\n%s_count%s %llu\n",
+				name, prefix.c_str(), (unsigned long long)histogram.count,
+				name, plain.c_str(), histogram.sum / 1e6,
+				name, plain.c_str(), (unsigned long long)histogram.count);
+		text += line;
+	}
+
+
+	std::string Metrics::Prometheus()
+	{
+		Snapshot snapshot = Snap();
+		std::string text;
+		char line[512];
+
+		snprintf(line, sizeof(line),
+				"# HELP flftp_bytes_total Bytes moved over data connections.\n"
+				"# TYPE flftp_bytes_total counter\n"
+				"flftp_bytes_total{direction=\"received\"} %llu\n"
+				"flftp_bytes_total{direction=\"sent\"} %llu\n",
+				(unsigned long long)snapshot.bytesReceived, (unsigned long long)snapshot.bytesSent);
+		text += line;
+		snprintf(line, sizeof(line),
+				"# HELP flftp_transfers_total Transfers ended, by how.\n"
+				"# TYPE flftp_transfers_total counter\n"
+				"flftp_transfers_total{result=\"done\"} %llu\n"
+				"flftp_transfers_total{result=\"failed\"} %llu\n"
+				"flftp_transfers_total{result=\"interrupted\"} %llu\n"
+				"# HELP flftp_transfers_active Transfers started and not yet ended.\n"
+				"# TYPE flftp_transfers_active gauge\n"
+				"flftp_transfers_active %llu\n",
+				(unsigned long long)snapshot.transfersDone,
+				(unsigned long long)snapshot.transfersFailed,
+				(unsigned long long)snapshot.transfersInterrupted,
+				(unsigned long long)(snapshot.transfersStarted - snapshot.transfersDone -
+					snapshot.transfersFailed - snapshot.transfersInterrupted));
+		text += line;
+		snprintf(line, sizeof(line),
+				"# HELP flftp_retries_total Reconnects and restarts from zero.\n"
+				"# TYPE flftp_retries_total counter\n"
+				"flftp_retries_total %llu\n"
+				"# HELP flftp_wait_seconds_total Time transfers spent blocked, by on what.\n"
+				"# TYPE flftp_wait_seconds_total counter\n"
+				"flftp_wait_seconds_total{on=\"disk\"} %.6f\n"
+				"flftp_wait_seconds_total{on=\"network\"} %.6f\n",
+				(unsigned long long)snapshot.retries,
+				snapshot.diskWaitSeconds, snapshot.networkWaitSeconds);
+		text += line;
+		snprintf(line, sizeof(line),
+				"# HELP flftp_throughput_bytes_per_second Bytes moved per second since the last scrape.\n"
+				"# TYPE flftp_throughput_bytes_per_second gauge\n"
+				"flftp_throughput_bytes_per_second %.0f\n"
+				"# HELP flftp_throughput_average_bytes_per_second Weighted average of the above.\n"
+				"# TYPE flftp_throughput_average_bytes_per_second gauge\n"
+				"flftp_throughput_average_bytes_per_second %.0f\n",
+				snapshot.throughput, snapshot.averageThroughput);
+		text += line;
+
+		text += "# HELP flftp_first_byte_seconds Data connection to first byte.\n"
+			"# TYPE flftp_first_byte_seconds histogram\n";
+		PrometheusHistogram(text, "flftp_first_byte_seconds", "", snapshot.firstByte);
+		text += "# HELP flftp_reply_seconds Control command to its reply.\n"
+			"# TYPE flftp_reply_seconds histogram\n";
+		for(int i = 0; i < CommandCount; ++i)
+			if(snapshot.replies[i].count > 0)
+				PrometheusHistogram(text, "flftp_reply_seconds",
+						std::string("command=\"") + CommandNames[i] + "\"", snapshot.replies[i]);
+		return text;
+	}
+
+
+	int Metrics::Export(const std::string &path)
+	{
+		const std::string text = Prometheus();
+		const std::string temporary = path + ".tmp";
+		FILE *fp = fopen(temporary.c_str(), "wb");
+		bool written = fp && fwrite(text.data(), 1, text.size(), fp) == text.size();
+		if(fp && fclose(fp) != 0)
+			written = false;
+		/* rename() does not replace an existing file on Windows */
+#ifdef _WIN32
+		if(written)
+			remove(path.c_str());
+#endif
+		if(!written || rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			remove(temporary.c_str());
+			std::lock_guard<std::mutex> lk(_mt);
+			_errorMessage = "write metrics error";
+			return -1;
+		}
+		return 0;
+	}
+
+
+#ifndef _WIN32
+	int Metrics::Serve(int port)
+	{
+		StopServing();
+		int sd = socket(AF_INET, SOCK_STREAM, 0);
+		int on = 1;
+		struct sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin.sin_port = htons(port);
+		if(sd < 0 || setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+				bind(sd, (sockaddr *)&sin, sizeof(sin)) < 0 || listen(sd, 16) < 0)
+		{
+			if(sd >= 0)
+				close(sd);
+			std::lock_guard<std::mutex> lk(_mt);
+			_errorMessage = "bind error";
+			return -1;
+		}
+		_listen = sd;
+		_server = std::thread(&Metrics::Accept, this);
+		return 0;
+	}
+
+
+	void Metrics::StopServing()
+	{
+		if(_listen < 0)
+			return;
+		/* wakes accept() */
+		shutdown(_listen, SHUT_RDWR);
+		_server.join();
+		close(_listen);
+		_listen = -1;
+	}
+
+
+	void Metrics::Accept()
+	{
+		for(;;)
+		{
+			int sd = accept(_listen, NULL, NULL);
+			if(sd < 0)
+			{
+				if(errno == EINTR || errno == ECONNABORTED)
+					continue;
+				return;
+			}
+			/* whatever was asked, the request is read and the metrics sent */
+			struct timeval timeout = {1, 0};
+			setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			char request[1024];
+			recv(sd, request, sizeof(request), 0);
+			const std::string body = Prometheus();
+			const std::string response = "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+			std::size_t sent = 0;
+			while(sent < response.size())
+			{
+				ssize_t n = send(sd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+				if(n <= 0)
+					break;
+				sent += n;
+			}
+			close(sd);
+		}
+	}
+#else
+	int Metrics::Serve(int)
+	{
+		std::lock_guard<std::mutex> lk(_mt);
+		_errorMessage = "not supported";
+		return -1;
+	}
+
+
+	void Metrics::StopServing()
+	{
+	}
+
+
+	void Metrics::Accept()
+	{
+	}
+#endif
+
+}	/* namespace Rainbow */
@@ -0,0 +1,259 @@
+#ifndef FLSTATS_H
+#define FLSTATS_H
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace Rainbow{
+
+	/*
+	 * Counts of values, microseconds say, in buckets that each cover an
+	 * eighth of a power of two, as HdrHistogram does with one significant
+	 * digit: any value is known to within 12.5% and 304 buckets reach
+	 * days. Recording takes no lock; each thread counts into one of a
+	 * few shards so threads recording at once seldom share a cache line.
+	 */
+	class Histogram
+	{
+		public:
+			static const std::size_t Buckets = 304;
+
+			struct Snapshot
+			{
+				uint64_t count;
+				uint64_t sum;
+				std::vector<uint64_t> buckets;
+
+				/* Upper bound of the bucket holding the q quantile, 0 if empty */
+				uint64_t Percentile(double q) const;
+
+				uint64_t Max() const
+				{
+					return Percentile(1);
+				}
+			};
+
+			Histogram() = default;
+
+			Histogram(const Histogram&) = delete;
+			Histogram &operator=(const Histogram&) = delete;
+
+			void Record(uint64_t value);
+
+			Snapshot Snap() const;
+
+			static std::size_t BucketOf(uint64_t value);
+
+			/* Largest value counted in bucket, UINT64_MAX for the last */
+			static uint64_t BucketUpper(std::size_t bucket);
+
+		private:
+			static const std::size_t Shards = 4;
+
+			struct Shard
+			{
+				std::atomic<uint64_t> sum{0};
+				std::atomic<uint64_t> buckets[Buckets];
+
+				Shard()
+				{
+					for(auto &bucket : buckets)
+						bucket.store(0, std::memory_order_relaxed);
+				}
+			};
+
+			Shard _shards[Shards];
+	};
+
+
+	/*
+	 * Throughput of one stream of bytes, fed by a single thread and read
+	 * from any: the rate over the last Interval and an exponentially
+	 * weighted average of it that forgets with time constant Decay.
+	 */
+	class RateMeter
+	{
+		public:
+			void Start(std::chrono::steady_clock::time_point now);
+
+			void Add(std::size_t n, std::chrono::steady_clock::time_point now);
+
+			/* Bytes per second over the last interval */
+			double Rate() const
+			{
+				return _rate.load(std::memory_order_relaxed);
+			}
+
+			double Average() const
+			{
+				return _average.load(std::memory_order_relaxed);
+			}
+
+			static const std::chrono::milliseconds Interval;
+			static const std::chrono::milliseconds Decay;
+
+		private:
+			std::size_t _bytes = 0;
+			std::size_t _sampleBytes = 0;
+			std::chrono::steady_clock::time_point _sampleTime;
+			bool		_sampled = false;
+			std::atomic<double> _rate{0};
+			std::atomic<double> _average{0};
+	};
+
+
+	/* How one transfer is going, or went */
+	struct TransferStats
+	{
+		std::size_t bytes;			/* moved by this transfer, not counting a resumed part */
+		double seconds;				/* since the data connection was opened */
+		double throughput;			/* bytes per second, RateMeter::Rate() */
+		double averageThroughput;	/* RateMeter::Average() */
+		double firstByteSeconds;	/* data connection to first byte, -1 before it */
+		double diskWaitSeconds;		/* blocked on the file */
+		double networkWaitSeconds;	/* blocked on the socket */
+		std::size_t retries;		/* reconnects and restarts this transfer needed */
+	};
+
+
+	/*
+	 * Counters and latency histograms shared by every session given to
+	 * SetMetrics(), usually one for the whole process: bytes, transfers
+	 * and how they ended, retries, time blocked on disk and network,
+	 * time to first byte and the round trip of each control command.
+	 * Recording is lock free, Snap() and the exporters may run on any
+	 * thread at any time. Must outlive the sessions using it.
+	 */
+	class Metrics
+	{
+		public:
+			enum Command
+			{
+				User, Pass, Type, Cwd, Pwd, Pasv, Rest, Size, Mdtm, Retr,
+				Stor, Appe, List, Mlsd, Noop, Feat, Opts, Hash, Xcrc, Xmd5,
+				Other,
+				CommandCount
+			};
+
+			struct Snapshot
+			{
+				uint64_t bytesReceived;
+				uint64_t bytesSent;
+				uint64_t transfersStarted;
+				uint64_t transfersDone;
+				uint64_t transfersFailed;
+				uint64_t transfersInterrupted;
+				uint64_t retries;
+				double diskWaitSeconds;
+				double networkWaitSeconds;
+				double throughput;			/* bytes per second since the previous Snap() */
+				double averageThroughput;	/* weighted over the snapshots, as RateMeter */
+				Histogram::Snapshot firstByte;				/* microseconds */
+				Histogram::Snapshot replies[CommandCount];	/* microseconds */
+			};
+
+			Metrics() = default;
+
+			Metrics(const Metrics&) = delete;
+			Metrics &operator=(const Metrics&) = delete;
+
+			/* The Command of the name a command line starts with */
+			static Command CommandOf(const char *name, std::size_t n);
+
+			static const char *CommandName(Command command);
+
+			void RecordReply(Command command, std::chrono::microseconds rtt)
+			{
+				_replies[command].Record(rtt.count());
+			}
+
+			void RecordFirstByte(std::chrono::microseconds elapsed)
+			{
+				_firstByte.Record(elapsed.count());
+			}
+
+			void AddBytes(bool upload, std::size_t n)
+			{
+				(upload ? _bytesSent : _bytesReceived).fetch_add(n, std::memory_order_relaxed);
+			}
+
+			void AddWait(std::chrono::nanoseconds disk, std::chrono::nanoseconds network)
+			{
+				_diskWaitNanos.fetch_add(disk.count(), std::memory_order_relaxed);
+				_networkWaitNanos.fetch_add(network.count(), std::memory_order_relaxed);
+			}
+
+			void TransferStarted()
+			{
+				_transfersStarted.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void TransferEnded(bool interrupted, bool failed);
+
+			void AddRetry()
+			{
+				_retries.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			Snapshot Snap();
+
+			/* The snapshot in the Prometheus text exposition format */
+			std::string Prometheus();
+
+			/* Write Prometheus() to path, through a file renamed over it */
+			int Export(const std::string &path);
+
+			/*
+			 * Answer every connection to 127.0.0.1:port with Prometheus()
+			 * over HTTP, from a thread of its own, until StopServing().
+			 * POSIX only.
+			 */
+			int Serve(int port);
+
+			void StopServing();
+
+			std::string GetErrorDesc()
+			{
+				std::lock_guard<std::mutex> lk(_mt);
+				return _errorMessage;
+			}
+
+			~Metrics()
+			{
+				StopServing();
+			}
+
+		private:
+			void Accept();
+
+			Histogram	_replies[CommandCount];
+			Histogram	_firstByte;
+			std::atomic<uint64_t> _bytesReceived{0};
+			std::atomic<uint64_t> _bytesSent{0};
+			std::atomic<uint64_t> _transfersStarted{0};
+			std::atomic<uint64_t> _transfersDone{0};
+			std::atomic<uint64_t> _transfersFailed{0};
+			std::atomic<uint64_t> _transfersInterrupted{0};
+			std::atomic<uint64_t> _retries{0};
+			std::atomic<uint64_t> _diskWaitNanos{0};
+			std::atomic<uint64_t> _networkWaitNanos{0};
+
+			std::mutex	_mt;
+			std::string _errorMessage;
+			/* the throughput between snapshots */
+			uint64_t	_lastBytes = 0;
+			std::chrono::steady_clock::time_point _lastSnap;
+			bool		_snapped = false;
+			double		_averageThroughput = 0;
+			int			_listen = -1;
+			std::thread _server;
+	};
+
+}	/* namespace Rainbow */
+
+#endif //FLSTATS_H
@@ -6,9 +6,30 @@
  **************************************************************/
 
 #include "flFTP.h"
+#include "flJournal.h"
+#include "flHash.h"
+#include "flList.h"
+#include "flCache.h"
+#include "flRate.h"
+#include "flStats.h"
+#include "flQueue.h"
+#include "flReactor.h"
 #include <string>
+#include <cstring>
+#include <cstdio>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <random>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#ifndef _WIN32
+#include "flServer.h"
+#include <ftw.h>
+#include <sys/stat.h>
+#endif
 
 using Rainbow::IProgress;
 
@@ -51,7 +72,8 @@ Rainbow::flFTP test(Progress &p)
 }
 
 
-int main()
+/* Download ls-lR.gz from a public mirror, showing the progress */
+static int Demo()
 {
 	//int sd = Rainbow::connectsock("mirrors.ustc.edu.cn", "ftp", "tcp");
 	Progress p;
@@ -63,6 +85,1519 @@ int main()
 	}
 	p.ShowProgress();
 	std::cout<<"\n";
-	
+
 	return 0;
 }
+
+
+#ifndef _WIN32
+
+/*
+ * The checks below need nothing but the local machine; each case
+ * counts what fails and goes on, so one run shows every failure.
+ */
+static int failures = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			++failures; \
+		} \
+	}while(0)
+
+
+/* name under a directory of this run, removed when it ends */
+static std::string Scratch(const std::string &name)
+{
+	static std::string dir;
+	if(dir.empty())
+	{
+		char path[] = "/tmp/flTest.XXXXXX";
+		if(!mkdtemp(path))
+		{
+			perror("mkdtemp");
+			exit(1);
+		}
+		dir = path;
+	}
+	return name.empty() ? dir : dir + '/' + name;
+}
+
+
+static void RemoveScratch()
+{
+	nftw(Scratch("").c_str(),
+			[](const char *path, const struct stat *, int, struct FTW *){ return remove(path); },
+			16, FTW_DEPTH | FTW_PHYS);
+}
+
+
+static std::size_t FileSize(const std::string &path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : (std::size_t)-1;
+}
+
+
+static Rainbow::TransferInfo Breakpoint(const std::string &filename, std::size_t offset)
+{
+	Rainbow::TransferInfo info;
+	info.transferMode = Rainbow::TransferInfo::Download;
+	info.host = "127.0.0.1";
+	info.serverPath = "/pub";
+	info.localPath = "/tmp";
+	info.filename = filename;
+	info.offset = offset;
+	return info;
+}
+
+
+/* A crash mid-append leaves part of a record, which Open() must drop */
+static void TestJournalTornTail()
+{
+	const std::string path = Scratch("torn.journal");
+	std::size_t intact = 0, whole = 0;
+	{
+		Rainbow::BreakJournal journal;
+		CHECK(journal.Open(path) == 0);
+		journal.Put(Breakpoint("a", 100));
+		journal.Put(Breakpoint("b", 200));
+		journal.Put(Breakpoint("a", 150));
+		intact = FileSize(path);
+		journal.Put(Breakpoint("c", 300));
+		whole = FileSize(path);
+		CHECK(journal.Close() == 0);
+	}
+
+	/* cut within the body of the last record, then within its header */
+	for(std::size_t cut : {whole - intact - 3, (std::size_t)5})
+	{
+		CHECK(truncate(path.c_str(), intact + cut) == 0);
+		Rainbow::BreakJournal journal;
+		CHECK(journal.Open(path) == 0);
+		CHECK(FileSize(path) == intact);
+		CHECK(journal.Size() == 2);
+		CHECK(journal.Get(Breakpoint("a", 0)) == 150);
+		CHECK(journal.Get(Breakpoint("b", 0)) == 200);
+		CHECK(journal.Get(Breakpoint("c", 0)) == 0);
+
+		/* what comes after the cut replays too */
+		journal.Put(Breakpoint("c", 300));
+		CHECK(journal.Close() == 0);
+		CHECK(FileSize(path) == whole);
+		CHECK(journal.Open(path) == 0);
+		CHECK(journal.Size() == 3);
+		CHECK(journal.Get(Breakpoint("c", 0)) == 300);
+	}
+}
+
+
+static void TestJournalCompact()
+{
+	const std::string path = Scratch("compact.journal");
+	Rainbow::BreakJournal journal;
+	CHECK(journal.Open(path) == 0);
+	for(int i = 0; i < 100; ++i)
+		journal.Put(Breakpoint("file" + std::to_string(i % 10), i));
+	for(int i = 0; i < 5; ++i)
+		journal.Delete(Breakpoint("file" + std::to_string(i), 0));
+	std::size_t before = FileSize(path);
+
+	CHECK(journal.Compact() == 0);
+	CHECK(FileSize(path) < before);
+	CHECK(FileSize(path + ".tmp") == (std::size_t)-1);
+	/* the log is open again after the rename */
+	journal.Put(Breakpoint("file9", 1000));
+	CHECK(journal.Close() == 0);
+
+	CHECK(journal.Open(path) == 0);
+	CHECK(journal.Size() == 5);
+	for(int i = 0; i < 5; ++i)
+		CHECK(journal.Get(Breakpoint("file" + std::to_string(i), 0)) == 0);
+	for(int i = 5; i < 9; ++i)
+		CHECK(journal.Get(Breakpoint("file" + std::to_string(i), 0)) == (std::size_t)(90 + i));
+	CHECK(journal.Get(Breakpoint("file9", 0)) == 1000);
+
+	/* dead records outweighing live ones past 1MB compact on their own */
+	for(int i = 0; i < 20000; ++i)
+		journal.Put(Breakpoint("file0", i));
+	CHECK(FileSize(path) < 1 << 20);
+	CHECK(journal.Close() == 0);
+	CHECK(journal.Open(path) == 0);
+	CHECK(journal.Size() == 6);
+	CHECK(journal.Get(Breakpoint("file0", 0)) == 19999);
+	CHECK(journal.Get(Breakpoint("file9", 0)) == 1000);
+}
+
+
+/* i % 251 for byte i, as LoopbackServer::Content() */
+static std::string Pattern(std::size_t n)
+{
+	std::string data(n, '\0');
+	for(std::size_t i = 0; i < n; ++i)
+		data[i] = (char)(i % 251);
+	return data;
+}
+
+
+/* The digest of data handed to Update() piece bytes at a time, all at once if 0 */
+static std::string Digest(Rainbow::HashAlgorithm algorithm, const std::string &data,
+		std::size_t piece = 0)
+{
+	std::unique_ptr<Rainbow::Hash> hash = Rainbow::MakeHash(algorithm);
+	if(piece == 0)
+		piece = data.size();
+	for(std::size_t i = 0; i < data.size(); i += piece)
+		hash->Update(data.data() + i, std::min(piece, data.size() - i));
+	return hash->HexDigest();
+}
+
+
+static void TestHashKnownAnswers()
+{
+	using namespace Rainbow;
+	struct Vector
+	{
+		HashAlgorithm algorithm;
+		std::string data;
+		const char *digest;
+	};
+	const Vector vectors[] = {
+		{HashCrc32, "123456789", "CBF43926"},
+		{HashMd5, "", "D41D8CD98F00B204E9800998ECF8427E"},
+		{HashMd5, "abc", "900150983CD24FB0D6963F7D28E17F72"},
+		{HashCrc32c, "123456789", "E3069283"},
+		{HashCrc32c, Pattern(1000), "11F66220"},
+		{HashXxh64, "", "EF46DB3751D8E999"},
+		{HashXxh64, "abc", "44BC2CF5AD770999"},
+		{HashXxh64, Pattern(1000), "F306F04AA88B54D3"},
+		{HashSha256, "", "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"},
+		{HashSha256, "abc", "BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD"},
+		{HashSha256, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"248D6A61D20638B8E5C026930C3E6039A33CE45964FF2167F6ECEDD419DB06C1"},
+		{HashSha256, std::string(1000000, 'a'),
+			"CDC76E5C9914FB9281A1C7E284D73E67F1809A48A497200E046D39CCC7112CD0"},
+		{HashSha256, Pattern(1000), "4E4C294B331F7A2099A379BEC34B9F9FC03DC46AB465D998F4D683DA53487E6D"},
+	};
+	for(auto &vector : vectors)
+	{
+		CHECK(Digest(vector.algorithm, vector.data) == vector.digest);
+		/* pieces that split the blocks, stripes and SIMD lanes every way */
+		if(vector.data.size() == 1000)
+			for(std::size_t piece : {1, 3, 7, 8, 15, 16, 31, 32, 33, 63, 64, 65, 999})
+				CHECK(Digest(vector.algorithm, vector.data, piece) == vector.digest);
+	}
+}
+
+
+/* CRLF to LF over the whole stream, a byte at a time */
+static std::string LocalText(const std::string &wire)
+{
+	std::string text;
+	for(std::size_t i = 0; i < wire.size(); ++i)
+		if(!(wire[i] == '\r' && i + 1 < wire.size() && wire[i + 1] == '\n'))
+			text += wire[i];
+	return text;
+}
+
+
+/* wire through Rainbow::ToLocalText() in buffers cut at cuts */
+static std::string ToLocalText(const std::string &wire, const std::vector<std::size_t> &cuts)
+{
+	std::string text;
+	bool pendingCR = false;
+	std::size_t begin = 0;
+	for(std::size_t i = 0; i <= cuts.size(); ++i)
+	{
+		std::size_t end = (i < cuts.size()) ? cuts[i] : wire.size();
+		/* the spare byte it may need, filled with junk */
+		std::vector<char> buffer(wire.begin() + begin, wire.begin() + end);
+		buffer.push_back('#');
+		std::size_t n = Rainbow::ToLocalText(buffer.data(), end - begin, pendingCR);
+		text.append(buffer.data(), n);
+		begin = end;
+	}
+	/* what FinishRecv() does with a CR left over */
+	if(pendingCR)
+		text += '\r';
+	return text;
+}
+
+
+static void TestLocalText()
+{
+	struct Case
+	{
+		std::string wire;
+		std::vector<std::size_t> cuts;
+	};
+	const Case cases[] = {
+		{"a\r\nb\r\n", {}},
+		{"line\r", {}},							/* a CR ends the stream */
+		{"line\r\n", {5}},						/* CRLF split between buffers */
+		{"a\rb", {}},								/* a lone CR */
+		{"a\rb", {2}},								/* held back, then put back */
+		{"a\r\r\nb", {2, 3}},					/* CR, CR then LF, each alone */
+		{"\r\r\r", {1, 2}},
+		{"\n\r\n\r", {1, 3}},
+		{"0123456789abcde\r\n0123456789abcdef\r\nxyz", {}},		/* at the 16 byte blocks */
+		{"0123456789abcdef0123456789abcde\r", {16}},
+		{"0123456789abcdef0123456789abcdef\r\n", {32}},
+		{"", {}},
+	};
+	for(auto &test : cases)
+		CHECK(ToLocalText(test.wire, test.cuts) == LocalText(test.wire));
+
+	/* streams thick with CR and LF, cut anywhere, empty buffers too */
+	std::mt19937 random(14);
+	for(int round = 0; round < 2000; ++round)
+	{
+		std::string wire(random() % 200, '\0');
+		for(auto &c : wire)
+			c = "\r\nab"[random() % 4];
+		std::vector<std::size_t> cuts(random() % 6);
+		for(auto &cut : cuts)
+			cut = wire.empty() ? 0 : random() % (wire.size() + 1);
+		std::sort(cuts.begin(), cuts.end());
+		std::string text = ToLocalText(wire, cuts);
+		CHECK(text == LocalText(wire));
+		if(text != LocalText(wire))
+			break;
+	}
+}
+
+
+struct Entry
+{
+	std::string name;
+	Rainbow::ListEntry::Type type;
+	int64_t size;
+	int64_t mtime;
+
+	bool operator==(const Entry &rhs) const
+	{
+		return name == rhs.name && type == rhs.type && size == rhs.size && mtime == rhs.mtime;
+	}
+};
+
+
+/* The entries of listing fed to a ListParser piece bytes at a time, all at once if 0 */
+static std::vector<Entry> ParseListing(bool mlsd, const std::string &listing, std::size_t piece = 0)
+{
+	std::vector<Entry> entries;
+	Rainbow::ListParser parser(mlsd, [&entries](const Rainbow::ListEntry &entry)
+		{
+			entries.push_back(Entry{entry.Name(), entry.type, entry.size, entry.mtime});
+		});
+	if(piece == 0)
+		piece = listing.size();
+	for(std::size_t i = 0; i < listing.size(); i += piece)
+		parser.Feed(listing.data() + i, std::min(piece, listing.size() - i));
+	parser.Finish();
+	return entries;
+}
+
+
+static void TestListParser()
+{
+	using Rainbow::ListEntry;
+	struct Case
+	{
+		bool mlsd;
+		std::string listing;
+		std::vector<Entry> entries;
+	};
+	const Case cases[] = {
+		{true,
+			"type=cdir;modify=20240101000000; .\r\n"
+			"type=pdir;modify=20240101000000; ..\r\n"
+			"type=file;size=1234;modify=20240131120000; a file.txt\r\n"
+			"Type=DIR;Sizd=4096;Modify=20230615083010.123; sub\r\n"
+			"type=OS.unix=slink:/etc;modify=20240101000000; link\r\n"
+			"type=file;perm=r; unsized",							/* no newline at the end */
+			{
+				{"a file.txt", ListEntry::File, 1234, 1706702400},
+				{"sub", ListEntry::Directory, 4096, 1686817810},
+				{"link", ListEntry::Link, -1, 1704067200},
+				{"unsized", ListEntry::File, -1, -1},
+			}},
+		{false,
+			"total 42\r\n"
+			"drwxr-xr-x   2 1001     1001         4096 Jan 31  2023 .\r\n"
+			"drwxr-xr-x   2 0        0            4096 Jan 31  2023 ..\r\n"
+			"-rw-r--r--   1 1001     100        123456 Mar  5  2022 data.bin\r\n"
+			"lrwxrwxrwx   1 0        0              11 Feb 29  2020 latest -> data.bin\r\n"
+			"drwxr-xr-x   3 ftp           4096 Jul  4  2021 no group\n",
+			{
+				{"data.bin", ListEntry::File, 123456, 1646438400},
+				{"latest", ListEntry::Link, 11, 1582934400},
+				{"no group", ListEntry::Directory, 4096, 1625356800},
+			}},
+		{false,
+			"01-31-24  12:00PM       <DIR>          Program Files\r\n"
+			"02-29-2000  01:05AM               1024 boot.ini\r\n"
+			"12-31-99  11:59PM                  0 y2k.txt\r\n"
+			"06-01-24  13:45                   77 24h.log\r\n",
+			{
+				{"Program Files", ListEntry::Directory, -1, 1706702400},
+				{"boot.ini", ListEntry::File, 1024, 951786300},
+				{"y2k.txt", ListEntry::File, 0, 946684740},
+				{"24h.log", ListEntry::File, 77, 1717249500},
+			}},
+	};
+	for(auto &test : cases)
+		for(std::size_t piece : {0, 1, 7, 64})
+			CHECK(ParseListing(test.mlsd, test.listing, piece) == test.entries);
+
+	/* a time instead of a year is within six months before now */
+	const time_t now = 1717200000;		/* 2024-06-01 */
+	ListEntry entry;
+	const std::string recent = "-rw-r--r-- 1 ftp ftp 7 May 30 10:00 recent";
+	CHECK(Rainbow::ListParser::ParseUnix(recent.data(), recent.size(), now, entry));
+	CHECK(entry.mtime == 1717063200);
+	const std::string lastYear = "-rw-r--r-- 1 ftp ftp 7 Dec 24 23:59  last year";
+	CHECK(Rainbow::ListParser::ParseUnix(lastYear.data(), lastYear.size(), now, entry));
+	CHECK(entry.mtime == 1703462340);
+	CHECK(entry.Name() == " last year");
+}
+
+
+/* The exact time cache has for a file of dir listed with size and time */
+static int64_t CachedTime(const Rainbow::MirrorCache &cache, const std::string &dir,
+		const std::string &name, int64_t size, int64_t listedTime)
+{
+	Rainbow::ListEntry entry;
+	entry.name = name.data();
+	entry.nameLength = name.size();
+	entry.type = Rainbow::ListEntry::File;
+	entry.size = size;
+	entry.mtime = listedTime;
+	return cache.Time(dir, entry);
+}
+
+
+static void TestMirrorCache()
+{
+	using Rainbow::MirrorCache;
+	const std::string path = Scratch("mirror.cache");
+	uint64_t hash = 0;
+	{
+		MirrorCache cache;
+		CHECK(cache.Open(path) == 0);
+		CHECK(cache.Size() == 0);
+		/* given out of order, looked up by binary search once saved */
+		cache.Put("/pub", 111, {{"zeta", 3, 300, 301}, {"alpha", 10, 100, 105}, {"beta", 20, 200, -1}});
+		cache.Put("/pub/sub", 222, {});
+		cache.Put("/other", 333, {{"x", 1, 1, 2}});
+		CHECK(cache.Save("/") == 0);
+		CHECK(FileSize(path + ".tmp") == (std::size_t)-1);
+	}
+	{
+		MirrorCache cache;
+		CHECK(cache.Open(path) == 0);
+		CHECK(cache.Size() == 3);
+		CHECK(cache.Find("/pub", hash) && hash == 111);
+		CHECK(cache.Find("/pub/sub", hash) && hash == 222);
+		CHECK(cache.Find("/other", hash) && hash == 333);
+		CHECK(!cache.Find("/pu", hash) && !cache.Find("/pub/", hash));
+		CHECK(CachedTime(cache, "/pub", "alpha", 10, 100) == 105);
+		CHECK(CachedTime(cache, "/pub", "zeta", 3, 300) == 301);
+		CHECK(CachedTime(cache, "/pub", "beta", 20, 200) == -1);
+		/* a change of size or listed time, or an unknown name, is not the cached file */
+		CHECK(CachedTime(cache, "/pub", "alpha", 11, 100) == -1);
+		CHECK(CachedTime(cache, "/pub", "alpha", 10, 160) == -1);
+		CHECK(CachedTime(cache, "/pub", "gamma", 10, 100) == -1);
+		CHECK(CachedTime(cache, "/other", "x", 1, 1) == 2);
+
+		/* a run under /pub: what it neither kept nor put there goes */
+		cache.Keep("/pub");
+		cache.Put("/pub/new", 444, {{"n", 5, 50, 55}});
+		CHECK(cache.Save("/pub") == 0);
+		/* and the saved file is mapped again at once */
+		CHECK(cache.Size() == 3);
+	}
+	{
+		MirrorCache cache;
+		CHECK(cache.Open(path) == 0);
+		CHECK(cache.Size() == 3);
+		CHECK(cache.Find("/pub", hash) && hash == 111);
+		CHECK(CachedTime(cache, "/pub", "alpha", 10, 100) == 105);
+		CHECK(!cache.Find("/pub/sub", hash));
+		CHECK(cache.Find("/pub/new", hash) && hash == 444);
+		CHECK(CachedTime(cache, "/pub/new", "n", 5, 50) == 55);
+		CHECK(cache.Find("/other", hash) && hash == 333);
+	}
+
+	/* a damaged file is an empty cache, which Save() replaces */
+	CHECK(truncate(path.c_str(), FileSize(path) - 1) == 0);
+	MirrorCache cache;
+	CHECK(cache.Open(path) == 0);
+	CHECK(cache.Size() == 0);
+	cache.Put("/pub", 555, {});
+	CHECK(cache.Save("/") == 0);
+	CHECK(cache.Find("/pub", hash) && hash == 555);
+}
+
+
+struct Reply
+{
+	int code;
+	std::string text;
+
+	bool operator==(const Reply &rhs) const
+	{
+		return code == rhs.code && text == rhs.text;
+	}
+};
+
+
+/*
+ * The replies a ReplyBuffer gives for reads arriving as they are, each
+ * drained before the next, and how many were whole before the last read
+ */
+static std::vector<Reply> ReadReplies(const std::vector<std::string> &reads,
+		std::size_t &beforeLast)
+{
+	Rainbow::ReplyBuffer buffer;
+	std::vector<Reply> replies;
+	beforeLast = 0;
+	for(auto &read : reads)
+	{
+		beforeLast = replies.size();
+		/* what CommPort::FillReply() asks for at least */
+		char *space = buffer.Space(std::max<std::size_t>(read.size(), 4096));
+		if(!space)
+			break;
+		memcpy(space, read.data(), read.size());
+		buffer.Commit(read.size());
+		const char *reply;
+		std::size_t length;
+		int code;
+		while(buffer.Next(reply, length, code))
+		{
+			replies.push_back(Reply{code, std::string(reply, length)});
+			buffer.Consume();
+		}
+	}
+	return replies;
+}
+
+
+static void TestReplyBuffer()
+{
+	const std::string longLine = "150 " + std::string(10000, 'x') + "\r\n";
+	struct Case
+	{
+		std::vector<std::string> reads;
+		std::vector<Reply> replies;
+		std::size_t beforeLast;			/* whole before the last read arrived */
+	};
+	const Case cases[] = {
+		{{"220 ready\r\n"}, {{220, "220 ready\r\n"}}, 0},
+		/* a multi-line reply ends on its code and a space, not on another code */
+		{{"123-first\r\n second\r\n200 inner\r\n123-more\r\n123 last\r\n"},
+			{{123, "123-first\r\n second\r\n200 inner\r\n123-more\r\n123 last\r\n"}}, 0},
+		{{"211-Features\r\n MLSD\r\n211\r\n"}, {{211, "211-Features\r\n MLSD\r\n211\r\n"}}, 0},
+		/* split within a line, and within the code of the last line */
+		{{"220 Serv", "ice ready\r\n"}, {{220, "220 Service ready\r\n"}}, 0},
+		{{"211-a\r\n21", "1 end\r\n"}, {{211, "211-a\r\n211 end\r\n"}}, 0},
+		{{"211-a\r\n211", " end\r\n"}, {{211, "211-a\r\n211 end\r\n"}}, 0},
+		/* several in one read, the last of them cut short */
+		{{"331 user ok\r\n230 logged in\r\n200 ok\r\n"},
+			{{331, "331 user ok\r\n"}, {230, "230 logged in\r\n"}, {200, "200 ok\r\n"}}, 0},
+		{{"350 rest\r\n213 12\r\n150 op", "ening\r\n"},
+			{{350, "350 rest\r\n"}, {213, "213 12\r\n"}, {150, "150 opening\r\n"}}, 2},
+		/* CRLF split across reads, a bare LF ends a line too */
+		{{"226 done\r", "\n"}, {{226, "226 done\r\n"}}, 0},
+		{{"226 done\r", "\n250 ok\n"}, {{226, "226 done\r\n"}, {250, "250 ok\n"}}, 0},
+		/* a line without a code is a reply of its own */
+		{{"hello\r\n200 ok\r\n"}, {{-1, "hello\r\n"}, {200, "200 ok\r\n"}}, 0},
+		/* longer than a read, and than the buffer first allocated */
+		{{longLine.substr(0, 4096), longLine.substr(4096, 4096), longLine.substr(8192)},
+			{{150, longLine}}, 0},
+		{{"200 a\r\n" + longLine.substr(0, 5000), longLine.substr(5000) + "226 b\r\n"},
+			{{200, "200 a\r\n"}, {150, longLine}, {226, "226 b\r\n"}}, 1},
+	};
+	for(auto &test : cases)
+	{
+		std::size_t beforeLast;
+		CHECK(ReadReplies(test.reads, beforeLast) == test.replies);
+		CHECK(beforeLast == test.beforeLast);
+
+		/* the same bytes a byte at a time */
+		std::string all;
+		for(auto &read : test.reads)
+			all += read;
+		std::vector<std::string> bytes;
+		for(char c : all)
+			bytes.push_back(std::string(1, c));
+		CHECK(ReadReplies(bytes, beforeLast) == test.replies);
+	}
+
+	/* a reply that never ends is refused at the first growth past MaxReply */
+	Rainbow::ReplyBuffer buffer;
+	const std::string line = "200-" + std::string(1000, 'y') + "\r\n";
+	std::size_t received = 0;
+	char *space;
+	while((space = buffer.Space(line.size())) != nullptr &&
+			received <= 2 * Rainbow::ReplyBuffer::MaxReply)
+	{
+		memcpy(space, line.data(), line.size());
+		buffer.Commit(line.size());
+		received += line.size();
+		const char *reply;
+		std::size_t length;
+		int code;
+		CHECK(!buffer.Next(reply, length, code));
+	}
+	CHECK(space == nullptr);
+	CHECK(received > Rainbow::ReplyBuffer::MaxReply);
+	CHECK(received < 2 * Rainbow::ReplyBuffer::MaxReply);
+}
+
+
+static std::chrono::steady_clock::time_point fakeNow;
+
+static std::chrono::steady_clock::time_point FakeClock()
+{
+	return fakeNow;
+}
+
+
+static void Advance(std::chrono::nanoseconds elapsed)
+{
+	fakeNow += std::chrono::duration_cast<std::chrono::steady_clock::duration>(elapsed);
+}
+
+
+/* Whether delay is expected to within a microsecond */
+static bool Near(std::chrono::nanoseconds delay, std::chrono::microseconds expected)
+{
+	return std::abs((delay - expected).count()) < 1000;
+}
+
+
+/* Seconds on the fake clock to move total through limiter, a quantum at a time */
+static double Transfer(Rainbow::RateLimiter &limiter, std::size_t total)
+{
+	auto start = fakeNow;
+	for(std::size_t moved = 0; moved < total; )
+	{
+		std::size_t n = limiter.Quantum(std::min<std::size_t>(total - moved, 1 << 20));
+		limiter.Consume(n);
+		moved += n;
+		/* what Wait() sleeps, in as many turns as it takes */
+		Advance(limiter.Delay());
+	}
+	return std::chrono::duration<double>(fakeNow - start).count();
+}
+
+
+static void TestRateLimiter()
+{
+	using Rainbow::RateLimiter;
+	using std::chrono::milliseconds;
+	using std::chrono::microseconds;
+
+	RateLimiter bucket(1000000);
+	bucket.SetClock(FakeClock);
+	CHECK(bucket.Limited());
+	CHECK(bucket.Delay().count() == 0);
+	/* in debt for what went through, paid back as time passes */
+	bucket.Consume(100000);
+	CHECK(Near(bucket.Delay(), milliseconds(100)));
+	Advance(milliseconds(40));
+	CHECK(Near(bucket.Delay(), milliseconds(60)));
+	Advance(milliseconds(60));
+	CHECK(Near(bucket.Delay(), microseconds(0)));
+
+	/* idle for long, it saves up no more than Burst */
+	Advance(std::chrono::seconds(10));
+	bucket.Consume(100000);
+	CHECK(Near(bucket.Delay(), microseconds(0)));
+	bucket.Consume(50000);
+	CHECK(Near(bucket.Delay(), milliseconds(50)));
+
+	/* a lower rate drops the savings beyond its burst, at once */
+	Advance(milliseconds(150));
+	bucket.SetRate(100000);
+	bucket.Consume(20000);
+	CHECK(Near(bucket.Delay(), milliseconds(100)));
+
+	/* a quantum is a slice of the rate, but no less than 16KB */
+	bucket.SetRate(1000000);
+	CHECK(bucket.Quantum(1 << 20) == 20000);
+	CHECK(bucket.Quantum(100) == 100);
+	bucket.SetRate(100000);
+	CHECK(bucket.Quantum(1 << 20) == 16 * 1024);
+	bucket.SetRate(0);
+	CHECK(!bucket.Limited());
+	CHECK(bucket.Quantum(1 << 20) == 1 << 20);
+	bucket.Consume(1 << 20);
+	CHECK(bucket.Delay().count() == 0);
+
+	/* a transfer holds the rate */
+	bucket.SetRate(5000000);
+	double seconds = Transfer(bucket, 50000000);
+	CHECK(seconds > 9.9 && seconds < 10.1);
+
+	/* under a slower parent it holds the parent's, which the child's quantum follows */
+	RateLimiter parent(2000000);
+	parent.SetClock(FakeClock);
+	RateLimiter child(8000000, &parent);
+	child.SetClock(FakeClock);
+	CHECK(child.Quantum(1 << 20) == 40000);
+	seconds = Transfer(child, 20000000);
+	CHECK(seconds > 9.9 && seconds < 10.1);
+	/* and a child without a rate of its own is limited all the same */
+	child.SetRate(0);
+	CHECK(child.Limited());
+	seconds = Transfer(child, 2000000);
+	CHECK(seconds > 0.9 && seconds < 1.1);
+	/* two children share the parent's rate */
+	RateLimiter sibling(0, &parent);
+	sibling.SetClock(FakeClock);
+	auto start = fakeNow;
+	for(int i = 0; i < 500; ++i)
+	{
+		for(RateLimiter *transfer : {&child, &sibling})
+			transfer->Consume(transfer->Quantum(1 << 20));
+		Advance(std::max(child.Delay(), sibling.Delay()));
+	}
+	seconds = std::chrono::duration<double>(fakeNow - start).count();
+	CHECK(seconds > 0.99 * 500 * 2 * 40000 / 2000000 && seconds < 1.01 * 500 * 2 * 40000 / 2000000);
+}
+
+
+static void TestHistogram()
+{
+	using namespace Rainbow;
+	/* one bucket a value up to 7, then eight to each power of two */
+	CHECK(Histogram::BucketOf(0) == 0 && Histogram::BucketUpper(0) == 0);
+	CHECK(Histogram::BucketOf(7) == 7 && Histogram::BucketUpper(7) == 7);
+	CHECK(Histogram::BucketOf(8) == 8 && Histogram::BucketUpper(8) == 8);
+	CHECK(Histogram::BucketOf(9) == 9);
+	CHECK(Histogram::BucketOf(16) == 16 && Histogram::BucketOf(17) == 16);
+	CHECK(Histogram::BucketUpper(16) == 17);
+	for(int exponent = 3; exponent < 40; ++exponent)
+	{
+		uint64_t power = (uint64_t)1 << exponent;
+		CHECK(Histogram::BucketOf(power) == (std::size_t)(exponent - 2) * 8);
+		CHECK(Histogram::BucketOf(power - 1) == (std::size_t)(exponent - 2) * 8 - 1);
+	}
+	const std::size_t last = Histogram::Buckets - 1;
+	CHECK(Histogram::BucketOf((uint64_t)1 << 40) == last);
+	CHECK(Histogram::BucketOf(UINT64_MAX) == last);
+	CHECK(Histogram::BucketUpper(last) == UINT64_MAX);
+	for(std::size_t bucket = 0; bucket < last; ++bucket)
+	{
+		uint64_t upper = Histogram::BucketUpper(bucket);
+		CHECK(Histogram::BucketOf(upper) == bucket && Histogram::BucketOf(upper + 1) == bucket + 1);
+	}
+
+	/* quantiles of 1..1000 are the upper bounds of their buckets */
+	Histogram histogram;
+	CHECK(histogram.Snap().Percentile(0.5) == 0);
+	for(uint64_t value = 1; value <= 1000; ++value)
+		histogram.Record(value);
+	Histogram::Snapshot snapshot = histogram.Snap();
+	CHECK(snapshot.count == 1000 && snapshot.sum == 500500);
+	CHECK(snapshot.Percentile(0) == 1);
+	CHECK(snapshot.Percentile(0.5) == Histogram::BucketUpper(Histogram::BucketOf(500)));
+	CHECK(snapshot.Percentile(0.5) == 511);
+	CHECK(snapshot.Percentile(0.99) == Histogram::BucketUpper(Histogram::BucketOf(990)));
+	CHECK(snapshot.Max() == Histogram::BucketUpper(Histogram::BucketOf(1000)));
+	histogram.Record(UINT64_MAX);
+	CHECK(histogram.Snap().Max() == UINT64_MAX);
+
+	/* command names match whole and in any case */
+	CHECK(Metrics::CommandOf("RETR", 4) == Metrics::Retr);
+	CHECK(Metrics::CommandOf("retr /f", 4) == Metrics::Retr);
+	CHECK(Metrics::CommandOf("RET", 3) == Metrics::Other);
+	CHECK(Metrics::CommandOf("RETRX", 5) == Metrics::Other);
+	CHECK(Metrics::CommandOf("", 0) == Metrics::Other);
+	for(int i = 0; i < Metrics::Other; ++i)
+	{
+		const char *name = Metrics::CommandName((Metrics::Command)i);
+		CHECK(Metrics::CommandOf(name, strlen(name)) == i);
+	}
+}
+
+
+/* A directory under the scratch one, made if need be, with a slash at the end */
+static std::string ScratchDir(const std::string &name)
+{
+	std::string dir = Scratch(name);
+	mkdir(dir.c_str(), 0755);
+	return dir + '/';
+}
+
+
+/* Whether path holds the first size bytes of every LoopbackServer file */
+static bool SameContent(const std::string &path, std::size_t size)
+{
+	if(FileSize(path) != size)
+		return false;
+	std::string local(size, '\0'), remote(size, '\0');
+	FILE *file = fopen(path.c_str(), "rb");
+	if(!file)
+		return false;
+	bool read = fread(&local[0], 1, size, file) == size;
+	fclose(file);
+	Rainbow::LoopbackServer::Content(0, &remote[0], size);
+	return read && local == remote;
+}
+
+
+/* Write the first size bytes of every LoopbackServer file to path */
+static bool WriteContent(const std::string &path, std::size_t size)
+{
+	std::string data(size, '\0');
+	Rainbow::LoopbackServer::Content(0, &data[0], size);
+	FILE *file = fopen(path.c_str(), "wb");
+	if(!file)
+		return false;
+	bool written = fwrite(data.data(), 1, size, file) == size;
+	return fclose(file) == 0 && written;
+}
+
+
+static bool Login(Rainbow::flFTP &ftp, const Rainbow::LoopbackServer &server)
+{
+	return ftp.Connection("127.0.0.1", server.Port()) == 0 && ftp.AnonymousLogin() == 0 &&
+		ftp.SetTransferType(Rainbow::flFTP::Binary) == 0;
+}
+
+
+/* Breakpoints kept in memory by file name, for sessions on any thread */
+class BreakPoints
+{
+	public:
+		/* Have target, a flFTP or TransferQueue, keep its breakpoints here */
+		template <typename T>
+		void Attach(T &target)
+		{
+			target.SetBreakRecordMethod(
+				[this](const Rainbow::TransferInfo &info)
+				{
+					std::lock_guard<std::mutex> lk(_mt);
+					auto search = _offsets.find(info.filename);
+					return search == _offsets.end() ? (std::size_t)0 : search->second;
+				},
+				[this](const Rainbow::TransferInfo &info)
+				{
+					std::lock_guard<std::mutex> lk(_mt);
+					_offsets[info.filename] = info.offset;
+				},
+				[this](const Rainbow::TransferInfo &info)
+				{
+					std::lock_guard<std::mutex> lk(_mt);
+					_offsets.erase(info.filename);
+				});
+		}
+
+		void Put(const std::string &filename, std::size_t offset)
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_offsets[filename] = offset;
+		}
+
+		/* -1 if there is none */
+		std::size_t Get(const std::string &filename)
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			auto search = _offsets.find(filename);
+			return search == _offsets.end() ? (std::size_t)-1 : search->second;
+		}
+
+	private:
+		std::mutex _mt;
+		std::map<std::string, std::size_t> _offsets;
+};
+
+
+static void TestPipelineFallback()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	for(int i = 0; i < 3; ++i)
+		server.AddFile("/pipe/f" + std::to_string(i), 100000 + i);
+	const std::string dir = ScratchDir("pipe");
+
+	/* a resume sends REST last, which a strict server needs right before RETR */
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/pipe") == 0);
+	ftp.SetPipelining(true, std::chrono::seconds(5));
+	CHECK(WriteContent(dir + "f0", 40000));
+	points.Put("f0", 40000);
+	server.ResetStats();
+	CHECK(ftp.Download("f0", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.GetStats().bytesSent == 100000 - 40000);
+	CHECK(SameContent(dir + "f0", 100000));
+	CHECK(ftp.GetTransferStats().retries == 0);
+
+	/* a server that drops commands sent ahead has them sent again one by one */
+	server.SetDropPipelined(true);
+	ftp.SetPipelining(true, std::chrono::milliseconds(200));
+	for(int i = 1; i < 3; ++i)
+	{
+		std::string name = "f" + std::to_string(i);
+		CHECK(ftp.Download(name, dir) == 0);
+		CHECK(ftp.Wait() == TransferState::Done);
+		CHECK(SameContent(dir + name, 100000 + i));
+		/* once is enough, the session no longer pipelines */
+		CHECK(ftp.GetTransferStats().retries == (i == 1 ? 1u : 0u));
+	}
+	CHECK(ftp.Noop() == 0);
+}
+
+
+static void TestMlsdFallback()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/list/a file", 10);
+	server.AddFile("/list/sub/b", 20);
+
+	/* the names and types of path's entries, sorted, and the sizes of files */
+	auto list = [&server](const std::string &path)
+	{
+		std::vector<Entry> entries;
+		flFTP ftp;
+		Listing listing;
+		if(!Login(ftp, server) || ftp.List(path, listing) < 0)
+			return entries;
+		for(auto &entry : listing)
+			entries.push_back(Entry{entry.Name(), entry.type,
+					entry.type == ListEntry::File ? entry.size : -1, 0});
+		std::sort(entries.begin(), entries.end(),
+				[](const Entry &lhs, const Entry &rhs){ return lhs.name < rhs.name; });
+		return entries;
+	};
+
+	std::vector<Entry> mlsd = list("/list");
+	CHECK(mlsd.size() == 2);
+	CHECK(server.Commands("LIST") == 0);
+
+	/* refused, MLSD is tried once a session, LIST gives the same entries */
+	server.SetMlsd(false);
+	server.ResetStats();
+	flFTP ftp;
+	Listing listing;
+	CHECK(Login(ftp, server));
+	CHECK(ftp.List("/list", listing) == 0);
+	listing.Clear();
+	CHECK(ftp.List("/list/sub", listing) == 0);
+	CHECK(listing.Size() == 1 && listing[0].Name() == "b" && listing[0].size == 20);
+	CHECK(server.Commands("MLSD") == 1);
+	CHECK(server.Commands("LIST") == 2);
+	CHECK(list("/list") == mlsd);
+	if(mlsd.size() == 2)
+	{
+		CHECK(mlsd[0] == (Entry{"a file", ListEntry::File, 10, 0}));
+		CHECK(mlsd[1] == (Entry{"sub", ListEntry::Directory, -1, 0}));
+	}
+}
+
+
+static void TestResumeAfterAbort()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/resume/f", 300000);
+	const std::string dir = ScratchDir("resume");
+
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/resume") == 0);
+
+	/* cut short with a 426, what arrived is kept as the breakpoint */
+	server.DropDataAfter(100000);
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::NetworkAnomaly);
+	CHECK(points.Get("f") == 100000);
+	CHECK(FileSize(dir + "f") == 100000);
+
+	/* and the next download asks for the rest only */
+	server.ResetStats();
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.GetStats().bytesSent == 200000);
+	CHECK(server.Commands("REST") == 1);
+	CHECK(SameContent(dir + "f", 300000));
+	CHECK(points.Get("f") == (std::size_t)-1);
+}
+
+
+static void TestQueueRetry()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	const std::size_t sizes[] = {150000, 160000, 170000, 180000};
+	std::size_t total = 0;
+	for(std::size_t i = 0; i < 4; ++i)
+	{
+		server.AddFile("/queue/f" + std::to_string(i), sizes[i]);
+		total += sizes[i];
+	}
+	const std::string dir = ScratchDir("queue");
+
+	/* one RETR refused and one cut short: each is retried, the cut one resumed */
+	server.FailCommand("RETR", 550);
+	server.DropDataAfter(50000);
+	TransferQueue queue(2, 2, 2);
+	BreakPoints points;
+	points.Attach(queue);
+	std::mutex mt;
+	std::size_t called = 0;
+	queue.SetCallback([&](const TransferQueue::Job &, TransferState state, const std::string &)
+		{
+			std::lock_guard<std::mutex> lk(mt);
+			CHECK(state == TransferState::Done);
+			++called;
+		});
+	for(std::size_t i = 0; i < 4; ++i)
+	{
+		TransferQueue::Job job;
+		job.host = "127.0.0.1";
+		job.service = std::to_string(server.Port());
+		job.serverPath = "/queue";
+		job.localPath = dir;
+		job.filename = "f" + std::to_string(i);
+		queue.Add(job);
+	}
+	queue.Wait();
+
+	TransferQueue::Stats stats = queue.GetStats();
+	CHECK(stats.done == 4 && stats.failed == 0);
+	CHECK(stats.retries == 2);
+	CHECK(stats.bytes == total);
+	CHECK(called == 4);
+	CHECK(server.GetStats().bytesSent == total);
+	for(std::size_t i = 0; i < 4; ++i)
+		CHECK(SameContent(dir + "f" + std::to_string(i), sizes[i]));
+}
+
+
+static void TestQueueStop()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	for(int i = 0; i < 3; ++i)
+		server.AddFile("/stop/f" + std::to_string(i), 100000);
+	const std::string dir = ScratchDir("stop");
+
+	/* the workers are still logging in when Stop() comes */
+	server.SetLatency(std::chrono::milliseconds(30));
+	TransferQueue queue(2, 2, 2);
+	TransferQueue::Job job;
+	job.host = "127.0.0.1";
+	job.service = std::to_string(server.Port());
+	job.serverPath = "/stop";
+	job.localPath = dir;
+	for(int i = 0; i < 2; ++i)
+	{
+		job.filename = "f" + std::to_string(i);
+		queue.Add(job);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	queue.Stop();
+	queue.Wait();
+	TransferQueue::Stats stats = queue.GetStats();
+	CHECK(stats.done == 0 && stats.failed == 2 && stats.retries == 0);
+	CHECK(server.Commands("RETR") == 0);
+
+	/* a job added after Stop() runs */
+	server.SetLatency(std::chrono::microseconds(0));
+	job.filename = "f2";
+	queue.Add(job);
+	queue.Wait();
+	CHECK(queue.GetStats().done == 1);
+	CHECK(SameContent(dir + "f2", 100000));
+}
+
+
+static void TestSegmentedDownload()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	const std::size_t bigSize = (5 << 20) + 12345, smallSize = 300000;
+	server.AddFile("/seg/big", bigSize);
+	server.AddFile("/seg/small", smallSize);
+	const std::string dir = ScratchDir("seg");
+
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/seg") == 0);
+	/* four ranges of a file worth splitting, reassembled in place */
+	CHECK(ftp.SegmentedDownload("big", 4, dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.Commands("RETR") == 4);
+	CHECK(SameContent(dir + "big", bigSize));
+
+	/* one too small to split is fetched whole */
+	server.ResetStats();
+	CHECK(ftp.SegmentedDownload("small", 4, dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.Commands("RETR") == 1);
+	CHECK(SameContent(dir + "small", smallSize));
+
+	/* a range cut short fails the whole */
+	server.DropDataAfter(100000);
+	CHECK(ftp.SegmentedDownload("big", 4, dir) == 0);
+	CHECK(ftp.Wait() == TransferState::NetworkAnomaly);
+}
+
+
+/* The mapping holds the whole of a size byte file of the server */
+static bool SameMapping(const Rainbow::MappedData *mapped, std::size_t size)
+{
+	if(!mapped || mapped->Size() != size)
+		return false;
+	std::string expect(size, '\0');
+	Rainbow::LoopbackServer::Content(0, &expect[0], size);
+	return memcmp(mapped->Data(), expect.data(), size) == 0;
+}
+
+
+static void TestMapping()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/map/f", 400000);
+	server.AddFile("/map/m", 250000);
+	const std::string dir = ScratchDir("map");
+
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/map") == 0);
+
+	/* cut short, the mapped file keeps what arrived and is resumed */
+	ftp.SetMapping(MapFile);
+	server.DropDataAfter(150000);
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::NetworkAnomaly);
+	CHECK(!ftp.TakeMapping());
+	CHECK(points.Get("f") == 150000);
+	CHECK(FileSize(dir + "f") == 150000);
+
+	server.ResetStats();
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.GetStats().bytesSent == 250000);
+	CHECK(SameContent(dir + "f", 400000));
+	CHECK(SameMapping(ftp.TakeMapping().get(), 400000));
+
+	/* held in memory, a breakpoint is ignored and no file is written */
+	ftp.SetMapping(MapMemory);
+	points.Put("m", 100000);
+	server.ResetStats();
+	CHECK(ftp.Download("m", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.GetStats().bytesSent == 250000);
+	CHECK(FileSize(dir + "m") == (std::size_t)-1);
+	CHECK(SameMapping(ftp.TakeMapping().get(), 250000));
+}
+
+
+static void TestVerify()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/verify/f", 300000);
+	server.AddFile("/verify/g", 200000);
+	const std::string dir = ScratchDir("verify");
+
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/verify") == 0);
+	ftp.SetVerify(HashSha256, 50000);
+
+	/* cut short, then the tail of what arrived is spoiled */
+	server.DropDataAfter(100000);
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::NetworkAnomaly);
+	CHECK(points.Get("f") == 100000);
+	FILE *fp = fopen((dir + "f").c_str(), "r+b");
+	CHECK(fp && fseek(fp, 99000, SEEK_SET) == 0 && fputc(0xff, fp) != EOF);
+	if(fp)
+		fclose(fp);
+
+	/* the window before the breakpoint differs, so it all comes again */
+	server.ResetStats();
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(ftp.GetTransferStats().retries == 1);
+	CHECK(server.Commands("HASH") == 2);
+	CHECK(server.GetStats().bytesSent == 300000);
+	CHECK(SameContent(dir + "f", 300000));
+
+	/* a server refusing HASH is asked XCRC instead, and not asked HASH again */
+	ftp.SetVerify(HashCrc32);
+	server.FailCommand("OPTS", 500);
+	server.ResetStats();
+	CHECK(ftp.Download("g", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(ftp.Download("g", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.Commands("OPTS") == 1);
+	CHECK(server.Commands("HASH") == 0);
+	CHECK(server.Commands("XCRC") == 2);
+	CHECK(SameContent(dir + "g", 200000));
+}
+
+
+static void TestReactor()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	const std::size_t size = 600000;
+	for(int i = 0; i < 4; ++i)
+		server.AddFile("/reactor/f" + std::to_string(i), size + i);
+	server.AddFile("/reactor/slow", 2000000);
+	const std::string dir = ScratchDir("reactor");
+
+	/* four downloads at once on the two threads of the reactor */
+	Reactor reactor(2);
+	BreakPoints points;
+	std::vector<std::unique_ptr<flFTP>> sessions;
+	for(int i = 0; i < 4; ++i)
+	{
+		sessions.push_back(details::make_unique<flFTP>());
+		flFTP &ftp = *sessions.back();
+		points.Attach(ftp);
+		ftp.SetReactor(&reactor);
+		CHECK(Login(ftp, server));
+		CHECK(ftp.Cd("/reactor") == 0);
+	}
+	for(int i = 0; i < 4; ++i)
+		CHECK(sessions[i]->Download("f" + std::to_string(i), dir) == 0);
+	for(int i = 0; i < 4; ++i)
+	{
+		CHECK(sessions[i]->Wait() == TransferState::Done);
+		CHECK(SameContent(dir + "f" + std::to_string(i), size + i));
+	}
+	CHECK(reactor.Watching() == 0);
+
+	/* stopped midway, what arrived is kept as the breakpoint */
+	server.SetBandwidth(4000000);
+	flFTP &ftp = *sessions[0];
+	CHECK(ftp.Download("slow", dir) == 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	ftp.StopDownload();
+	CHECK(ftp.Wait() == TransferState::Suspend);
+	std::size_t offset = points.Get("slow");
+	CHECK(offset > 0 && offset < 2000000);
+	CHECK(FileSize(dir + "slow") != (std::size_t)-1 && FileSize(dir + "slow") >= offset);
+	CHECK(reactor.Watching() == 0);
+}
+
+
+/* Wait up to two seconds for done() to hold */
+template <typename Predicate>
+static bool Eventually(Predicate done)
+{
+	for(int i = 0; i < 2000 && !done(); ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return done();
+}
+
+
+/* Keeps what it was told last and how often */
+class RecordedProgress : public Rainbow::IProgress
+{
+	public:
+		virtual void OnProgress(const Rainbow::Progress &progress) override
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			_last = progress;
+			++_calls;
+		}
+
+		Rainbow::Progress Last()
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			return _last;
+		}
+
+		std::size_t Calls()
+		{
+			std::lock_guard<std::mutex> lk(_mt);
+			return _calls;
+		}
+
+	private:
+		std::mutex _mt;
+		Rainbow::Progress _last = Rainbow::Progress();
+		std::size_t _calls = 0;
+};
+
+
+static void TestProgressNotifier()
+{
+	using namespace Rainbow;
+	ProgressNotifier notifier(std::chrono::milliseconds(10));
+
+	/* Remove() waits for the tick it caught running */
+	int a, b, c;
+	std::atomic_bool entered{false}, left{false};
+	notifier.Add(&a, [&]
+		{
+			entered = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			left = true;
+			return true;
+		});
+	CHECK(Eventually([&]{ return entered.load(); }));
+	notifier.Remove(&a);
+	CHECK(left);
+
+	/* Flush() calls it at once and waits, the interval notwithstanding */
+	notifier.SetInterval(std::chrono::seconds(10));
+	std::atomic_int calls{0};
+	notifier.Add(&b, [&]{ ++calls; return true; });
+	notifier.Flush(&b);
+	CHECK(calls == 1);
+	notifier.Flush(&b);
+	CHECK(calls == 2);
+
+	/* from within a tick both return at once, and the tick is gone */
+	notifier.Add(&c, [&]
+		{
+			++calls;
+			notifier.Flush(&c);
+			notifier.Remove(&c);
+			return true;
+		});
+	calls = 0;
+	notifier.Flush(&c);
+	CHECK(calls == 1);
+	notifier.Flush(&c);
+	CHECK(calls == 1);
+
+	/* a tick replaced while it runs cannot remove its successor */
+	std::atomic_bool release{false};
+	entered = false;
+	notifier.Add(&a, [&]
+		{
+			entered = true;
+			while(!release)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			return false;
+		});
+	std::thread flusher([&]{ notifier.Flush(&a); });
+	CHECK(Eventually([&]{ return entered.load(); }));
+	calls = 0;
+	notifier.Add(&a, [&]{ ++calls; return true; });
+	release = true;
+	flusher.join();
+	notifier.Flush(&a);
+	CHECK(calls == 1);
+	notifier.Remove(&a);
+	notifier.Remove(&b);
+
+	/* an observer of a download hears of its end, done and complete */
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/progress/f", 500000);
+	const std::string dir = ScratchDir("progress");
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	RecordedProgress observer;
+	ftp.AddIProgress(&observer);
+	ftp.SetProgressNotifier(&notifier);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/progress") == 0);
+	CHECK(ftp.Download("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(Eventually([&]{ return observer.Last().done; }));
+	Rainbow::Progress last = observer.Last();
+	CHECK(last.done && last.bytes == 500000 && last.total == 500000 && last.fraction == 1);
+	ftp.RemoveIProgress(&observer);
+}
+
+
+static void TestMirrorRetry()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	for(int i = 0; i < 6; ++i)
+		server.AddFile("/tree/d" + std::to_string(i % 2) + "/f" + std::to_string(i), 20000 + i);
+	const std::string dir = Scratch("tree");
+
+	flFTP ftp;
+	CHECK(Login(ftp, server));
+	/* a file refused and another cut short fail the run, the rest is fetched */
+	server.FailCommand("RETR", 550);
+	server.DropDataAfter(5000);
+	flFTP::MirrorStats stats;
+	CHECK(ftp.Mirror("/tree", dir, 2, &stats) < 0);
+	CHECK(stats.directories == 3 && stats.files == 6);
+	CHECK(stats.downloaded == 4 && stats.failed == 2);
+
+	/* the next run fetches those two again, in full, and skips the others */
+	server.ResetStats();
+	CHECK(ftp.Mirror("/tree", dir, 2, &stats) == 0);
+	CHECK(stats.downloaded == 2 && stats.skipped == 4 && stats.failed == 0);
+	CHECK(server.Commands("RETR") == 2);
+	for(int i = 0; i < 6; ++i)
+		CHECK(SameContent(dir + "/d" + std::to_string(i % 2) + "/f" + std::to_string(i), 20000 + i));
+}
+
+
+static void TestMirrorBadNames()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/evil/ok", 1000);
+	server.AddListed("/evil", "../escaped", false);
+	server.AddListed("/evil", "sub/../../climbed", true);
+	server.AddListed("/evil", "..", true);
+	const std::string dir = Scratch("evil");
+
+	/* names that would leave the local tree fail the run and are not touched */
+	for(bool mlsd : {true, false})
+	{
+		server.SetMlsd(mlsd);
+		server.ResetStats();
+		flFTP ftp;
+		CHECK(Login(ftp, server));
+		flFTP::MirrorStats stats;
+		CHECK(ftp.Mirror("/evil", dir, 1, &stats) < 0);
+		CHECK(stats.directories == 1 && stats.files == 1 && stats.failed == 2);
+		/* the second run finds ok up to date */
+		CHECK(server.Commands("RETR") == (mlsd ? 1u : 0u));
+		CHECK(FileSize(Scratch("escaped")) == (std::size_t)-1);
+		CHECK(FileSize(Scratch("climbed")) == (std::size_t)-1);
+		CHECK(FileSize(dir + "/sub") == (std::size_t)-1);
+		CHECK(SameContent(dir + "/ok", 1000));
+	}
+}
+
+
+static void TestUploadFailure()
+{
+	using namespace Rainbow;
+	LoopbackServer server;
+	CHECK(server.Start() == 0);
+	server.AddFile("/up/f", 100000);
+	const std::string dir = ScratchDir("up");
+	CHECK(WriteContent(dir + "f", 50000));
+
+	flFTP ftp;
+	BreakPoints points;
+	points.Attach(ftp);
+	CHECK(Login(ftp, server));
+	CHECK(ftp.Cd("/up") == 0);
+
+	/* nothing to send, the server is not asked to store anything */
+	CHECK(ftp.Upload("missing", dir) < 0);
+	CHECK(ftp.Upload("f", Scratch("none") + '/') < 0);
+	/* nor when the breakpoint is past the end of the local file */
+	points.Put("f", 80000);
+	CHECK(ftp.Upload("f", dir) < 0);
+	CHECK(server.Commands("STOR") == 0 && server.Commands("APPE") == 0);
+	CHECK(ftp.Noop() == 0);
+
+	/* and the session goes on */
+	points.Put("f", 20000);
+	server.ResetStats();
+	CHECK(ftp.Upload("f", dir) == 0);
+	CHECK(ftp.Wait() == TransferState::Done);
+	CHECK(server.Commands("APPE") == 1);
+	CHECK(server.GetStats().bytesReceived == 30000);
+	CHECK(ftp.Noop() == 0);
+}
+
+
+struct TestCase
+{
+	const char *name;
+	void (*run)();
+};
+
+static const TestCase tests[] = {
+	{"journal_torn_tail", TestJournalTornTail},
+	{"journal_compact", TestJournalCompact},
+	{"hash_known_answers", TestHashKnownAnswers},
+	{"local_text", TestLocalText},
+	{"list_parser", TestListParser},
+	{"mirror_cache", TestMirrorCache},
+	{"reply_buffer", TestReplyBuffer},
+	{"rate_limiter", TestRateLimiter},
+	{"histogram", TestHistogram},
+	{"pipeline_fallback", TestPipelineFallback},
+	{"mlsd_fallback", TestMlsdFallback},
+	{"resume_after_abort", TestResumeAfterAbort},
+	{"queue_retry", TestQueueRetry},
+	{"queue_stop", TestQueueStop},
+	{"segmented_download", TestSegmentedDownload},
+	{"mapping", TestMapping},
+	{"verify", TestVerify},
+	{"reactor", TestReactor},
+	{"progress_notifier", TestProgressNotifier},
+	{"mirror_retry", TestMirrorRetry},
+	{"upload_failure", TestUploadFailure},
+	{"mirror_bad_names", TestMirrorBadNames},
+};
+
+#endif
+
+
+/*
+ * flTest [name...]		run the checks, or those whose names are given
+ * flTest --demo		download from a public server instead
+ */
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && strcmp(argv[1], "--demo") == 0)
+		return Demo();
+
+#ifndef _WIN32
+	int run = 0;
+	for(auto &test : tests)
+	{
+		bool wanted = (argc == 1);
+		for(int i = 1; i < argc; ++i)
+			wanted = wanted || strcmp(argv[i], test.name) == 0;
+		if(!wanted)
+			continue;
+		int before = failures;
+		test.run();
+		printf("%-24s %s\n", test.name, failures == before ? "ok" : "FAILED");
+		++run;
+	}
+	RemoveScratch();
+	printf("%d cases, %d failed checks\n", run, failures);
+	return failures == 0 ? 0 : 1;
+#else
+	return Demo();
+#endif
+}